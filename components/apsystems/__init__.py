@@ -2,18 +2,61 @@ import re
 from esphome import pins
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import uart, time
-from esphome.const import CONF_ID, CONF_RESTORE, CONF_TIME_ID
+from esphome.components import uart, time, sensor
+from esphome.const import (
+    CONF_DURATION,
+    CONF_ID,
+    CONF_PLATFORM,
+    CONF_RESTORE,
+    CONF_SENSOR,
+    CONF_TIME_ID,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_TOTAL_INCREASING,
+    STATE_CLASS_MEASUREMENT,
+    UNIT_MILLISECOND,
+    UNIT_PERCENT,
+    UNIT_SECOND,
+)
+from esphome.core import CORE
 from esphome import automation
+import esphome.final_validate as fv
 
 CODEOWNERS = ["@derrohrbach"]
 
 DEPENDENCIES = ["uart", "time"]
+AUTO_LOAD = ["sensor"]
 
+CONF_APSYSTEMS_ID = "apsystems_id"
 CONF_AUTO_PAIR = "auto_pair"
 CONF_COORDINATOR_RESET_PIN = "coordinator_reset_pin"
 CONF_COORDINATOR_ID = "coordinator_id"
 CONF_SERIAL = "serial"
+CONF_COMMIT_INTERVAL = "commit_interval"
+CONF_PREFERENCES_BYTES_WRITTEN = "preferences_bytes_written"
+CONF_PREFERENCES_COMMITS_TODAY = "preferences_commits_today"
+CONF_HEALTHCHECK_QUIET_PERIOD = "healthcheck_quiet_period"
+CONF_HEALTHCHECK_TIME = "healthcheck_time"
+CONF_RECOVERY_TIME = "recovery_time"
+CONF_LOOP_TIME = "loop_time"
+CONF_POLL_RTT_P50 = "poll_rtt_p50"
+CONF_POLL_RTT_P95 = "poll_rtt_p95"
+CONF_POLL_SUCCESS_RATIO = "poll_success_ratio"
+CONF_RESETS_TODAY = "resets_today"
+CONF_SWEEP_TIME = "sweep_time"
+CONF_CAPTURE_SIZE = "capture_size"
+CONF_CAPTURE = "capture"
+CONF_STATE_PROFILING = "state_profiling"
+UNIT_BYTES = "B"
+
+# the esp8266 keeps all preferences stored in flash in 128 words of 32 bit
+ESP8266_FLASH_PREFERENCE_WORDS = 128
+# packed sizes of PreferenceBlob and FleetBlob
+PREFERENCE_HEADER_SIZE = 5
+PREFERENCE_RECORD_SIZE = 42
+PREFERENCE_SLOT_RECORDS = 5
+FLEET_HEADER_SIZE = 4
+FLEET_RECORD_SIZE = 5
+FLEET_SLOT_RECORDS = 16
 
 apsystems_ns = cg.esphome_ns.namespace("apsystems")
 Apsystems = apsystems_ns.class_("Apsystems", cg.Component, uart.UARTDevice)
@@ -26,6 +69,15 @@ ApsystemsPollInverterAction = apsystems_ns.class_(
 ApsystemsRebootInverterAction = apsystems_ns.class_(
     "ApsystemsRebootInverterAction", automation.Action
 )
+ApsystemsDumpCaptureAction = apsystems_ns.class_(
+    "ApsystemsDumpCaptureAction", automation.Action
+)
+ApsystemsReplayCaptureAction = apsystems_ns.class_(
+    "ApsystemsReplayCaptureAction", automation.Action
+)
+ApsystemsDiscoverInvertersAction = apsystems_ns.class_(
+    "ApsystemsDiscoverInvertersAction", automation.Action
+)
 
 
 MULTI_CONF = True
@@ -45,6 +97,74 @@ CONFIG_SCHEMA = (
             cv.GenerateID(): cv.declare_id(Apsystems),
             cv.GenerateID(CONF_TIME_ID): cv.use_id(time.RealTimeClock),
             cv.Optional(CONF_RESTORE, False): cv.boolean,
+            cv.Optional(
+                CONF_COMMIT_INTERVAL, default="15min"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_PREFERENCES_BYTES_WRITTEN): sensor.sensor_schema(
+                unit_of_measurement=UNIT_BYTES,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_PREFERENCES_COMMITS_TODAY): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(
+                CONF_HEALTHCHECK_QUIET_PERIOD, default="60s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_HEALTHCHECK_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_SECOND,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_TOTAL_INCREASING,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_RECOVERY_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_SECOND,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_LOOP_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=2,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_POLL_RTT_P50): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_POLL_RTT_P95): sensor.sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_POLL_SUCCESS_RATIO): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_RESETS_TODAY): sensor.sensor_schema(
+                accuracy_decimals=0,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_SWEEP_TIME): sensor.sensor_schema(
+                unit_of_measurement=UNIT_SECOND,
+                accuracy_decimals=1,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_CAPTURE_SIZE, default=2048): cv.int_range(
+                min=0, max=65535
+            ),
+            cv.Optional(CONF_STATE_PROFILING, default=False): cv.boolean,
             cv.Optional(CONF_AUTO_PAIR, True): cv.boolean,
             cv.Optional(CONF_COORDINATOR_ID, "46AF3B742134"): coordinator_id,
             cv.Required(CONF_COORDINATOR_RESET_PIN): pins.gpio_output_pin_schema,
@@ -55,13 +175,98 @@ CONFIG_SCHEMA = (
 )
 
 
+def inverter_count(config, apsystems_id=None):
+    return sum(
+        1
+        for conf in config.get(CONF_SENSOR, [])
+        if conf[CONF_PLATFORM] == "apsystems"
+        and (apsystems_id is None or conf[CONF_APSYSTEMS_ID].id == apsystems_id.id)
+    )
+
+
+def preference_words(header_size, record_size, records):
+    # data rounded up to words, plus the word of the preference crc
+    return (header_size + record_size * records + 3) // 4 + 1
+
+
+def final_validate(config):
+    if not CORE.is_esp8266 or not config[CONF_RESTORE]:
+        return config
+    full_config = fv.full_config.get()
+    inverters = max(inverter_count(full_config), 1)
+    # every component stores its inverters in slots of a fixed size
+    slot_words = preference_words(
+        PREFERENCE_HEADER_SIZE, PREFERENCE_RECORD_SIZE, PREFERENCE_SLOT_RECORDS
+    )
+    words = 0
+    for conf in full_config["apsystems"]:
+        if conf[CONF_RESTORE]:
+            component_inverters = inverter_count(full_config, conf[CONF_ID])
+            slots = (
+                component_inverters + PREFERENCE_SLOT_RECORDS - 1
+            ) // PREFERENCE_SLOT_RECORDS
+            words += slots * slot_words
+    if "apsystems_fleet" in full_config:
+        fleet_slots = (inverters + FLEET_SLOT_RECORDS - 1) // FLEET_SLOT_RECORDS
+        words += fleet_slots * preference_words(
+            FLEET_HEADER_SIZE, FLEET_RECORD_SIZE, FLEET_SLOT_RECORDS
+        )
+    if words > ESP8266_FLASH_PREFERENCE_WORDS:
+        raise cv.Invalid(
+            f"The preferences of {inverters} inverters need {words * 4} bytes, the "
+            f"esp8266 stores at most {ESP8266_FLASH_PREFERENCE_WORDS * 4} bytes of "
+            f"preferences in flash. Set {CONF_RESTORE} to false or use an esp32",
+            [CONF_RESTORE],
+        )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = final_validate
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
     cg.add(var.set_restore(config[CONF_RESTORE]))
+    cg.add(var.set_commit_interval(config[CONF_COMMIT_INTERVAL]))
+    if CONF_PREFERENCES_BYTES_WRITTEN in config:
+        sens = await sensor.new_sensor(config[CONF_PREFERENCES_BYTES_WRITTEN])
+        cg.add(var.set_bytes_written_sensor(sens))
+    if CONF_PREFERENCES_COMMITS_TODAY in config:
+        sens = await sensor.new_sensor(config[CONF_PREFERENCES_COMMITS_TODAY])
+        cg.add(var.set_commits_today_sensor(sens))
+    cg.add(var.set_healthcheck_quiet_period(config[CONF_HEALTHCHECK_QUIET_PERIOD]))
+    if CONF_HEALTHCHECK_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_HEALTHCHECK_TIME])
+        cg.add(var.set_healthcheck_time_sensor(sens))
+    if CONF_RECOVERY_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_RECOVERY_TIME])
+        cg.add(var.set_recovery_time_sensor(sens))
+    if CONF_LOOP_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_LOOP_TIME])
+        cg.add(var.set_loop_time_sensor(sens))
+    if CONF_POLL_RTT_P50 in config:
+        sens = await sensor.new_sensor(config[CONF_POLL_RTT_P50])
+        cg.add(var.set_poll_rtt_p50_sensor(sens))
+    if CONF_POLL_RTT_P95 in config:
+        sens = await sensor.new_sensor(config[CONF_POLL_RTT_P95])
+        cg.add(var.set_poll_rtt_p95_sensor(sens))
+    if CONF_POLL_SUCCESS_RATIO in config:
+        sens = await sensor.new_sensor(config[CONF_POLL_SUCCESS_RATIO])
+        cg.add(var.set_poll_success_ratio_sensor(sens))
+    if CONF_RESETS_TODAY in config:
+        sens = await sensor.new_sensor(config[CONF_RESETS_TODAY])
+        cg.add(var.set_resets_today_sensor(sens))
+    if CONF_SWEEP_TIME in config:
+        sens = await sensor.new_sensor(config[CONF_SWEEP_TIME])
+        cg.add(var.set_sweep_time_sensor(sens))
+    cg.add(var.set_capture_size(config[CONF_CAPTURE_SIZE]))
+    cg.add(var.set_state_profiling(config[CONF_STATE_PROFILING]))
     cg.add(var.set_auto_pair(config[CONF_AUTO_PAIR]))
     cg.add(var.set_ecu_id(config[CONF_COORDINATOR_ID]))
+    time_ = await cg.get_variable(config[CONF_TIME_ID])
+    cg.add(var.set_time(time_))
 
     reset_pin = await cg.gpio_pin_expression(config[CONF_COORDINATOR_RESET_PIN])
     cg.add(var.set_reset_pin(reset_pin))
@@ -90,3 +295,54 @@ async def actions_to_code(config, action_id, template_arg, args):
     template_ = await cg.templatable(config[CONF_SERIAL], args, cg.std_string)
     cg.add(var.set_serial(template_))
     return var
+
+
+@automation.register_action(
+    "apsystems.dump_capture",
+    ApsystemsDumpCaptureAction,
+    cv.Schema({cv.Required(CONF_ID): cv.use_id(Apsystems)}),
+)
+async def dump_capture_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    return cg.new_Pvariable(action_id, template_arg, paren)
+
+
+@automation.register_action(
+    "apsystems.replay_capture",
+    ApsystemsReplayCaptureAction,
+    cv.All(
+        cv.Schema(
+            {
+                cv.Required(CONF_ID): cv.use_id(Apsystems),
+                cv.Required(CONF_CAPTURE): cv.templatable(cv.string),
+            }
+        ),
+        cv.only_on("host"),
+    ),
+)
+async def replay_capture_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    template_ = await cg.templatable(config[CONF_CAPTURE], args, cg.std_string)
+    cg.add(var.set_capture(template_))
+    return var
+
+
+@automation.register_action(
+    "apsystems.discover_inverters",
+    ApsystemsDiscoverInvertersAction,
+    cv.Schema(
+        {
+            cv.Required(CONF_ID): cv.use_id(Apsystems),
+            cv.Optional(
+                CONF_DURATION, default="10s"
+            ): cv.templatable(cv.positive_time_period_milliseconds),
+        }
+    ),
+)
+async def discover_inverters_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    template_ = await cg.templatable(config[CONF_DURATION], args, cg.uint32)
+    cg.add(var.set_duration(template_))
+    return var
@@ -1,5 +1,9 @@
 #include "apsystems.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
 
 namespace esphome {
 namespace apsystems {
@@ -13,23 +17,74 @@ void Apsystems::setup() {
   reset_pin_->pin_mode(gpio::Flags::FLAG_OUTPUT);
   coordinator_.set_reset_pin(reset_pin_);
   coordinator_.set_uart_device(this);
+  store_.allocate();
+  coordinator_.get_capture().allocate(capture_size_);
+  if (restore_) {
+    for (auto inv : inverters_)
+      preferences_.add_inverter(inv);
+    preferences_.load(std::string("apsystems_") + ecu_id_);
+  }
   bool needs_pairing = false;
   for (auto inv : inverters_) {
-    if (restore_)
-      inv->enable_restore();
     if (!inv->is_paired())
       needs_pairing = true;
     coordinator_.add_inverter(inv);
   }
+  coordinator_.build_index();
+  coordinator_.start_poll_scheduler(get_update_interval());
   coordinator_.restart(ecu_id_, false);
   if (auto_pair_ && needs_pairing)
     coordinator_.start_pair_inverter("*");
-  run_coordinator();
 }
 
-void Apsystems::update() { coordinator_.start_poll_inverter("*"); }
+// Polls are driven by the poll scheduler of the coordinator, update_interval is the default interval per inverter
+// the loop time sensor reports the longest loop of every update interval
+void Apsystems::update() {
+  if (loop_time_sensor_ != nullptr)
+    loop_time_sensor_->publish_state(loop_time_max_ / 1000.0f);
+  loop_time_max_ = 0;
+  publish_metrics_();
+}
+
+void Apsystems::publish_metrics_() {
+  const CoordinatorMetrics &m = coordinator_.get_metrics();
+  uint32_t polls = m.polls - polls_published_;
+  uint32_t failed = m.failed_polls - failed_polls_published_;
+  polls_published_ = m.polls;
+  failed_polls_published_ = m.failed_polls;
+  if (polls > 0) {
+    if (poll_rtt_p50_sensor_ != nullptr && m.poll_rtt.get_count() > 0)
+      poll_rtt_p50_sensor_->publish_state(m.poll_rtt.percentile(50));
+    if (poll_rtt_p95_sensor_ != nullptr && m.poll_rtt.get_count() > 0)
+      poll_rtt_p95_sensor_->publish_state(m.poll_rtt.percentile(95));
+    if (poll_success_ratio_sensor_ != nullptr)
+      poll_success_ratio_sensor_->publish_state((polls - failed) * 100.0f / polls);
+  }
+  if (resets_today_sensor_ != nullptr)
+    resets_today_sensor_->publish_state(m.resets_today);
+  if (sweep_time_sensor_ != nullptr && m.sweeps != sweeps_published_)
+    sweep_time_sensor_->publish_state(m.sweep_time / 1000.0f);
+  sweeps_published_ = m.sweeps;
+}
 
 void Apsystems::loop() {
+  uint32_t start = micros();
+  coordinator_.loop();
+  preferences_.loop(millis());
+  publish_flash_wear_();
+  publish_healthcheck_time_();
+  check_day_();
+
+  uint32_t elapsed = micros() - start;
+  loop_time_max_ = std::max(loop_time_max_, elapsed);
+  loop_time_peak_ = std::max(loop_time_peak_, elapsed);
+  if (elapsed > APSYSTEMS_LOOP_BUDGET_US) {
+    loop_overruns_++;
+    ESP_LOGV(TAG, "loop took %uus, over the budget of %uus", (unsigned) elapsed, (unsigned) APSYSTEMS_LOOP_BUDGET_US);
+  }
+}
+
+void Apsystems::check_day_() {
   auto t = time_->now();
   if (!t.is_valid())
     return;
@@ -41,33 +96,115 @@ void Apsystems::loop() {
 
   if (t.day_of_year != last_day_of_year_) {
     last_day_of_year_ = t.day_of_year;
-    for (auto inv : inverters_) {
-      InverterData data = inv->get_data();
-      for (int i = 0; i < 5; i++)
-        data.energy_today[i] = 0;
-      inv->set_data(data);
-    }
+    for (auto inv : inverters_)
+      inv->reset_energy_today();
+    // the energy of the day is final now
+    preferences_.commit();
+    preferences_.start_day();
+    coordinator_.start_day();
+    publish_flash_wear_(true);
+  }
+}
+
+void Apsystems::adopt_inverter(Inverter *inverter, bool pair, CommandCallback &&callback) {
+  coordinator_.add_inverter(inverter);
+  if (pair) {
+    coordinator_.start_pair_inverter(inverter->get_serial(), std::move(callback));
+  } else if (callback) {
+    callback(true);
+  }
+}
+
+void Apsystems::dump_capture() {
+  if (!coordinator_.get_capture().is_enabled()) {
+    ESP_LOGW(TAG, "Frame capture is disabled");
+    return;
   }
+  coordinator_.get_capture().dump(TAG);
 }
 
-void Apsystems::run_coordinator() {
-  coordinator_.run();
-  set_timeout(coordinator_.get_delay_to_next_execution(), [&]() { run_coordinator(); });
+#ifdef USE_HOST
+void Apsystems::replay_capture(const std::string &capture) {
+  if (!coordinator_.replay_capture(base64_decode(capture)))
+    ESP_LOGE(TAG, "The capture to replay is malformed");
 }
+#endif
 
-void Apsystems::pair_inverter(std::string serial) { coordinator_.start_pair_inverter(serial.c_str()); }
-void Apsystems::poll_inverter(std::string serial) { coordinator_.start_poll_inverter(serial.c_str()); }
-void Apsystems::reboot_inverter(std::string serial) { coordinator_.start_reboot_inverter(serial.c_str()); }
+void Apsystems::on_shutdown() { preferences_.commit(); }
+
+void Apsystems::publish_healthcheck_time_() {
+  if (recovery_time_sensor_ != nullptr && coordinator_.get_recoveries() != recoveries_published_) {
+    recoveries_published_ = coordinator_.get_recoveries();
+    recovery_time_sensor_->publish_state(coordinator_.get_recovery_time() / 1000.0f);
+  }
+  if (healthcheck_time_sensor_ == nullptr || coordinator_.get_healthchecks() == healthchecks_published_)
+    return;
+  healthchecks_published_ = coordinator_.get_healthchecks();
+  healthcheck_time_sensor_->publish_state(coordinator_.get_healthcheck_time() / 1000.0f);
+}
+
+void Apsystems::publish_flash_wear_(bool force) {
+  if (!force && preferences_.get_commits() == commits_published_)
+    return;
+  commits_published_ = preferences_.get_commits();
+  if (bytes_written_sensor_ != nullptr)
+    bytes_written_sensor_->publish_state(preferences_.get_bytes_written());
+  if (commits_today_sensor_ != nullptr)
+    commits_today_sensor_->publish_state(preferences_.get_commits_today());
+}
+
+void Apsystems::pair_inverter(const char *serial, CommandCallback &&callback) {
+  coordinator_.start_pair_inverter(serial, std::move(callback));
+}
+void Apsystems::poll_inverter(const char *serial, CommandCallback &&callback) {
+  coordinator_.start_poll_inverter(serial, std::move(callback));
+}
+void Apsystems::reboot_inverter(const char *serial, CommandCallback &&callback) {
+  coordinator_.start_reboot_inverter(serial, std::move(callback));
+}
+void Apsystems::discover_inverters(uint32_t duration, CommandCallback &&callback) {
+  coordinator_.start_discovery(duration, std::move(callback));
+}
 void Apsystems::set_restore(bool restore) { restore_ = restore; }
 void Apsystems::set_auto_pair(bool auto_pair) { auto_pair_ = auto_pair; }
-void Apsystems::set_ecu_id(std::string ecu_id) { ecu_id.copy(ecu_id_, 12, 0); }
-void Apsystems::add_inverter(Inverter *inverter) { this->inverters_.push_back(inverter); }
+void Apsystems::set_ecu_id(const char *ecu_id) { strncpy(ecu_id_, ecu_id, sizeof(ecu_id_) - 1); }
+void Apsystems::add_inverter(Inverter *inverter) {
+  inverter->set_store(&store_, store_.add_slot());
+  this->inverters_.push_back(inverter);
+}
 void Apsystems::set_reset_pin(GPIOPin *pin) { reset_pin_ = pin; }
 void Apsystems::dump_config() {
   ESP_LOGCONFIG(TAG, "APsystems:");
   this->check_uart_settings(115200, 1, uart::UART_CONFIG_PARITY_NONE, 8);
   LOG_PIN("  Reset Pin: ", reset_pin_);
   LOG_UPDATE_INTERVAL(this);
+  ESP_LOGCONFIG(TAG, "  Health check after %us without traffic: %u checks, %ums",
+                (unsigned) (coordinator_.get_healthcheck_quiet_period() / 1000),
+                (unsigned) coordinator_.get_healthchecks(), (unsigned) coordinator_.get_healthcheck_time());
+  if (coordinator_.get_recoveries() > 0)
+    ESP_LOGCONFIG(TAG, "  Recoveries: %u, the last took %ums", (unsigned) coordinator_.get_recoveries(),
+                  (unsigned) coordinator_.get_recovery_time());
+  coordinator_.dump_config();
+  if (coordinator_.get_capture().is_enabled()) {
+    const FrameCapture &capture = coordinator_.get_capture();
+    ESP_LOGCONFIG(TAG, "  Frame capture: %u bytes, %u frames captured, %u dropped", (unsigned) capture.get_size(),
+                  (unsigned) capture.get_frames(), (unsigned) capture.get_dropped());
+  }
+  if (!inverters_.empty()) {
+    // the inverter itself, its values in the store and its share of the sensor registry
+    size_t sensors = store_.sensor_count() * sizeof(SensorEntry);
+    ESP_LOGCONFIG(TAG, "  RAM per inverter: %u bytes (%u values, %u sensors)",
+                  (unsigned) (sizeof(Inverter) + InverterStore::slot_size() + sensors / inverters_.size()),
+                  (unsigned) InverterStore::slot_size(), (unsigned) (sensors / inverters_.size()));
+  }
+  ESP_LOGCONFIG(TAG, "  Loop time: longest %uus, %u over the budget of %uus", (unsigned) loop_time_peak_,
+                (unsigned) loop_overruns_, (unsigned) APSYSTEMS_LOOP_BUDGET_US);
+  if (restore_) {
+    ESP_LOGCONFIG(TAG, "  Preferences: %u bytes, committed every %us at most", (unsigned) sizeof(PreferenceBlob),
+                  (unsigned) (preferences_.get_commit_interval() / 1000));
+    ESP_LOGCONFIG(TAG, "    Commits: %u, %u today, %u bytes written", (unsigned) preferences_.get_commits(),
+                  (unsigned) preferences_.get_commits_today(), (unsigned) preferences_.get_bytes_written());
+  }
   ESP_LOGCONFIG(TAG, "  Configured inverters:");
   for (auto inv : inverters_) {
     ESP_LOGCONFIG(TAG, "    Serial: %s", inv->get_serial());
@@ -5,13 +5,18 @@
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
 #include "esphome/components/uart/uart.h"
+#include "esphome/components/sensor/sensor.h"
 #include "esphome/components/time/real_time_clock.h"
 #include "zigbee_coordinator.h"
 #include "inverter.h"
+#include "preference_store.h"
 
 namespace esphome {
 namespace apsystems {
 
+// The main loop should never wait on the coordinator, a loop of the component longer than this counts as an overrun
+static const uint32_t APSYSTEMS_LOOP_BUDGET_US = 1000;
+
 class Apsystems : public PollingComponent, public uart::UARTDevice {
  public:
   float get_setup_priority() const override;
@@ -20,20 +25,80 @@ class Apsystems : public PollingComponent, public uart::UARTDevice {
   void dump_config() override;
   void set_time(time::RealTimeClock *time) { time_ = time; }
   void add_inverter(Inverter *inverter);
-  void pair_inverter(std::string serial);
-  void poll_inverter(std::string serial);
-  void reboot_inverter(std::string serial);
+  const std::vector<Inverter *> &get_inverters() const { return inverters_; }
+  // The fleet manager moves the radio link of inverters between components. An inverter keeps its values and
+  // preferences at the component it is configured at, only its coordinator changes.
+  ZigbeeCoordinator &get_coordinator() { return coordinator_; }
+  bool release_inverter(Inverter *inverter) { return coordinator_.remove_inverter(inverter); }
+  // Takes over the link of an inverter, pair re-pairs it with this coordinator
+  void adopt_inverter(Inverter *inverter, bool pair, CommandCallback &&callback = nullptr);
+  void pair_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  void poll_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  void reboot_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  // Scans the channel for inverters and logs what it found, duration in ms
+  void discover_inverters(uint32_t duration, CommandCallback &&callback = nullptr);
   void set_reset_pin(GPIOPin *pin);
   void set_restore(bool restore);
-  void set_ecu_id(std::string ecu_id);
+  void set_commit_interval(uint32_t commit_interval) { preferences_.set_commit_interval(commit_interval); }
+  void set_bytes_written_sensor(sensor::Sensor *sensor) { bytes_written_sensor_ = sensor; }
+  void set_commits_today_sensor(sensor::Sensor *sensor) { commits_today_sensor_ = sensor; }
+  void set_healthcheck_quiet_period(uint32_t quiet_period) { coordinator_.set_healthcheck_quiet_period(quiet_period); }
+  void set_healthcheck_time_sensor(sensor::Sensor *sensor) { healthcheck_time_sensor_ = sensor; }
+  void set_recovery_time_sensor(sensor::Sensor *sensor) { recovery_time_sensor_ = sensor; }
+  void set_loop_time_sensor(sensor::Sensor *sensor) { loop_time_sensor_ = sensor; }
+  void set_poll_rtt_p50_sensor(sensor::Sensor *sensor) { poll_rtt_p50_sensor_ = sensor; }
+  void set_poll_rtt_p95_sensor(sensor::Sensor *sensor) { poll_rtt_p95_sensor_ = sensor; }
+  void set_poll_success_ratio_sensor(sensor::Sensor *sensor) { poll_success_ratio_sensor_ = sensor; }
+  void set_resets_today_sensor(sensor::Sensor *sensor) { resets_today_sensor_ = sensor; }
+  void set_sweep_time_sensor(sensor::Sensor *sensor) { sweep_time_sensor_ = sensor; }
+  // Bytes of raw uart frames kept for apsystems.dump_capture, 0 disables the capture
+  void set_capture_size(uint32_t capture_size) { capture_size_ = capture_size; }
+  void set_state_profiling(bool state_profiling) { coordinator_.set_state_profiling(state_profiling); }
+  void dump_capture();
+#ifdef USE_HOST
+  // Replays a base64 capture as logged by dump_capture
+  void replay_capture(const std::string &capture);
+#endif
+  void set_ecu_id(const char *ecu_id);
   void set_auto_pair(bool auto_pair);
   void update();
   void loop();
+  // Commits the preferences before a reboot or an OTA update
+  void on_shutdown() override;
 
  protected:
-  void run_coordinator();
+  // Publishes the flash wear counters after a commit
+  void publish_flash_wear_(bool force = false);
+  // Publishes the time spent in health checks after a check and the time to recovery after a recovery
+  void publish_healthcheck_time_();
+  // Publishes the poll and coordinator metrics of the last update interval
+  void publish_metrics_();
+  // Resets the energy of the day at midnight
+  void check_day_();
   time::RealTimeClock *time_;
   ZigbeeCoordinator coordinator_;
+  InverterStore store_;
+  PreferenceStore preferences_;
+  sensor::Sensor *bytes_written_sensor_{nullptr};
+  sensor::Sensor *commits_today_sensor_{nullptr};
+  uint32_t commits_published_ = 0;
+  sensor::Sensor *healthcheck_time_sensor_{nullptr};
+  uint32_t healthchecks_published_ = 0;
+  sensor::Sensor *recovery_time_sensor_{nullptr};
+  uint32_t recoveries_published_ = 0;
+  sensor::Sensor *loop_time_sensor_{nullptr};
+  uint32_t loop_time_max_ = 0;   // [µs] longest loop since the last update
+  uint32_t loop_time_peak_ = 0;  // [µs] longest loop since boot
+  uint32_t loop_overruns_ = 0;
+  sensor::Sensor *poll_rtt_p50_sensor_{nullptr};
+  sensor::Sensor *poll_rtt_p95_sensor_{nullptr};
+  sensor::Sensor *poll_success_ratio_sensor_{nullptr};
+  sensor::Sensor *resets_today_sensor_{nullptr};
+  sensor::Sensor *sweep_time_sensor_{nullptr};
+  uint32_t polls_published_ = 0;
+  uint32_t failed_polls_published_ = 0;
+  uint32_t sweeps_published_ = 0;
+  uint32_t capture_size_ = CAPTURE_DEFAULT_SIZE;
   std::vector<Inverter*> inverters_{};
   GPIOPin *reset_pin_;
   bool auto_pair_ = false;
@@ -48,7 +113,13 @@ template<typename... Ts> class ApsystemsPairInverterAction : public Action<Ts...
 
   TEMPLATABLE_VALUE(std::string, serial)
 
-  void play(Ts... x) override { this->apsystems_->pair_inverter(serial_.value(x...)); }
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->apsystems_->pair_inverter(serial_.value(x...).c_str(),
+                                    [this, x...](bool success) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
 
  protected:
   Apsystems *apsystems_;
@@ -60,7 +131,13 @@ template<typename... Ts> class ApsystemsPollInverterAction : public Action<Ts...
 
   TEMPLATABLE_VALUE(std::string, serial)
 
-  void play(Ts... x) override { this->apsystems_->poll_inverter(serial_.value(x...)); }
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->apsystems_->poll_inverter(serial_.value(x...).c_str(),
+                                    [this, x...](bool success) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
 
  protected:
   Apsystems *apsystems_;
@@ -73,11 +150,58 @@ template<typename... Ts> class ApsystemsRebootInverterAction : public Action<Ts.
 
   TEMPLATABLE_VALUE(std::string, serial)
 
-  void play(Ts... x) override { this->apsystems_->reboot_inverter(serial_.value(x...)); }
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->apsystems_->reboot_inverter(serial_.value(x...).c_str(),
+                                      [this, x...](bool success) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
+
+ protected:
+  Apsystems *apsystems_;
+};
+
+template<typename... Ts> class ApsystemsDumpCaptureAction : public Action<Ts...> {
+ public:
+  ApsystemsDumpCaptureAction(Apsystems *aps) : apsystems_(aps) {}
+
+  void play(Ts... x) override { this->apsystems_->dump_capture(); }
+
+ protected:
+  Apsystems *apsystems_;
+};
+
+template<typename... Ts> class ApsystemsDiscoverInvertersAction : public Action<Ts...> {
+ public:
+  ApsystemsDiscoverInvertersAction(Apsystems *aps) : apsystems_(aps) {}
+
+  TEMPLATABLE_VALUE(uint32_t, duration)
+
+  // the action completes once the scan finished, the results are in the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->apsystems_->discover_inverters(duration_.value(x...), [this, x...](bool success) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
+
+ protected:
+  Apsystems *apsystems_;
+};
+
+#ifdef USE_HOST
+template<typename... Ts> class ApsystemsReplayCaptureAction : public Action<Ts...> {
+ public:
+  ApsystemsReplayCaptureAction(Apsystems *aps) : apsystems_(aps) {}
+
+  TEMPLATABLE_VALUE(std::string, capture)
+
+  void play(Ts... x) override { this->apsystems_->replay_capture(capture_.value(x...)); }
 
  protected:
   Apsystems *apsystems_;
 };
+#endif
 
 }  // namespace apsystems
 }  // namespace esphome
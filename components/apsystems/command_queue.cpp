@@ -0,0 +1,89 @@
+#include "command_queue.h"
+#include <algorithm>
+#include <memory>
+
+namespace esphome {
+namespace apsystems {
+
+void CommandQueue::set_capacity(size_t inverters) {
+  capacity_ = std::max<size_t>(COMMAND_QUEUE_SIZE, COMMAND_TYPES * inverters);
+  commands_.reserve(capacity_);
+}
+
+bool CommandQueue::push(CommandType type, Inverter *inverter, CommandCallback &&callback) {
+  for (auto &queued : commands_) {
+    if (queued.type != type || queued.inverter != inverter)
+      continue;
+    if (!queued.callback) {
+      queued.callback = std::move(callback);
+    } else if (callback) {
+      queued.callback = [first = std::move(queued.callback), second = std::move(callback)](bool success) {
+        first(success);
+        second(success);
+      };
+    }
+    return true;
+  }
+  if (commands_.size() >= capacity_)
+    return false;
+  commands_.push_back(Command{type, inverter, std::move(callback)});
+  return true;
+}
+
+const Command *CommandQueue::peek() const {
+  const Command *next = nullptr;
+  for (const auto &queued : commands_) {
+    if (next == nullptr || queued.type > next->type)
+      next = &queued;
+  }
+  return next;
+}
+
+bool CommandQueue::pop(Command &command) {
+  const Command *next = peek();
+  if (next == nullptr)
+    return false;
+  remove_(next - commands_.data(), command);
+  return true;
+}
+
+bool CommandQueue::pop(CommandType type, Command &command) {
+  for (size_t i = 0; i < commands_.size(); i++) {
+    if (commands_[i].type == type) {
+      remove_(i, command);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CommandQueue::contains(const Inverter *inverter) const {
+  for (const auto &queued : commands_) {
+    if (queued.inverter == inverter)
+      return true;
+  }
+  return false;
+}
+
+void CommandQueue::remove_(size_t index, Command &command) {
+  command = std::move(commands_[index]);
+  // keep the arrival order of the remaining commands
+  commands_.erase(commands_.begin() + index);
+}
+
+CommandCallback make_group_callback(size_t count, CommandCallback &&callback) {
+  struct Group {
+    size_t remaining;
+    bool success;
+    CommandCallback callback;
+  };
+  auto group = std::make_shared<Group>(Group{count, true, std::move(callback)});
+  return [group](bool success) {
+    group->success &= success;
+    if (--group->remaining == 0 && group->callback)
+      group->callback(group->success);
+  };
+}
+
+}  // namespace apsystems
+}  // namespace esphome
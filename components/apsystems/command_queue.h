@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "inverter.h"
+
+namespace esphome {
+namespace apsystems {
+
+// Command types in order of priority, commands with a higher type run first. Scheduled polls are not queued,
+// they rank below all queued commands.
+enum CommandType : uint8_t { COMMAND_POLL = 0, COMMAND_PAIR = 1, COMMAND_REBOOT = 2 };
+static const uint8_t COMMAND_TYPES = 3;
+
+// Called once the command completed, success is false if it failed or could not be queued
+using CommandCallback = std::function<void(bool success)>;
+
+struct Command {
+  CommandType type;
+  Inverter *inverter;
+  CommandCallback callback;
+};
+
+static const uint16_t COMMAND_QUEUE_SIZE = 32;
+
+// Queue of pending commands. A command for an inverter that is already queued with the same type is merged into
+// the queued one, both callbacks are called on completion. So a queue with room for a command of every type for
+// every inverter never runs full, set_capacity() sizes it by the inverter count.
+class CommandQueue {
+ public:
+  // Room for a command of every type for inverters inverters, at least COMMAND_QUEUE_SIZE commands
+  void set_capacity(size_t inverters);
+  // false if the queue is full, the callback is not called in that case
+  bool push(CommandType type, Inverter *inverter, CommandCallback &&callback);
+  // Next command by priority, first in first out within a priority. nullptr if empty.
+  const Command *peek() const;
+  bool pop(Command &command);
+  // Next command of the given type
+  bool pop(CommandType type, Command &command);
+  bool contains(const Inverter *inverter) const;
+  bool empty() const { return commands_.empty(); }
+  uint16_t size() const { return commands_.size(); }
+
+ protected:
+  void remove_(size_t index, Command &command);
+  std::vector<Command> commands_{};
+  size_t capacity_ = COMMAND_QUEUE_SIZE;
+};
+
+// Callback for a group of count commands, calls callback once all of them completed. Succeeds if all succeeded.
+CommandCallback make_group_callback(size_t count, CommandCallback &&callback);
+
+}  // namespace apsystems
+}  // namespace esphome
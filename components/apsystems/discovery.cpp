@@ -0,0 +1,157 @@
+#include "discovery.h"
+#include "inverter_model.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+
+// Serial prefixes of the inverter models
+static const struct {
+  const char *prefix;
+  InverterType type;
+} SERIAL_PREFIXES[] = {
+    {"408", INVERTER_TYPE_YC600},
+    {"802", INVERTER_TYPE_QS1},
+    {"703", INVERTER_TYPE_DS3},
+};
+static const uint8_t INVERTER_TYPES = 3;
+
+uint8_t model_from_serial(const char *serial) {
+  for (const auto &entry : SERIAL_PREFIXES) {
+    if (strncmp(serial, entry.prefix, strlen(entry.prefix)) == 0)
+      return entry.type;
+  }
+  return MODEL_UNKNOWN;
+}
+
+// Data bytes a poll answer needs to hold all fields of the model
+static uint8_t required_length(const InverterModel &model) {
+  uint8_t length = 0;
+  for (uint8_t i = 0; i < model.field_count; i++) {
+    const FieldDescriptor &field = model.fields[i];
+    uint8_t width = field.encoding == ENCODING_U32                                                  ? 4
+                    : field.encoding == ENCODING_U24 || field.encoding == ENCODING_U24_RECIPROCAL ? 3
+                                                                                                  : 2;
+    length = std::max<uint8_t>(length, field.offset + width);
+  }
+  return length;
+}
+
+DiscoveredInverter &DiscoveryTable::find_or_add_(const uint8_t *address) {
+  for (auto &entry : entries_) {
+    if (memcmp(entry.address, address, 2) == 0)
+      return entry;
+  }
+  DiscoveredInverter entry{};
+  memcpy(entry.address, address, 2);
+  entry.model = MODEL_UNKNOWN;
+  entries_.push_back(entry);
+  return entries_.back();
+}
+
+void DiscoveryTable::add_device(const uint8_t *address, const uint8_t *ieee_address, uint8_t link_quality) {
+  DiscoveredInverter &entry = find_or_add_(address);
+  entry.link_quality = std::max(entry.link_quality, link_quality);
+  // the inverters have an ieee address of FFFF + serial like the coordinator has FFFF + ecu id, little endian
+  if (entry.serial[0] != '\0' || ieee_address[0] != 0xFF || ieee_address[1] != 0xFF)
+    return;
+  char serial[13];
+  for (uint8_t i = 0; i < 6; i++) {
+    uint8_t value = ieee_address[7 - i];
+    if ((value >> 4) > 9 || (value & 0x0F) > 9)
+      return;  // serials are decimal
+    snprintf(serial + 2 * i, 3, "%02X", value);
+  }
+  memcpy(entry.serial, serial, sizeof(serial));
+}
+
+void DiscoveryTable::add_answer(const MtFrame &frame) {
+  DiscoveredInverter &entry = find_or_add_(frame.payload + AF_INCOMING_MSG_SRC_ADDR);
+  entry.link_quality = std::max(entry.link_quality, frame.get_u8(AF_INCOMING_MSG_LINK_QUALITY));
+  MtFrame msg = frame.slice(AF_INCOMING_MSG_DATA);
+  entry.answer_length = msg.length;
+  // the layouts differ in length and offsets, only the layout of the actual model decodes to plausible values
+  entry.plausible = 0;
+  int64_t values[FIELD_COUNT];
+  for (uint8_t type = 0; type < INVERTER_TYPES; type++) {
+    const InverterModel &model = get_inverter_model((InverterType) type);
+    if (msg.length >= required_length(model) && model.decode(msg, (1 << model.panels) - 1, values))
+      entry.plausible |= 1 << type;
+  }
+}
+
+void DiscoveryTable::resolve(const std::vector<Inverter *> &inverters) {
+  for (auto &entry : entries_) {
+    entry.configured = nullptr;
+    char pair_id[5];
+    snprintf(pair_id, sizeof(pair_id), "%02X%02X", entry.address[0], entry.address[1]);
+    for (auto inv : inverters) {
+      if (entry.serial[0] != '\0' ? strcmp(entry.serial, inv->get_serial()) == 0
+                                  : inv->is_paired() && strcmp(pair_id, inv->get_id()) == 0) {
+        entry.configured = inv;
+        break;
+      }
+    }
+    if (entry.serial[0] == '\0' && entry.configured != nullptr)
+      strncpy(entry.serial, entry.configured->get_serial(), sizeof(entry.serial) - 1);
+
+    // a single plausible layout settles it, otherwise the serial prefix or the configured type if they fit
+    uint8_t by_serial = entry.serial[0] != '\0' ? model_from_serial(entry.serial) : MODEL_UNKNOWN;
+    uint8_t by_config = entry.configured != nullptr ? (uint8_t) entry.configured->get_type() : MODEL_UNKNOWN;
+    auto fits = [&entry](uint8_t model) {
+      return model != MODEL_UNKNOWN && (entry.answer_length == 0 || (entry.plausible & (1 << model)));
+    };
+    if (entry.plausible != 0 && (entry.plausible & (entry.plausible - 1)) == 0) {
+      entry.model = __builtin_ctz(entry.plausible);
+    } else if (fits(by_serial)) {
+      entry.model = by_serial;
+    } else if (fits(by_config)) {
+      entry.model = by_config;
+    } else {
+      entry.model = MODEL_UNKNOWN;
+    }
+  }
+}
+
+void DiscoveryTable::forget(const Inverter *inverter) {
+  for (auto &entry : entries_) {
+    if (entry.configured == inverter)
+      entry.configured = nullptr;
+  }
+}
+
+void DiscoveryTable::log(const char *tag, const std::vector<Inverter *> &inverters) const {
+  ESP_LOGI(tag, "Discovery found %u devices:", (unsigned) entries_.size());
+  for (const auto &entry : entries_) {
+    const char *model =
+        entry.model != MODEL_UNKNOWN ? get_inverter_model((InverterType) entry.model).name : "unknown model";
+    char answer[24] = "no poll answer";
+    if (entry.answer_length > 0)
+      snprintf(answer, sizeof(answer), "answer of %u bytes", entry.answer_length);
+    ESP_LOGI(tag, "  %-12s  pair id %02X%02X  %-13s  LQI %3u  %s%s", entry.serial[0] != '\0' ? entry.serial : "?",
+             entry.address[0], entry.address[1], model, entry.link_quality, answer,
+             entry.configured != nullptr ? "" : ", not configured");
+    if (entry.configured != nullptr && entry.model != MODEL_UNKNOWN && entry.model != entry.configured->get_type())
+      ESP_LOGW(tag, "  inverter %s is configured as %s but looks like a %s", entry.serial,
+               get_inverter_model(entry.configured->get_type()).name, model);
+  }
+  for (auto inv : inverters) {
+    bool found = false;
+    for (const auto &entry : entries_)
+      found |= entry.configured == inv;
+    if (found)
+      continue;
+    if (inv->is_paired()) {
+      ESP_LOGW(tag, "  inverter %s with pair id %s was not found, it dropped off the network", inv->get_serial(),
+               inv->get_id());
+    } else {
+      ESP_LOGI(tag, "  inverter %s was not found, it is not paired", inv->get_serial());
+    }
+  }
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "inverter.h"
+#include "mt_frame.h"
+
+namespace esphome {
+namespace apsystems {
+
+static const uint32_t DISCOVERY_DEFAULT_DURATION = 10000;  // [ms] listening for answers to the broadcast poll
+static const uint8_t MODEL_UNKNOWN = 0xFF;
+
+// A device found on the channel of the coordinator
+struct DiscoveredInverter {
+  char serial[13];      // empty if only its address is known
+  uint8_t address[2];   // short address in the byte order of the pair id
+  uint8_t model;        // InverterType, MODEL_UNKNOWN if it can't be told
+  uint8_t plausible;    // bit per InverterType whose layout decodes its poll answer to plausible values
+  uint8_t link_quality;
+  uint8_t answer_length;  // data bytes of its poll answer, 0 if it didn't answer
+  Inverter *configured;   // the configured inverter with this serial or pair id
+};
+
+// Results of a discovery scan, one entry per short address
+class DiscoveryTable {
+ public:
+  void clear() { entries_.clear(); }
+  // A device of the neighbor table of the coordinator or a device announcement, ieee_address in MT byte order
+  void add_device(const uint8_t *address, const uint8_t *ieee_address, uint8_t link_quality);
+  // An answer to the broadcast poll, frame is the AF_INCOMING_MSG
+  void add_answer(const MtFrame &frame);
+  // Matches the entries to the configured inverters and infers their models
+  void resolve(const std::vector<Inverter *> &inverters);
+  const std::vector<DiscoveredInverter> &get_entries() const { return entries_; }
+  // Logs the entries and the configured inverters that weren't found
+  void log(const char *tag, const std::vector<Inverter *> &inverters) const;
+  // Drops the references to an inverter that is removed
+  void forget(const Inverter *inverter);
+
+ protected:
+  DiscoveredInverter &find_or_add_(const uint8_t *address);
+  std::vector<DiscoveredInverter> entries_{};
+};
+
+// Model by the serial prefix of the inverter, MODEL_UNKNOWN for other prefixes
+uint8_t model_from_serial(const char *serial);
+
+}  // namespace apsystems
+}  // namespace esphome
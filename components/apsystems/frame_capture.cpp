@@ -0,0 +1,112 @@
+#include "frame_capture.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+
+// bytes per logged line, a multiple of 3 so the lines join to one base64 string
+static const uint8_t CAPTURE_DUMP_LINE = 48;
+
+void FrameCapture::allocate(size_t size) {
+  buffer_.reset(size > 0 ? new uint8_t[size] : nullptr);
+  size_ = size;
+  clear();
+}
+
+void FrameCapture::clear() {
+  head_ = 0;
+  used_ = 0;
+  records_ = 0;
+}
+
+void FrameCapture::record(CaptureDirection direction, uint32_t timestamp, const uint8_t *raw, size_t raw_size) {
+  size_t record_size = CAPTURE_RECORD_HEADER_SIZE + raw_size;
+  if (raw_size > UINT8_MAX || record_size > size_)
+    return;
+  while (size_ - used_ < record_size)
+    drop_oldest_();
+  uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+  header[0] = direction;
+  for (uint8_t i = 0; i < 4; i++)
+    header[1 + i] = timestamp >> (8 * i);
+  header[5] = raw_size;
+  write_(header, sizeof(header));
+  write_(raw, raw_size);
+  records_++;
+  frames_++;
+}
+
+void FrameCapture::write_(const uint8_t *data, size_t size) {
+  size_t tail = (head_ + used_) % size_;
+  size_t first = std::min(size, size_ - tail);
+  memcpy(buffer_.get() + tail, data, first);
+  memcpy(buffer_.get(), data + first, size - first);
+  used_ += size;
+}
+
+void FrameCapture::read_(size_t offset, uint8_t *data, size_t size) const {
+  size_t start = (head_ + offset) % size_;
+  size_t first = std::min(size, size_ - start);
+  memcpy(data, buffer_.get() + start, first);
+  memcpy(data + first, buffer_.get(), size - first);
+}
+
+void FrameCapture::drop_oldest_() {
+  uint8_t raw_size;
+  read_(CAPTURE_RECORD_HEADER_SIZE - 1, &raw_size, 1);
+  size_t record_size = CAPTURE_RECORD_HEADER_SIZE + raw_size;
+  head_ = (head_ + record_size) % size_;
+  used_ -= record_size;
+  records_--;
+  dropped_++;
+}
+
+size_t FrameCapture::read_export(size_t offset, uint8_t *data, size_t max) const {
+  size_t total = export_size();
+  if (offset >= total)
+    return 0;
+  size_t count = std::min(max, total - offset);
+  size_t copied = 0;
+  if (offset < sizeof(CAPTURE_MAGIC)) {
+    copied = std::min(count, sizeof(CAPTURE_MAGIC) - offset);
+    memcpy(data, CAPTURE_MAGIC + offset, copied);
+  }
+  if (copied < count)
+    read_(offset + copied - sizeof(CAPTURE_MAGIC), data + copied, count - copied);
+  return count;
+}
+
+void FrameCapture::dump(const char *tag) const {
+  size_t total = export_size();
+  ESP_LOGI(tag, "Frame capture: %u frames, %u bytes (base64, join the lines):", (unsigned) records_, (unsigned) total);
+  uint8_t line[CAPTURE_DUMP_LINE];
+  for (size_t offset = 0; offset < total; offset += sizeof(line)) {
+    size_t size = read_export(offset, line, sizeof(line));
+    ESP_LOGI(tag, "  %s", base64_encode(line, size).c_str());
+  }
+  ESP_LOGI(tag, "End of frame capture");
+}
+
+bool FrameCapture::parse(const uint8_t *data, size_t size,
+                         const std::function<void(CaptureDirection, uint32_t, const uint8_t *, size_t)> &callback) {
+  if (size < sizeof(CAPTURE_MAGIC) || memcmp(data, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+    return false;
+  size_t pos = sizeof(CAPTURE_MAGIC);
+  while (pos < size) {
+    if (size - pos < CAPTURE_RECORD_HEADER_SIZE)
+      return false;
+    const uint8_t *header = data + pos;
+    size_t raw_size = header[5];
+    if (header[0] > CD_TX || size - pos - CAPTURE_RECORD_HEADER_SIZE < raw_size)
+      return false;
+    callback((CaptureDirection) header[0], record_timestamp(header), header + CAPTURE_RECORD_HEADER_SIZE, raw_size);
+    pos += CAPTURE_RECORD_HEADER_SIZE + raw_size;
+  }
+  return true;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
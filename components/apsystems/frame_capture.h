@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace esphome {
+namespace apsystems {
+
+enum CaptureDirection : uint8_t { CD_RX = 0, CD_TX = 1 };
+
+// Magic and version in front of an exported capture
+static const uint8_t CAPTURE_MAGIC[4] = {'A', 'P', 'C', '1'};
+// Per frame: direction, timestamp [µs] little endian, raw size, then the raw frame from SOF to FCS
+static const uint8_t CAPTURE_RECORD_HEADER_SIZE = 6;
+static const uint16_t CAPTURE_DEFAULT_SIZE = 2048;
+
+// Ring buffer of the raw MT frames on the uart in both directions. Recording a frame is a copy into the ring, the
+// oldest frames are dropped to make room, so it is cheap enough to stay on and holds the traffic around an
+// intermittent failure until it is dumped. The export is the records oldest first behind CAPTURE_MAGIC.
+class FrameCapture {
+ public:
+  // 0 disables the capture
+  void allocate(size_t size);
+  bool is_enabled() const { return size_ > 0; }
+  void record(CaptureDirection direction, uint32_t timestamp, const uint8_t *raw, size_t raw_size);
+  void clear();
+  size_t get_size() const { return size_; }
+  size_t get_used() const { return used_; }
+  uint16_t get_records() const { return records_; }
+  uint32_t get_frames() const { return frames_; }
+  uint32_t get_dropped() const { return dropped_; }
+  // Size of the export
+  size_t export_size() const { return used_ > 0 ? sizeof(CAPTURE_MAGIC) + used_ : 0; }
+  // Copies up to max bytes of the export starting at offset, returns how many
+  size_t read_export(size_t offset, uint8_t *data, size_t max) const;
+  // Logs the export in base64 lines, joined they are the base64 of the whole export
+  void dump(const char *tag) const;
+
+  static uint32_t record_timestamp(const uint8_t *header) {
+    return header[1] | (header[2] << 8) | (header[3] << 16) | ((uint32_t) header[4] << 24);
+  }
+  // Calls callback for each record of an export, false if it is malformed
+  static bool parse(const uint8_t *data, size_t size,
+                    const std::function<void(CaptureDirection, uint32_t, const uint8_t *, size_t)> &callback);
+
+ protected:
+  void write_(const uint8_t *data, size_t size);
+  void read_(size_t offset, uint8_t *data, size_t size) const;
+  void drop_oldest_();
+
+  std::unique_ptr<uint8_t[]> buffer_;
+  size_t size_ = 0;
+  size_t head_ = 0;  // oldest record
+  size_t used_ = 0;
+  uint16_t records_ = 0;  // frames in the ring
+  uint32_t frames_ = 0;   // recorded since boot
+  uint32_t dropped_ = 0;  // dropped to make room
+};
+
+}  // namespace apsystems
+}  // namespace esphome
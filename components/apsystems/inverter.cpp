@@ -1,5 +1,8 @@
 #include "inverter.h"
+#include "preference_store.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/log.h"
+#include <cstring>
 
 static const char *const TAG = "apsystems.inverter";
 
@@ -7,15 +10,27 @@ namespace esphome {
 namespace apsystems {
 
 void Inverter::set_panel_connected(int i, bool connected) {
-  if (i >= 0 && i <= 3)
-    connnected_panels_[i] = connected;
+  if (i < 0 || i > 3)
+    return;
+  if (connected) {
+    connected_panels_ |= 1 << i;
+  } else {
+    connected_panels_ &= ~(1 << i);
+  }
 }
 
-void Inverter::set_serial(std::string serial) { serial.copy(serial_, 12, 0); }
+void Inverter::set_serial(const char *serial) {
+  strncpy(serial_, serial, sizeof(serial_) - 1);
+  serial_[sizeof(serial_) - 1] = '\0';
+}
 
-void Inverter::set_id(std::string id) {
-  id.copy(id_, 4, 0);
-  save_preferences();
+void Inverter::set_id(const char *id) {
+  strncpy(id_, id, sizeof(id_) - 1);  // pads with zeros, an empty id unpairs
+  id_[sizeof(id_) - 1] = '\0';
+  command_frames_.valid = false;  // the frames are addressed to the old pair id
+  // a lost pair id means pairing again, so it is committed right away
+  if (preferences_ != nullptr)
+    preferences_->mark_dirty(true);
 }
 
 void Inverter::set_type(InverterType type) { type_ = type; };
@@ -26,87 +41,96 @@ const char *Inverter::get_serial() { return serial_; }
 
 const char *Inverter::get_id() { return id_; }
 
+uint32_t Inverter::get_update_interval() { return update_interval_; }
+void Inverter::set_update_interval(uint32_t update_interval) { update_interval_ = update_interval; }
+uint8_t Inverter::get_poll_priority() { return poll_priority_; }
+void Inverter::set_poll_priority(uint8_t priority) { poll_priority_ = priority; }
+
 int Inverter::get_unsuccessfull_polls() { return unsuccessfull_polls_; }
 void Inverter::set_unsuccessfull_polls(int amount) { unsuccessfull_polls_ = amount; }
 
-void Inverter::set_panel_energy_sensor(int i, sensor::Sensor *inst) { panel_sensors_[i].energy = inst; }
-void Inverter::set_panel_ac_power_sensor(int i, sensor::Sensor *inst) { panel_sensors_[i].ac_power = inst; }
-void Inverter::set_panel_dc_power_sensor(int i, sensor::Sensor *inst) { panel_sensors_[i].dc_power = inst; }
-void Inverter::set_panel_dc_voltage_sensor(int i, sensor::Sensor *inst) { panel_sensors_[i].dc_voltage = inst; }
-void Inverter::set_panel_dc_current_sensor(int i, sensor::Sensor *inst) { panel_sensors_[i].dc_current = inst; }
+void Inverter::record_poll(bool success) {
+  if (polls_ == UINT16_MAX)
+    return;
+  polls_++;
+  if (!success)
+    failed_polls_++;
+}
+void Inverter::reset_poll_statistics() {
+  polls_ = 0;
+  failed_polls_ = 0;
+}
 
-void Inverter::set_energy_sensor(sensor::Sensor *inst) { energy_sensor_ = inst; }
-void Inverter::set_temperature_sensor(sensor::Sensor *inst) { temperature_sensor_ = inst; }
-void Inverter::set_ac_voltage_sensor(sensor::Sensor *inst) { ac_voltage_sensor_ = inst; }
-void Inverter::set_ac_frequency_sensor(sensor::Sensor *inst) { ac_frequency_sensor_ = inst; }
-void Inverter::set_signal_quality_sensor(sensor::Sensor *inst) { signal_quality_sensor_ = inst; }
-void Inverter::set_dc_power_sensor(sensor::Sensor *inst) { dc_power_sensor_ = inst; }
-void Inverter::set_ac_power_sensor(sensor::Sensor *inst) { ac_power_sensor_ = inst; }
+void Inverter::set_store(InverterStore *store, uint16_t slot) {
+  store_ = store;
+  slot_ = slot;
+}
 
-InverterData Inverter::get_data() { return data_; }
+void Inverter::set_panel_energy_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_ENERGY, i, inst, filter);
+}
+void Inverter::set_panel_ac_power_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_AC_POWER, i, inst, filter);
+}
+void Inverter::set_panel_dc_power_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_DC_POWER, i, inst, filter);
+}
+void Inverter::set_panel_dc_voltage_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_DC_VOLTAGE, i, inst, filter);
+}
+void Inverter::set_panel_dc_current_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_DC_CURRENT, i, inst, filter);
+}
 
-void publish_state(sensor::Sensor *sensor, float state, bool nanIs0) {
-  if (sensor == nullptr)
-    return;
-  if (std::isnan(state) && nanIs0) {
-    sensor->publish_state(0);
-  } else {
-    sensor->publish_state(state);
-  }
+void Inverter::set_energy_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_ENERGY, -1, inst, filter);
+}
+void Inverter::set_temperature_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_TEMPERATURE, -1, inst, filter);
+}
+void Inverter::set_ac_voltage_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_AC_VOLTAGE, -1, inst, filter);
+}
+void Inverter::set_ac_frequency_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_AC_FREQUENCY, -1, inst, filter);
+}
+void Inverter::set_signal_quality_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_SIGNAL_QUALITY, -1, inst, filter);
+}
+void Inverter::set_dc_power_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_DC_POWER, -1, inst, filter);
 }
+void Inverter::set_ac_power_sensor(sensor::Sensor *inst, const PublishFilter &filter) {
+  store_->add_sensor(slot_, SENSOR_AC_POWER, -1, inst, filter);
+}
+
+InverterCommandFrames &Inverter::get_command_frames() { return command_frames_; }
 
-void Inverter::set_data(InverterData data) {
-  data_ = data;
+void Inverter::publish_data() {
   save_preferences();
-  for (int i = 0; i < 4; i++) {
-    if (is_panel_connected(i)) {
-      publish_state(panel_sensors_[i].energy, data_.energy_today[i], false);
-      publish_state(panel_sensors_[i].ac_power, data_.ac_power[i], true);
-      publish_state(panel_sensors_[i].dc_power, data_.dc_power[i], true);
-      publish_state(panel_sensors_[i].dc_voltage, data_.dc_voltage[i], false);
-      publish_state(panel_sensors_[i].dc_current, data_.dc_current[i], false);
-    }
-  }
-  publish_state(energy_sensor_, data_.energy_today[4], false);
-  publish_state(temperature_sensor_, data_.temperature, false);
-  publish_state(ac_voltage_sensor_, data_.ac_voltage, false);
-  publish_state(ac_frequency_sensor_, data_.ac_frequency, false);
-  publish_state(signal_quality_sensor_, data_.signal_quality, false);
-  publish_state(dc_power_sensor_, data_.dc_power[4], true);
-  publish_state(ac_power_sensor_, data_.ac_power[4], true);
+  store_->publish(slot_, connected_panels_, millis());
 }
 
-void Inverter::save_preferences() {
-  if (restore_) {
-    InverterPreference pref_data;
-    for (int i = 0; i < 4; i++)
-      pref_data.energy_today[i] = data_.energy_today[i];
-    for (int i = 0; i < 4; i++)
-      pref_data.energy_since_last_reset[i] = data_.energy_since_last_reset[i];
-    pref_data.last_poll_timestamp = data_.poll_timestamp;
-    strcpy(pref_data.pair_id, id_);
-    this->pref_.save(&pref_data);
-  }
+void Inverter::set_data_unknown() {
+  store_->set_unknown(slot_);
+  publish_data();
+}
+
+void Inverter::reset_energy_today() {
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++)
+    store_->energy_today(slot_, i) = 0;
+  publish_data();
 }
 
-void Inverter::enable_restore() {
-  InverterPreference pref_data{};
-  this->pref_ = global_preferences->make_preference<InverterPreference>(fnv1_hash(std::string("inv_") + get_serial()));
-  this->pref_.load(&pref_data);
-  for (int i = 0; i < 4; i++)
-    data_.energy_today[4] += data_.energy_today[i] = pref_data.energy_today[i];
-  for (int i = 0; i < 4; i++)
-    data_.energy_since_last_reset[4] += data_.energy_since_last_reset[i] = pref_data.energy_since_last_reset[i];
-  data_.poll_timestamp = pref_data.last_poll_timestamp;
-  if (!is_paired())
-    strcpy(id_, pref_data.pair_id);
-  restore_ = true;
+void Inverter::save_preferences() {
+  if (preferences_ != nullptr)
+    preferences_->mark_dirty();
 }
 
 bool Inverter::is_panel_connected(int i) {
   if (i < 0 || i > 3)
     return false;
-  return connnected_panels_[i];
+  return connected_panels_ & (1 << i);
 }
 
 bool Inverter::is_paired() { return id_[0] != '\0'; }
@@ -1,16 +1,20 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
 #include "esphome/components/sensor/sensor.h"
+#include "inverter_store.h"
 
 namespace esphome {
 namespace apsystems {
 
 enum InverterType { INVERTER_TYPE_YC600 = 0, INVERTER_TYPE_QS1 = 1, INVERTER_TYPE_DS3 = 2 };
 
+// Preference of a single inverter, as stored by earlier versions
 struct InverterPreference {
   int last_poll_timestamp;
   float energy_today[4];
@@ -18,27 +22,15 @@ struct InverterPreference {
   float energy_since_last_reset[4];
 };
 
-struct InverterData {
-  int poll_timestamp{0};
-  float ac_frequency{0.0f};
-  float signal_quality{0.0f};
-  float temperature{0.0f};
-  float ac_voltage{0.0f};
-  float dc_current[4]{0.0f};
-  float dc_voltage[4]{0.0f};
-  float dc_power[5]{0.0f};
-  float ac_power[5]{0.0f};
-  float energy_since_last_reset[5]{0.0f};
-  float energy_today[5]{0.0f};
+// Ready to send AF_DATA_REQUEST frames for this inverter, built by the coordinator once the inverter is paired
+static const uint8_t INVERTER_COMMAND_FRAME_SIZE = 34;
+struct InverterCommandFrames {
+  uint8_t poll[INVERTER_COMMAND_FRAME_SIZE];
+  uint8_t reboot[INVERTER_COMMAND_FRAME_SIZE];
+  bool valid{false};
 };
 
-struct PanelSensors {
-  sensor::Sensor *energy;
-  sensor::Sensor *ac_power;
-  sensor::Sensor *dc_power;
-  sensor::Sensor *dc_voltage;
-  sensor::Sensor *dc_current;
-};
+class PreferenceStore;
 
 class Inverter {
  public:
@@ -47,49 +39,64 @@ class Inverter {
   const char *get_id();
   InverterType get_type();
   bool is_paired();
-  void set_serial(std::string serial);
+  void set_serial(const char *serial);
   void set_panel_connected(int i, bool connected);
-  void set_id(std::string id);
+  void set_id(const char *id);
   void set_type(InverterType type);
-  void set_panel_energy_sensor(int i, sensor::Sensor *inst);
-  void set_panel_ac_power_sensor(int i, sensor::Sensor *inst);
-  void set_panel_dc_power_sensor(int i, sensor::Sensor *inst);
-  void set_panel_dc_voltage_sensor(int i, sensor::Sensor *inst);
-  void set_panel_dc_current_sensor(int i, sensor::Sensor *inst);
-  void set_energy_sensor(sensor::Sensor *inst);
-  void set_temperature_sensor(sensor::Sensor *inst);
-  void set_ac_voltage_sensor(sensor::Sensor *inst);
-  void set_ac_frequency_sensor(sensor::Sensor *inst);
-  void set_signal_quality_sensor(sensor::Sensor *inst);
-  void set_dc_power_sensor(sensor::Sensor *inst);
-  void set_ac_power_sensor(sensor::Sensor *inst);
+  void set_panel_energy_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_panel_ac_power_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_panel_dc_power_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_panel_dc_voltage_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_panel_dc_current_sensor(int i, sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_energy_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_temperature_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_ac_voltage_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_ac_frequency_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_signal_quality_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_dc_power_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  void set_ac_power_sensor(sensor::Sensor *inst, const PublishFilter &filter = {});
+  uint32_t get_update_interval();
+  void set_update_interval(uint32_t update_interval);
+  uint8_t get_poll_priority();
+  void set_poll_priority(uint8_t priority);
   int get_unsuccessfull_polls();
   void set_unsuccessfull_polls(int amount);
+  // Poll results since the statistics were last reset, they rate the radio link of the inverter
+  void record_poll(bool success);
+  uint16_t get_polls() { return polls_; }
+  uint16_t get_failed_polls() { return failed_polls_; }
+  void reset_poll_statistics();
+  // Marks the preferences dirty, they are committed by the preference store
   void save_preferences();
-  void enable_restore();
-  InverterData get_data();
-  void set_data(InverterData data);
+  void set_preferences(PreferenceStore *preferences) { preferences_ = preferences; }
+  // Takes the slot of this inverter in the store, sensors can only be set after this
+  void set_store(InverterStore *store, uint16_t slot);
+  InverterStore *get_store() { return store_; }
+  uint16_t get_slot() { return slot_; }
+  uint8_t get_connected_panels() { return connected_panels_; }
+  // Publishes the values in the store and saves them to the preferences
+  void publish_data();
+  // Marks the measured values unknown and publishes them
+  void set_data_unknown();
+  // Starts a new day, the energy produced today starts over
+  void reset_energy_today();
+  InverterCommandFrames &get_command_frames();
 
  protected:
-  bool restore_;
-  ESPPreferenceObject pref_;
+  PreferenceStore *preferences_{nullptr};  // nullptr if the preferences are not restored
   int unsuccessfull_polls_ = 0;
+  uint16_t polls_ = 0;
+  uint16_t failed_polls_ = 0;
+  uint32_t update_interval_ = 0;  // 0 polls at the update interval of the component
+  uint8_t poll_priority_ = 0;
   char serial_[13] = "000000000000";
   char id_[5] {0};
-  InverterData data_{};
+  InverterCommandFrames command_frames_{};
   InverterType type_ = InverterType::INVERTER_TYPE_YC600;
 
-  PanelSensors panel_sensors_[4];
-
-  sensor::Sensor *energy_sensor_;
-  sensor::Sensor *temperature_sensor_;
-  sensor::Sensor *ac_voltage_sensor_;
-  sensor::Sensor *ac_frequency_sensor_;
-  sensor::Sensor *signal_quality_sensor_;
-  sensor::Sensor *dc_power_sensor_;
-  sensor::Sensor *ac_power_sensor_;
-
-  bool connnected_panels_[4] = {false, false, false, false};
+  InverterStore *store_{nullptr};
+  uint16_t slot_{0};
+  uint8_t connected_panels_{0};  // bit per panel
 };
 
 }  // namespace apsystems
@@ -0,0 +1,74 @@
+#include "inverter_index.h"
+#include "esphome/core/helpers.h"
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+
+bool InverterIndex::serial_key(const char *serial, uint64_t &key) {
+  uint8_t bytes[6];
+  if (strlen(serial) != 12 || !parse_hex(serial, bytes, 6))
+    return false;
+  key = 0;
+  for (uint8_t byte : bytes)
+    key = key << 8 | byte;
+  return true;
+}
+
+void InverterIndex::build(const std::vector<Inverter *> &inverters) {
+  bits_ = 1;
+  while ((1u << bits_) < 2 * inverters.size())
+    bits_++;
+  uint32_t mask = (1u << bits_) - 1;
+  serials_.assign(mask + 1, SerialSlot{0, nullptr});
+  addresses_.assign(mask + 1, AddressSlot{0, nullptr});
+  paired_ = 0;
+  // the first inverter of a key wins like it did for a scan over the inverters
+  for (auto inv : inverters) {
+    uint64_t key;
+    if (serial_key(inv->get_serial(), key)) {
+      uint32_t i = hash_(key, bits_);
+      while (serials_[i].inverter != nullptr && serials_[i].key != key)
+        i = (i + 1) & mask;
+      if (serials_[i].inverter == nullptr)
+        serials_[i] = SerialSlot{key, inv};
+    }
+    uint8_t address[2];
+    if (!inv->is_paired() || !parse_hex(inv->get_id(), address, 2))
+      continue;
+    paired_++;
+    uint16_t address_key = address[0] << 8 | address[1];
+    uint32_t i = hash_(address_key, bits_);
+    while (addresses_[i].inverter != nullptr && addresses_[i].key != address_key)
+      i = (i + 1) & mask;
+    if (addresses_[i].inverter == nullptr)
+      addresses_[i] = AddressSlot{address_key, inv};
+  }
+}
+
+Inverter *InverterIndex::find(const char *serial) const {
+  uint64_t key;
+  if (serials_.empty() || !serial_key(serial, key))
+    return nullptr;
+  uint32_t mask = serials_.size() - 1;
+  for (uint32_t i = hash_(key, bits_); serials_[i].inverter != nullptr; i = (i + 1) & mask) {
+    if (serials_[i].key == key)
+      return serials_[i].inverter;
+  }
+  return nullptr;
+}
+
+Inverter *InverterIndex::find(const uint8_t *address) const {
+  if (addresses_.empty())
+    return nullptr;
+  uint16_t key = address[0] << 8 | address[1];
+  uint32_t mask = addresses_.size() - 1;
+  for (uint32_t i = hash_(key, bits_); addresses_[i].inverter != nullptr; i = (i + 1) & mask) {
+    if (addresses_[i].key == key)
+      return addresses_[i].inverter;
+  }
+  return nullptr;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "inverter.h"
+
+namespace esphome {
+namespace apsystems {
+
+// Hash index of the inverters by serial and by pair id. The serial is keyed as the 48-bit integer of its 12 digits,
+// the pair id as the 16-bit short address in wire order. Both tables are open addressing with linear probing and
+// at most half full, a lookup is a hash and a probe or two instead of a string compare per inverter. The index is a
+// snapshot, it is rebuilt after inverters are added or removed or a pair id changes.
+class InverterIndex {
+ public:
+  void build(const std::vector<Inverter *> &inverters);
+  // nullptr if no inverter has that serial
+  Inverter *find(const char *serial) const;
+  // The paired inverter with that short address, nullptr if none
+  Inverter *find(const uint8_t *address) const;
+  // Paired inverters at the time of the build
+  uint16_t get_paired() const { return paired_; }
+
+  // 48-bit key of a serial, false if it isn't 12 digits
+  static bool serial_key(const char *serial, uint64_t &key);
+
+ protected:
+  struct SerialSlot {
+    uint64_t key;
+    Inverter *inverter;  // nullptr if free
+  };
+  struct AddressSlot {
+    uint16_t key;
+    Inverter *inverter;
+  };
+  static uint32_t hash_(uint64_t key, uint8_t bits) {
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+  }
+
+  std::vector<SerialSlot> serials_{};
+  std::vector<AddressSlot> addresses_{};
+  uint8_t bits_ = 0;  // both tables have 2^bits_ slots
+  uint16_t paired_ = 0;
+};
+
+}  // namespace apsystems
+}  // namespace esphome
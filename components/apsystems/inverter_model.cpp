@@ -0,0 +1,109 @@
+#include "inverter_model.h"
+
+namespace esphome {
+namespace apsystems {
+
+// clang-format off
+// field, panel, offset, encoding, scale, bias, min, max in the units of the InverterStore
+static constexpr FieldDescriptor YC600_FIELDS[] = {
+    make_field(FIELD_AC_VOLTAGE,     -1, 28, ENCODING_U16,             1000 / 5.3108,        0, 80000, 290000),
+    make_field(FIELD_AC_FREQUENCY,   -1, 12, ENCODING_U24_RECIPROCAL,  50000000000.0,        0, 30000, 80000),
+    make_field(FIELD_TEMPERATURE,    -1, 10, ENCODING_U16,             275.2,          -258700),
+    make_field(FIELD_TIMESTAMP,      -1, 17, ENCODING_U16,             1),
+    make_field(FIELD_DC_VOLTAGE,      0, 23, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_VOLTAGE + 1,  1, 26, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT,      0, 22, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT + 1,  1, 25, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_ENERGY,          0, 37, ENCODING_U24,             8311000 / 3600.0),
+    make_field(FIELD_ENERGY + 1,      1, 42, ENCODING_U24,             8311000 / 3600.0),
+};
+
+// like the YC600 with two more panels and the timestamp at another offset
+static constexpr FieldDescriptor QS1_FIELDS[] = {
+    make_field(FIELD_AC_VOLTAGE,     -1, 28, ENCODING_U16,             1000 / 5.3108,        0, 80000, 290000),
+    make_field(FIELD_AC_FREQUENCY,   -1, 12, ENCODING_U24_RECIPROCAL,  50000000000.0,        0, 30000, 80000),
+    make_field(FIELD_TEMPERATURE,    -1, 10, ENCODING_U16,             275.2,          -258700),
+    make_field(FIELD_TIMESTAMP,      -1, 30, ENCODING_U16,             1),
+    make_field(FIELD_DC_VOLTAGE,      0, 23, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_VOLTAGE + 1,  1, 26, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_VOLTAGE + 2,  2, 20, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_VOLTAGE + 3,  3, 17, ENCODING_U12_HIGH_NIBBLE, 82500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT,      0, 22, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT + 1,  1, 25, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT + 2,  2, 19, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_DC_CURRENT + 3,  3, 16, ENCODING_U12_LOW_NIBBLE,  27500000 / 4096.0,    0, 0),
+    make_field(FIELD_ENERGY,          0, 37, ENCODING_U24,             8311000 / 3600.0),
+    make_field(FIELD_ENERGY + 1,      1, 42, ENCODING_U24,             8311000 / 3600.0),
+    make_field(FIELD_ENERGY + 2,      2, 47, ENCODING_U24,             8311000 / 3600.0),
+    make_field(FIELD_ENERGY + 3,      3, 52, ENCODING_U24,             8311000 / 3600.0),
+};
+
+static constexpr FieldDescriptor DS3_FIELDS[] = {
+    make_field(FIELD_AC_VOLTAGE,     -1, 34, ENCODING_U16,             1000 / 3.8,           0, 80000, 290000),
+    make_field(FIELD_AC_FREQUENCY,   -1, 36, ENCODING_U16,             10,                   0, 30000, 80000),
+    make_field(FIELD_TEMPERATURE,    -1, 48, ENCODING_U16,             19.8,            -23840),
+    make_field(FIELD_TIMESTAMP,      -1, 38, ENCODING_U16,             1),
+    make_field(FIELD_DC_VOLTAGE,      0, 26, ENCODING_U16,             1000000 / 48.0,       0, 0),
+    make_field(FIELD_DC_VOLTAGE + 1,  1, 28, ENCODING_U16,             1000000 / 48.0,       0, 0),
+    make_field(FIELD_DC_CURRENT,      0, 30, ENCODING_U16,             12500,                0, 0),
+    make_field(FIELD_DC_CURRENT + 1,  1, 32, ENCODING_U16,             12500,                0, 0),
+    make_field(FIELD_ENERGY,          0, 50, ENCODING_U32,             16.6),
+    make_field(FIELD_ENERGY + 1,      1, 54, ENCODING_U32,             16.6),
+};
+// clang-format on
+
+static const InverterModel YC600_MODEL{"YC600", 2, 450000, YC600_FIELDS,
+                                      sizeof(YC600_FIELDS) / sizeof(FieldDescriptor)};
+static const InverterModel QS1_MODEL{"QS1", 4, 480000, QS1_FIELDS, sizeof(QS1_FIELDS) / sizeof(FieldDescriptor)};
+static const InverterModel DS3_MODEL{"DS3", 2, 750000, DS3_FIELDS, sizeof(DS3_FIELDS) / sizeof(FieldDescriptor)};
+
+const InverterModel &get_inverter_model(InverterType type) {
+  switch (type) {
+    case InverterType::INVERTER_TYPE_YC600:
+      return YC600_MODEL;
+    case InverterType::INVERTER_TYPE_DS3:
+      return DS3_MODEL;
+    default:
+      return QS1_MODEL;
+  }
+}
+
+static uint32_t read_raw(const MtFrame &msg, const FieldDescriptor &field) {
+  switch (field.encoding) {
+    case ENCODING_U16:
+      return msg.get_u16(field.offset);
+    case ENCODING_U24:
+    case ENCODING_U24_RECIPROCAL:
+      return msg.get_u24(field.offset);
+    case ENCODING_U32:
+      return msg.get_u32(field.offset);
+    case ENCODING_U12_HIGH_NIBBLE:
+      return (msg.get_u8(field.offset + 1) << 4) | msg.get_high_nibble(field.offset);
+    case ENCODING_U12_LOW_NIBBLE:
+      return (msg.get_low_nibble(field.offset + 1) << 8) | msg.get_u8(field.offset);
+  }
+  return 0;
+}
+
+bool InverterModel::decode(const MtFrame &msg, uint8_t connected_panels, int64_t *values) const {
+  bool plausible = true;
+  for (uint8_t i = 0; i < field_count; i++) {
+    const FieldDescriptor &field = fields[i];
+    uint32_t raw = read_raw(msg, field);
+    int64_t value;
+    if (field.encoding == ENCODING_U24_RECIPROCAL) {
+      value = raw == 0 ? INT64_MAX : ((((uint64_t) field.mul << field.shift) + raw / 2) / raw) + field.bias;
+    } else {
+      value = (int64_t) (((uint64_t) raw * field.mul + (1ULL << field.shift >> 1)) >> field.shift) + field.bias;
+    }
+    values[field.field] = value;
+
+    bool checked = field.panel < 0 || (connected_panels & (1 << field.panel));
+    if (checked && (value < field.min || value > field.max))
+      plausible = false;
+  }
+  return plausible;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include "inverter.h"
+#include "mt_frame.h"
+
+namespace esphome {
+namespace apsystems {
+
+// Values of a poll answer, panel values are consecutive from panel 1 to 4. The units are those of the InverterStore.
+enum InverterField : uint8_t {
+  FIELD_AC_VOLTAGE = 0,
+  FIELD_AC_FREQUENCY,
+  FIELD_TEMPERATURE,
+  FIELD_TIMESTAMP,
+  FIELD_DC_VOLTAGE,
+  FIELD_DC_CURRENT = FIELD_DC_VOLTAGE + 4,
+  FIELD_ENERGY = FIELD_DC_CURRENT + 4,
+  FIELD_COUNT = FIELD_ENERGY + 4,
+};
+
+// How the raw value of a field is stored in the poll answer, multi byte values are big endian
+enum FieldEncoding : uint8_t {
+  ENCODING_U16,
+  ENCODING_U24,
+  ENCODING_U32,
+  // 12 bit: the high nibble of the byte at offset holds the low bits, the byte behind it the high bits
+  ENCODING_U12_HIGH_NIBBLE,
+  // 12 bit: the byte at offset holds the low bits, the low nibble of the byte behind it the high bits
+  ENCODING_U12_LOW_NIBBLE,
+  // the raw value is a period, value = (mul << shift) / raw
+  ENCODING_U24_RECIPROCAL,
+};
+
+// Largest shift that keeps scale * 2^shift below 2^31
+constexpr uint8_t fixed_shift(double scale, uint8_t shift = 31) {
+  return shift == 0 || scale * (double) (1ULL << shift) < 2147483648.0 ? shift : fixed_shift(scale, shift - 1);
+}
+// Smallest shift that makes numerator / 2^shift fit into 32 bits
+constexpr uint8_t reciprocal_shift(double numerator, uint8_t shift = 0) {
+  return numerator / (double) (1ULL << shift) < 4294967296.0 ? shift : reciprocal_shift(numerator, shift + 1);
+}
+
+// One field of a poll answer: value = ((raw * mul) >> shift) + bias, rounded. Values outside of min..max make the
+// answer implausible, panel fields are only checked for connected panels.
+struct FieldDescriptor {
+  uint8_t field;  // InverterField
+  int8_t panel;   // 0-3, -1 for inverter wide fields
+  uint8_t offset;
+  FieldEncoding encoding;
+  uint32_t mul;
+  uint8_t shift;
+  int32_t bias;
+  int32_t min;
+  int32_t max;
+};
+
+// Descriptor for value = raw * scale + bias with the fixed point factor computed at compile time
+constexpr FieldDescriptor make_field(uint8_t field, int8_t panel, uint8_t offset, FieldEncoding encoding, double scale,
+                                     int32_t bias = 0, int32_t min = INT32_MIN, int32_t max = INT32_MAX) {
+  return encoding == ENCODING_U24_RECIPROCAL
+             ? FieldDescriptor{field, panel, offset, encoding,
+                               (uint32_t) (scale / (double) (1ULL << reciprocal_shift(scale))),
+                               reciprocal_shift(scale), bias, min, max}
+             : FieldDescriptor{field, panel, offset, encoding,
+                               (uint32_t) (scale * (double) (1ULL << fixed_shift(scale)) + 0.5), fixed_shift(scale),
+                               bias, min, max};
+}
+
+// Layout of the poll answer of an inverter model
+struct InverterModel {
+  const char *name;
+  uint8_t panels;
+  int32_t max_panel_power;  // [mW] higher ac or dc power per panel is implausible
+  const FieldDescriptor *fields;
+  uint8_t field_count;
+
+  // Decodes all fields of the answer into values, indexed by InverterField. Fields the model doesn't have keep
+  // their value. Returns false if a value is implausible.
+  bool decode(const MtFrame &msg, uint8_t connected_panels, int64_t *values) const;
+};
+
+// Model of the inverter type, unknown types are decoded like a QS1
+const InverterModel &get_inverter_model(InverterType type);
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,153 @@
+#include "inverter_store.h"
+#include <algorithm>
+
+namespace esphome {
+namespace apsystems {
+
+void InverterStore::allocate() {
+  poll_timestamp_.assign(slots_, 0);
+  ac_frequency_.assign(slots_, 0);
+  signal_quality_.assign(slots_, 0);
+  temperature_.assign(slots_, 0);
+  ac_voltage_.assign(slots_, 0);
+  dc_current_.assign(slots_ * INVERTER_PANELS, 0);
+  dc_voltage_.assign(slots_ * INVERTER_PANELS, 0);
+  dc_power_.assign(slots_ * INVERTER_PANELS, 0);
+  ac_power_.assign(slots_ * INVERTER_PANELS, 0);
+  energy_since_last_reset_.assign(slots_ * INVERTER_PANELS, 0);
+  energy_today_.assign(slots_ * INVERTER_PANELS, 0);
+}
+
+void InverterStore::add_sensor(uint16_t slot, InverterSensor kind, int8_t panel, sensor::Sensor *sensor,
+                               const PublishFilter &filter) {
+  uint16_t index = 0;
+  while (index < filters_.size() &&
+         (filters_[index].deadband != filter.deadband || filters_[index].deadband_relative != filter.deadband_relative ||
+          filters_[index].max_age != filter.max_age))
+    index++;
+  if (index == filters_.size())
+    filters_.push_back(filter);
+
+  auto pos = std::upper_bound(sensors_.begin(), sensors_.end(), slot,
+                              [](uint16_t slot, const SensorEntry &entry) { return slot < entry.slot; });
+  sensors_.insert(pos, SensorEntry{slot, kind, panel, index, 0, sensor});
+}
+
+float InverterStore::get_value_(const SensorEntry &entry, uint8_t connected_panels) const {
+  uint16_t slot = entry.slot;
+  size_t index = slot * INVERTER_PANELS + entry.panel;
+  bool total = entry.panel < 0;
+  switch (entry.kind) {
+    case SENSOR_ENERGY:
+      return fixed_to_float(total ? total_energy_today(slot, connected_panels) : energy_today_[index], UNIT_MICRO);
+    case SENSOR_AC_POWER:
+      return fixed_to_float(total ? total_ac_power(slot, connected_panels) : ac_power_[index], UNIT_MILLI);
+    case SENSOR_DC_POWER:
+      return fixed_to_float(total ? total_dc_power(slot, connected_panels) : dc_power_[index], UNIT_MILLI);
+    case SENSOR_DC_VOLTAGE:
+      return fixed_to_float(dc_voltage_[index], UNIT_MICRO);
+    case SENSOR_DC_CURRENT:
+      return fixed_to_float(dc_current_[index], UNIT_MICRO);
+    case SENSOR_TEMPERATURE:
+      return fixed_to_float(temperature_[slot], UNIT_MILLI);
+    case SENSOR_AC_VOLTAGE:
+      return fixed_to_float(ac_voltage_[slot], UNIT_MILLI);
+    case SENSOR_AC_FREQUENCY:
+      return fixed_to_float(ac_frequency_[slot], UNIT_MILLI);
+    case SENSOR_SIGNAL_QUALITY:
+      return fixed_to_float(signal_quality_[slot], UNIT_MILLI);
+  }
+  return NAN;
+}
+
+bool InverterStore::is_due_(const SensorEntry &entry, float state, uint32_t now) const {
+  const PublishFilter &filter = filters_[entry.filter];
+  if (!entry.sensor->has_state())
+    return true;
+  if (filter.max_age != 0 && now - entry.last_publish >= filter.max_age)
+    return true;
+  // the raw state of a sensor is the value it was last published with, before its own filters
+  float last = entry.sensor->raw_state;
+  if (std::isnan(last) || std::isnan(state))
+    return std::isnan(last) != std::isnan(state);
+  float change = std::fabs(state - last);
+  return change > std::max(filter.deadband, std::fabs(last) * filter.deadband_relative);
+}
+
+void InverterStore::publish(uint16_t slot, uint8_t connected_panels, uint32_t now) {
+  auto it = std::lower_bound(sensors_.begin(), sensors_.end(), slot,
+                             [](const SensorEntry &entry, uint16_t slot) { return entry.slot < slot; });
+  for (auto end = sensors_.end(); it != end && it->slot == slot; ++it) {
+    if (it->panel >= 0 && !(connected_panels & (1 << it->panel)))
+      continue;
+    float state = get_value_(*it, connected_panels);
+    // an unknown power is published as 0, the inverter doesn't produce anything while it is unreachable
+    if (std::isnan(state) && (it->kind == SENSOR_AC_POWER || it->kind == SENSOR_DC_POWER))
+      state = 0;
+    if (!is_due_(*it, state, now))
+      continue;
+    it->last_publish = now;
+    it->sensor->publish_state(state);
+  }
+}
+
+void InverterStore::set_unknown(uint16_t slot) {
+  ac_frequency_[slot] = VALUE_UNKNOWN;
+  ac_voltage_[slot] = VALUE_UNKNOWN;
+  signal_quality_[slot] = VALUE_UNKNOWN;
+  temperature_[slot] = VALUE_UNKNOWN;
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++) {
+    size_t index = slot * INVERTER_PANELS + i;
+    dc_current_[index] = VALUE_UNKNOWN;
+    dc_voltage_[index] = VALUE_UNKNOWN;
+    dc_power_[index] = VALUE_UNKNOWN;
+    ac_power_[index] = VALUE_UNKNOWN;
+  }
+}
+
+int32_t InverterStore::total_dc_power(uint16_t slot, uint8_t connected_panels) const {
+  int32_t total = 0;
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++) {
+    if (!(connected_panels & (1 << i)))
+      continue;
+    int32_t value = dc_power_[slot * INVERTER_PANELS + i];
+    if (value == VALUE_UNKNOWN)
+      return VALUE_UNKNOWN;
+    total += value;
+  }
+  return total;
+}
+
+int32_t InverterStore::total_ac_power(uint16_t slot, uint8_t connected_panels) const {
+  int32_t total = 0;
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++) {
+    if (!(connected_panels & (1 << i)))
+      continue;
+    int32_t value = ac_power_[slot * INVERTER_PANELS + i];
+    if (value == VALUE_UNKNOWN)
+      return VALUE_UNKNOWN;
+    total += value;
+  }
+  return total;
+}
+
+int64_t InverterStore::total_energy_since_last_reset(uint16_t slot, uint8_t connected_panels) const {
+  int64_t total = 0;
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++) {
+    if (connected_panels & (1 << i))
+      total += energy_since_last_reset_[slot * INVERTER_PANELS + i];
+  }
+  return total;
+}
+
+int64_t InverterStore::total_energy_today(uint16_t slot, uint8_t connected_panels) const {
+  int64_t total = 0;
+  for (uint8_t i = 0; i < INVERTER_PANELS; i++) {
+    if (connected_panels & (1 << i))
+      total += energy_today_[slot * INVERTER_PANELS + i];
+  }
+  return total;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "esphome/components/sensor/sensor.h"
+
+namespace esphome {
+namespace apsystems {
+
+// Marks a value that is not known, published as NaN
+static const int32_t VALUE_UNKNOWN = INT32_MIN;
+// Units of the fixed point values in float units
+static const float UNIT_MILLI = 0.001f;
+static const float UNIT_MICRO = 0.000001f;
+
+// Value in float units, NaN if unknown
+inline float fixed_to_float(int64_t value, float unit) { return value == VALUE_UNKNOWN ? NAN : value * unit; }
+
+static const uint8_t INVERTER_PANELS = 4;
+
+// Values a sensor publishes. Panel sensors publish the value of their panel, inverter wide sensors the total.
+enum InverterSensor : uint8_t {
+  SENSOR_ENERGY = 0,
+  SENSOR_AC_POWER,
+  SENSOR_DC_POWER,
+  SENSOR_DC_VOLTAGE,
+  SENSOR_DC_CURRENT,
+  SENSOR_TEMPERATURE,
+  SENSOR_AC_VOLTAGE,
+  SENSOR_AC_FREQUENCY,
+  SENSOR_SIGNAL_QUALITY,
+};
+
+// When a sensor publishes: once its value changed by more than the larger of the deadbands, or when its last publish
+// is older than max_age. Both deadbands 0 publish every change, max_age 0 never republishes an unchanged value.
+struct PublishFilter {
+  float deadband{0};           // absolute, in the unit of the sensor
+  float deadband_relative{0};  // fraction of the last published value
+  uint32_t max_age{0};         // [ms]
+};
+
+struct SensorEntry {
+  uint16_t slot;
+  InverterSensor kind;
+  int8_t panel;     // 0-3, -1 for inverter wide sensors
+  uint16_t filter;  // index into the publish filters
+  uint32_t last_publish;
+  sensor::Sensor *sensor;
+};
+
+// Decoded data of all inverters in fixed point, one array per value indexed by the slot of the inverter (times 4
+// plus the panel for panel values). The units are fine enough that the published values match a float decode,
+// energies are 64 bit so they don't lose precision over long uptimes. Totals over the panels are not stored, they
+// are summed over the connected panels when needed.
+//
+// Slots are handed out while the configuration is built, the arrays are allocated once by allocate(). Sensors are
+// kept in a registry sorted by slot, so inverters only pay for the sensors that are configured. Sensors only publish
+// values that passed their publish filter, identical filters are shared.
+class InverterStore {
+ public:
+  uint16_t add_slot() { return slots_++; }
+  // Allocates the arrays for all slots handed out so far, all values start at 0
+  void allocate();
+  uint16_t size() const { return slots_; }
+  void add_sensor(uint16_t slot, InverterSensor kind, int8_t panel, sensor::Sensor *sensor,
+                  const PublishFilter &filter = {});
+  // Publishes the values of the slot that passed their filter, panel sensors only if their panel is connected
+  void publish(uint16_t slot, uint8_t connected_panels, uint32_t now);
+  // Marks the measured values of the slot unknown, energies are kept
+  void set_unknown(uint16_t slot);
+  // Bytes of the value arrays per slot
+  static constexpr size_t slot_size() {
+    return sizeof(uint16_t) + 4 * sizeof(int32_t) + INVERTER_PANELS * (4 * sizeof(int32_t) + 2 * sizeof(int64_t));
+  }
+  size_t sensor_count() const { return sensors_.size(); }
+
+  uint16_t &poll_timestamp(uint16_t slot) { return poll_timestamp_[slot]; }  // [s] since the inverter started
+  int32_t &ac_frequency(uint16_t slot) { return ac_frequency_[slot]; }       // [mHz]
+  int32_t &signal_quality(uint16_t slot) { return signal_quality_[slot]; }   // [0.001 %]
+  int32_t &temperature(uint16_t slot) { return temperature_[slot]; }         // [m°C]
+  int32_t &ac_voltage(uint16_t slot) { return ac_voltage_[slot]; }           // [mV]
+  int32_t &dc_current(uint16_t slot, uint8_t panel) { return dc_current_[slot * INVERTER_PANELS + panel]; }  // [µA]
+  int32_t &dc_voltage(uint16_t slot, uint8_t panel) { return dc_voltage_[slot * INVERTER_PANELS + panel]; }  // [µV]
+  int32_t &dc_power(uint16_t slot, uint8_t panel) { return dc_power_[slot * INVERTER_PANELS + panel]; }      // [mW]
+  int32_t &ac_power(uint16_t slot, uint8_t panel) { return ac_power_[slot * INVERTER_PANELS + panel]; }      // [mW]
+  int64_t &energy_since_last_reset(uint16_t slot, uint8_t panel) {  // [µWh]
+    return energy_since_last_reset_[slot * INVERTER_PANELS + panel];
+  }
+  int64_t &energy_today(uint16_t slot, uint8_t panel) {  // [µWh]
+    return energy_today_[slot * INVERTER_PANELS + panel];
+  }
+
+  // Sums over the connected panels, unknown if the value of a connected panel is unknown
+  int32_t total_dc_power(uint16_t slot, uint8_t connected_panels) const;
+  int32_t total_ac_power(uint16_t slot, uint8_t connected_panels) const;
+  int64_t total_energy_since_last_reset(uint16_t slot, uint8_t connected_panels) const;
+  int64_t total_energy_today(uint16_t slot, uint8_t connected_panels) const;
+
+ protected:
+  float get_value_(const SensorEntry &entry, uint8_t connected_panels) const;
+  bool is_due_(const SensorEntry &entry, float state, uint32_t now) const;
+
+  uint16_t slots_ = 0;
+  std::vector<uint16_t> poll_timestamp_{};
+  std::vector<int32_t> ac_frequency_{};
+  std::vector<int32_t> signal_quality_{};
+  std::vector<int32_t> temperature_{};
+  std::vector<int32_t> ac_voltage_{};
+  std::vector<int32_t> dc_current_{};
+  std::vector<int32_t> dc_voltage_{};
+  std::vector<int32_t> dc_power_{};
+  std::vector<int32_t> ac_power_{};
+  std::vector<int64_t> energy_since_last_reset_{};
+  std::vector<int64_t> energy_today_{};
+  std::vector<SensorEntry> sensors_{};
+  std::vector<PublishFilter> filters_{};
+};
+
+}  // namespace apsystems
+}  // namespace esphome
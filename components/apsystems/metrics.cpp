@@ -0,0 +1,50 @@
+#include "metrics.h"
+#include <algorithm>
+
+namespace esphome {
+namespace apsystems {
+
+uint8_t Histogram::bucket_(uint32_t value) {
+  if (value < 4)
+    return value;
+  uint8_t octave = 31 - __builtin_clz(value);
+  uint8_t quarter = (value >> (octave - 2)) & 3;
+  return std::min<uint8_t>((octave - 1) * 4 + quarter, BUCKETS - 1);
+}
+
+uint32_t Histogram::upper_bound_(uint8_t bucket) {
+  if (bucket < 4)
+    return bucket;
+  uint8_t octave = bucket / 4 + 1;
+  return (1UL << octave) + (bucket % 4 + 1) * (1UL << (octave - 2)) - 1;
+}
+
+void Histogram::add(uint32_t value) {
+  counts_[bucket_(value)]++;
+  count_++;
+  max_ = std::max(max_, value);
+  if (++window_ < HISTOGRAM_DECAY)
+    return;
+  window_ = 0;
+  for (auto &count : counts_)
+    count /= 2;
+}
+
+uint32_t Histogram::percentile(uint8_t percent) const {
+  uint32_t total = 0;
+  for (auto count : counts_)
+    total += count;
+  if (total == 0)
+    return 0;
+  uint32_t rank = (total * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    seen += counts_[i];
+    if (seen >= rank)
+      return std::min(upper_bound_(i), max_);
+  }
+  return max_;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
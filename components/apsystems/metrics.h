@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+namespace esphome {
+namespace apsystems {
+
+// Histogram with four buckets per power of two, values up to 2^18 in whatever unit the caller records. Adding a value
+// is a few shifts and an increment. The counts are halved once HISTOGRAM_DECAY samples were added, so the
+// percentiles follow the recent behaviour.
+class Histogram {
+ public:
+  static const uint8_t BUCKETS = 68;
+  static const uint16_t HISTOGRAM_DECAY = 1024;
+
+  void add(uint32_t value);
+  // Upper bound of the bucket the percentile falls into, capped at the largest value seen. 0 if empty.
+  uint32_t percentile(uint8_t percent) const;
+  uint32_t get_count() const { return count_; }
+  uint32_t get_max() const { return max_; }
+
+ protected:
+  static uint8_t bucket_(uint32_t value);
+  static uint32_t upper_bound_(uint8_t bucket);
+
+  uint16_t counts_[BUCKETS]{};
+  uint16_t window_ = 0;  // samples since the last decay
+  uint32_t count_ = 0;   // samples since boot
+  uint32_t max_ = 0;
+};
+
+static const uint8_t COORDINATOR_STATES = 25;  // ZigbeeCoordinatorState values
+
+// Counters of the coordinator, cheap enough to update on every poll
+struct CoordinatorMetrics {
+  Histogram poll_rtt;       // [ms] from the poll request to the answer
+  Histogram response_time;  // [ms] from a command to its response
+  Histogram decode_time;    // [µs] decoding a poll answer
+  uint32_t polls{0};
+  uint32_t failed_polls{0};
+  uint32_t late_answers{0};  // poll answers that arrived after their request timed out or without one
+  uint32_t recovery_attempts[3]{};  // per RecoveryTier
+  uint32_t resets_today{0};         // soft resets and full initializations
+  uint32_t state_time[COORDINATOR_STATES]{};  // [ms] spent in each state
+  // with state profiling: [bytes] deepest stack use of a loop and least free heap after a loop in each state
+  uint16_t state_stack[COORDINATOR_STATES]{};
+  uint32_t state_free_heap[COORDINATOR_STATES]{};
+  uint32_t sweep_time{0};  // [ms] the last sweep took, a sweep is as many polls as inverters are paired
+  uint32_t sweeps{0};
+};
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,136 @@
+#include "mt_frame.h"
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+
+uint8_t MtFrame::get_u8(uint8_t offset) const {
+  if (offset >= length)
+    return 0;
+  return payload[offset];
+}
+
+uint16_t MtFrame::get_u16(uint8_t offset) const { return (get_u8(offset) << 8) | get_u8(offset + 1); }
+
+uint32_t MtFrame::get_u24(uint8_t offset) const {
+  return ((uint32_t) get_u8(offset) << 16) | ((uint32_t) get_u8(offset + 1) << 8) | get_u8(offset + 2);
+}
+
+uint32_t MtFrame::get_u32(uint8_t offset) const {
+  return ((uint32_t) get_u8(offset) << 24) | get_u24(offset + 1);
+}
+
+int MtFrame::find_last(const uint8_t *pattern, uint8_t pattern_length) const {
+  if (pattern_length == 0 || pattern_length > length)
+    return -1;
+  for (int i = length - pattern_length; i >= 0; i--) {
+    if (memcmp(payload + i, pattern, pattern_length) == 0)
+      return i;
+  }
+  return -1;
+}
+
+MtFrame MtFrame::slice(uint8_t offset) const {
+  if (offset >= length)
+    return MtFrame{command, 0, payload};
+  return MtFrame{command, (uint8_t) (length - offset), payload + offset};
+}
+
+void MtFrameBuilder::reset(uint16_t command) {
+  data_[0] = MT_SOF;
+  data_[1] = 0;
+  data_[2] = command >> 8;
+  data_[3] = command & 0xFF;
+  size_ = MT_HEADER_SIZE;
+}
+
+MtFrameBuilder &MtFrameBuilder::add(uint8_t value) {
+  if (size_ < MT_HEADER_SIZE + MT_MAX_PAYLOAD_SIZE)
+    data_[size_++] = value;
+  return *this;
+}
+
+MtFrameBuilder &MtFrameBuilder::add(const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; i++)
+    add(data[i]);
+  return *this;
+}
+
+const uint8_t *MtFrameBuilder::finish() {
+  data_[1] = size_ - MT_HEADER_SIZE;
+  data_[size_] = mt_checksum(data_ + 1, size_ - 1);
+  size_++;
+  return data_;
+}
+
+void MtFrameParser::feed(uint8_t byte) {
+  if (size_ == 0 && byte != MT_SOF)
+    return;  // wait for start of frame
+  buffer_[size_++] = byte;
+  parse_();
+}
+
+void MtFrameParser::parse_() {
+  while (size_ > 0) {
+    if (buffer_[0] != MT_SOF) {
+      // skip everything up to the next SOF
+      size_t next = 1;
+      while (next < size_ && buffer_[next] != MT_SOF)
+        next++;
+      size_ -= next;
+      memmove(buffer_, buffer_ + next, size_);
+      continue;
+    }
+    if (size_ < 2)
+      return;
+    uint8_t length = buffer_[1];
+    size_t frame_size = MT_HEADER_SIZE + length + 1;
+    if (length <= MT_MAX_PAYLOAD_SIZE) {
+      if (size_ < frame_size)
+        return;  // wait for more bytes
+      if (mt_checksum(buffer_ + 1, frame_size - 2) == buffer_[frame_size - 1]) {
+        MtFrame frame{(uint16_t) ((buffer_[2] << 8) | buffer_[3]), length, buffer_ + MT_HEADER_SIZE};
+        if (on_frame_)
+          on_frame_(frame, buffer_, frame_size);
+        size_ -= frame_size;
+        memmove(buffer_, buffer_ + frame_size, size_);
+        continue;
+      }
+    }
+    // the SOF we locked onto was no frame start, resync on the next SOF in the bytes received so far
+    dropped_++;
+    size_--;
+    memmove(buffer_, buffer_ + 1, size_);
+  }
+}
+
+uint8_t mt_checksum(const uint8_t *data, size_t length) {
+  uint8_t fcs = 0;
+  for (size_t i = 0; i < length; i++)
+    fcs ^= data[i];
+  return fcs;
+}
+
+bool mt_next_frame(const uint8_t *buffer, size_t size, size_t &pos, MtFrame &frame) {
+  while (pos + MT_HEADER_SIZE < size) {
+    if (buffer[pos] != MT_SOF) {
+      pos++;
+      continue;
+    }
+    uint8_t length = buffer[pos + 1];
+    size_t fcs_pos = pos + MT_HEADER_SIZE + length;
+    if (fcs_pos >= size || buffer[fcs_pos] != mt_checksum(buffer + pos + 1, fcs_pos - pos - 1)) {
+      pos++;  // truncated or corrupt, resync on the next SOF
+      continue;
+    }
+    frame.command = (buffer[pos + 2] << 8) | buffer[pos + 3];
+    frame.length = length;
+    frame.payload = buffer + pos + MT_HEADER_SIZE;
+    pos = fcs_pos + 1;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
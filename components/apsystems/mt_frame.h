@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace esphome {
+namespace apsystems {
+
+// TI Monitor and Test (MT) framing used by the cc2530 ZNP firmware:
+// SOF (0xFE) | length | cmd0 | cmd1 | payload[length] | FCS (xor of length..payload)
+static const uint8_t MT_SOF = 0xFE;
+static const uint8_t MT_HEADER_SIZE = 4;  // SOF, length, cmd0, cmd1
+static const uint8_t MT_MAX_PAYLOAD_SIZE = 250;
+static const uint16_t MT_MAX_FRAME_SIZE = MT_HEADER_SIZE + MT_MAX_PAYLOAD_SIZE + 1;
+
+enum MtCommand : uint16_t {
+  MT_SYS_PING = 0x2101,
+  MT_SYS_PING_SRSP = 0x6101,
+  MT_SYS_RESET_REQ = 0x4100,
+  MT_SYS_RESET_IND = 0x4180,
+  MT_AF_REGISTER = 0x2400,
+  MT_AF_REGISTER_SRSP = 0x6400,
+  MT_AF_DATA_REQUEST = 0x2401,
+  MT_AF_DATA_REQUEST_EXT = 0x2402,
+  MT_AF_DATA_REQUEST_SRSP = 0x6401,
+  MT_AF_DATA_REQUEST_EXT_SRSP = 0x6402,
+  MT_AF_DATA_CONFIRM = 0x4480,
+  MT_AF_INCOMING_MSG = 0x4481,
+  MT_ZB_START_REQUEST = 0x2600,
+  MT_ZB_START_REQUEST_SRSP = 0x6600,
+  MT_ZB_WRITE_CONFIGURATION = 0x2605,
+  MT_ZB_WRITE_CONFIGURATION_SRSP = 0x6605,
+  MT_UTIL_GET_DEVICE_INFO = 0x2700,
+  MT_UTIL_GET_DEVICE_INFO_SRSP = 0x6700,
+  MT_ZDO_MGMT_LQI_REQ = 0x2531,
+  MT_ZDO_MGMT_LQI_REQ_SRSP = 0x6531,
+  MT_ZDO_MGMT_LQI_RSP = 0x45B1,
+  MT_ZDO_END_DEVICE_ANNCE_IND = 0x45C1,
+};
+
+// Compile time FCS of the given bytes
+constexpr uint8_t mt_fcs() { return 0; }
+template<typename... Ts> constexpr uint8_t mt_fcs(uint8_t first, Ts... rest) { return first ^ mt_fcs(rest...); }
+// Compile time FCS of a constexpr array
+constexpr uint8_t mt_fcs_array(const uint8_t *data, size_t length) {
+  return length == 0 ? 0 : data[0] ^ mt_fcs_array(data + 1, length - 1);
+}
+
+// A complete frame without variable parts, assembled and checksummed at compile time
+template<uint16_t Command, uint8_t... Payload> struct MtStaticFrame {
+  static const uint8_t SIZE = MT_HEADER_SIZE + sizeof...(Payload) + 1;
+  static const uint8_t DATA[SIZE];
+};
+template<uint16_t Command, uint8_t... Payload>
+const uint8_t MtStaticFrame<Command, Payload...>::DATA[] = {
+    MT_SOF, sizeof...(Payload), Command >> 8, Command & 0xFF, Payload...,
+    mt_fcs(sizeof...(Payload), Command >> 8, Command & 0xFF, Payload...)};
+
+// AF_DATA_CONFIRM payload layout: Status, Endpoint, TransID
+static const uint8_t AF_DATA_CONFIRM_TRANS_ID = 2;
+
+// AF_INCOMING_MSG payload layout
+static const uint8_t AF_INCOMING_MSG_SRC_ADDR = 4;
+static const uint8_t AF_INCOMING_MSG_LINK_QUALITY = 9;
+static const uint8_t AF_INCOMING_MSG_DATA_LENGTH = 16;
+static const uint8_t AF_INCOMING_MSG_DATA = 17;
+
+// ZDO_MGMT_LQI_RSP payload layout: SrcAddr(2), Status, Total, StartIndex, Count, then the neighbor table entries:
+// ExtPanId(8), IEEE address(8), short address(2), device type, permit join, depth, LQI
+static const uint8_t ZDO_MGMT_LQI_RSP_STATUS = 2;
+static const uint8_t ZDO_MGMT_LQI_RSP_TOTAL = 3;
+static const uint8_t ZDO_MGMT_LQI_RSP_START_INDEX = 4;
+static const uint8_t ZDO_MGMT_LQI_RSP_COUNT = 5;
+static const uint8_t ZDO_MGMT_LQI_RSP_ENTRIES = 6;
+static const uint8_t ZDO_NEIGHBOR_SIZE = 22;
+static const uint8_t ZDO_NEIGHBOR_IEEE_ADDR = 8;
+static const uint8_t ZDO_NEIGHBOR_SHORT_ADDR = 16;
+static const uint8_t ZDO_NEIGHBOR_LQI = 21;
+
+// ZDO_END_DEVICE_ANNCE_IND payload layout: SrcAddr(2), short address(2), IEEE address(8), capabilities
+static const uint8_t ZDO_END_DEVICE_ANNCE_SHORT_ADDR = 2;
+static const uint8_t ZDO_END_DEVICE_ANNCE_IEEE_ADDR = 4;
+
+// A received frame. The payload points into the buffer the frame was parsed from.
+struct MtFrame {
+  uint16_t command;
+  uint8_t length;
+  const uint8_t *payload;
+
+  bool is(uint16_t cmd) const { return command == cmd; }
+  // Field accessors by payload byte offset, multi byte values are big endian. Reads past the end return 0.
+  uint8_t get_u8(uint8_t offset) const;
+  uint16_t get_u16(uint8_t offset) const;
+  uint32_t get_u24(uint8_t offset) const;
+  uint32_t get_u32(uint8_t offset) const;
+  uint8_t get_high_nibble(uint8_t offset) const { return get_u8(offset) >> 4; }
+  uint8_t get_low_nibble(uint8_t offset) const { return get_u8(offset) & 0x0F; }
+  // Offset of the last occurrence of pattern in the payload, -1 if not found
+  int find_last(const uint8_t *pattern, uint8_t pattern_length) const;
+  // View on the payload starting at offset
+  MtFrame slice(uint8_t offset) const;
+};
+
+// Builds an outgoing frame, the length and FCS are filled in by finish()
+class MtFrameBuilder {
+ public:
+  explicit MtFrameBuilder(uint16_t command) { reset(command); }
+  // Starts a new frame in the same buffer
+  void reset(uint16_t command);
+  MtFrameBuilder &add(uint8_t value);
+  MtFrameBuilder &add(const uint8_t *data, size_t length);
+  const uint8_t *finish();
+  size_t get_size() const { return size_; }
+  uint16_t get_command() const { return (data_[2] << 8) | data_[3]; }
+
+ protected:
+  uint8_t data_[MT_MAX_FRAME_SIZE];
+  size_t size_ = MT_HEADER_SIZE;
+};
+
+// Resumable byte at a time parser for the receive direction. The frame callback is invoked for every frame
+// with a valid FCS; the frame and raw bytes are only valid during the callback.
+class MtFrameParser {
+ public:
+  void set_on_frame(std::function<void(const MtFrame &frame, const uint8_t *raw, size_t raw_size)> &&callback) {
+    on_frame_ = std::move(callback);
+  }
+  void feed(uint8_t byte);
+  uint32_t get_dropped() const { return dropped_; }
+  // Drops a partial frame, the next frame starts on the next SOF
+  void reset() {
+    dropped_ += size_ > 0;
+    size_ = 0;
+  }
+
+ protected:
+  void parse_();
+  std::function<void(const MtFrame &frame, const uint8_t *raw, size_t raw_size)> on_frame_;
+  uint8_t buffer_[MT_MAX_FRAME_SIZE];
+  size_t size_ = 0;
+  uint32_t dropped_ = 0;
+};
+
+uint8_t mt_checksum(const uint8_t *data, size_t length);
+
+// Finds the next valid frame in buffer starting at pos. Garbage and frames with a bad FCS are skipped.
+bool mt_next_frame(const uint8_t *buffer, size_t size, size_t &pos, MtFrame &frame);
+
+}  // namespace apsystems
+}  // namespace esphome
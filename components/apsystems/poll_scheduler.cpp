@@ -0,0 +1,79 @@
+#include "poll_scheduler.h"
+#include "esphome/core/component.h"
+#include <algorithm>
+
+namespace esphome {
+namespace apsystems {
+
+// heap order: earliest due first, on equal due times the higher priority first
+static bool poll_entry_after(const PollEntry &a, const PollEntry &b) {
+  int32_t diff = (int32_t) (a.due - b.due);
+  if (diff != 0)
+    return diff > 0;
+  return a.inverter->get_poll_priority() < b.inverter->get_poll_priority();
+}
+
+void PollScheduler::add_inverter(Inverter *inverter, uint32_t due) {
+  if (get_interval(inverter) == SCHEDULER_DONT_RUN)
+    return;
+  heap_.push_back(PollEntry{due, inverter});
+  std::push_heap(heap_.begin(), heap_.end(), poll_entry_after);
+}
+
+void PollScheduler::remove_inverter(Inverter *inverter) {
+  auto it = std::find_if(heap_.begin(), heap_.end(), [inverter](const PollEntry &e) { return e.inverter == inverter; });
+  if (it == heap_.end())
+    return;
+  *it = heap_.back();
+  heap_.pop_back();
+  std::make_heap(heap_.begin(), heap_.end(), poll_entry_after);
+}
+
+void PollScheduler::start(uint32_t now, uint32_t default_interval) {
+  default_interval_ = default_interval;
+  // inverters added before the default interval was known and are never polled leave now
+  heap_.erase(std::remove_if(heap_.begin(), heap_.end(),
+                             [this](const PollEntry &e) { return get_interval(e.inverter) == SCHEDULER_DONT_RUN; }),
+              heap_.end());
+  // the first slots of the interval go to the inverters with the highest priority
+  std::stable_sort(heap_.begin(), heap_.end(), [](const PollEntry &a, const PollEntry &b) {
+    return a.inverter->get_poll_priority() > b.inverter->get_poll_priority();
+  });
+  uint32_t count = heap_.size();
+  for (uint32_t i = 0; i < count; i++)
+    heap_[i].due = now + (uint64_t) get_interval(heap_[i].inverter) * i / count;
+  std::make_heap(heap_.begin(), heap_.end(), poll_entry_after);
+}
+
+bool PollScheduler::is_due(uint32_t now) const { return !heap_.empty() && (int32_t) (now - heap_.front().due) >= 0; }
+
+uint32_t PollScheduler::get_next_due() const { return heap_.front().due; }
+
+Inverter *PollScheduler::pop_due(uint32_t now) {
+  // unpaired inverters are skipped, so every entry is looked at once at most
+  for (size_t i = 0; i < heap_.size() && is_due(now); i++) {
+    std::pop_heap(heap_.begin(), heap_.end(), poll_entry_after);
+    PollEntry &entry = heap_.back();
+    uint32_t interval = get_interval(entry.inverter);
+    // keep the phase of the inverter, unless it fell behind by a full interval
+    entry.due += interval;
+    if ((int32_t) (now - entry.due) >= 0)
+      entry.due = now + interval;
+    Inverter *inverter = entry.inverter;
+    std::push_heap(heap_.begin(), heap_.end(), poll_entry_after);
+    if (inverter->is_paired())
+      return inverter;
+  }
+  return nullptr;
+}
+
+uint32_t PollScheduler::get_interval(Inverter *inverter) const {
+  uint32_t interval = inverter->get_update_interval();
+  if (interval == 0)
+    interval = default_interval_;
+  // the due times compare as signed differences, longer intervals would wrap
+  return interval == SCHEDULER_DONT_RUN ? interval : std::min(interval, POLL_MAX_INTERVAL);
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "inverter.h"
+
+namespace esphome {
+namespace apsystems {
+
+static const uint32_t POLL_MAX_INTERVAL = 7 * 24 * 3600 * 1000UL;  // [ms] longer intervals are cut to this
+
+struct PollEntry {
+  uint32_t due;
+  Inverter *inverter;
+};
+
+// Min-heap of the inverters by the time their next poll is due. Each inverter is polled at its own interval,
+// inverters with a higher priority go first when several are due at once. Inverters with an interval of never
+// are not scheduled, they are only polled on request.
+class PollScheduler {
+ public:
+  // Adds an inverter with its first poll due at due, start() spreads the polls of all inverters added before
+  void add_inverter(Inverter *inverter, uint32_t due = 0);
+  void remove_inverter(Inverter *inverter);
+  // Spreads the first polls of all inverters evenly over their interval, starting at now
+  void start(uint32_t now, uint32_t default_interval);
+  bool is_due(uint32_t now) const;
+  // Time the next poll is due, only valid if there are inverters
+  uint32_t get_next_due() const;
+  bool empty() const { return heap_.empty(); }
+  // Returns the next paired inverter that is due and schedules its next poll, nullptr if none is due
+  Inverter *pop_due(uint32_t now);
+
+ protected:
+  // SCHEDULER_DONT_RUN if the inverter is never polled
+  uint32_t get_interval(Inverter *inverter) const;
+  std::vector<PollEntry> heap_{};
+  uint32_t default_interval_ = 0;
+};
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,170 @@
+#include "preference_store.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const char *const TAG = "apsystems.preferences";
+
+namespace esphome {
+namespace apsystems {
+
+static uint16_t blob_crc(const PreferenceBlob &blob) {
+  uint16_t crc = crc16(&blob.version, sizeof(blob.version) + sizeof(blob.count));
+  return crc16(reinterpret_cast<const uint8_t *>(blob.records), blob.count * sizeof(InverterRecord), crc);
+}
+
+void PreferenceStore::load(const std::string &key) {
+  std::vector<uint32_t> serial_hashes;
+  for (auto inv : inverters_)
+    serial_hashes.push_back(fnv1_hash(inv->get_serial()));
+  std::vector<bool> restored(inverters_.size(), false);
+  bool stored = false;
+  size_t slots = (inverters_.size() + PREFERENCE_SLOT_RECORDS - 1) / PREFERENCE_SLOT_RECORDS;
+  for (size_t s = 0; s < slots; s++) {
+    PreferenceSlot slot{global_preferences->make_preference<PreferenceBlob>(
+                            fnv1_hash(str_sprintf("%s_%u", key.c_str(), (unsigned) s)), true),
+                        0};
+    PreferenceBlob blob{};
+    bool loaded = slot.pref.load(&blob);
+    stored |= loaded;
+    if (loaded && blob.version == PREFERENCE_VERSION && blob.count <= PREFERENCE_SLOT_RECORDS &&
+        blob.crc == blob_crc(blob)) {
+      slot.committed_crc = blob.crc;
+      // the inverters of a slot change with the config, the records are matched by serial
+      for (uint16_t r = 0; r < blob.count; r++) {
+        for (size_t i = 0; i < inverters_.size(); i++) {
+          if (!restored[i] && serial_hashes[i] == blob.records[r].serial_hash) {
+            restore_(inverters_[i], blob.records[r]);
+            restored[i] = true;
+            break;
+          }
+        }
+      }
+    } else if (loaded) {
+      ESP_LOGW(TAG, "Preference slot %u is invalid, its inverters start over", (unsigned) s);
+    }
+    slots_.push_back(std::move(slot));
+  }
+
+  // the per inverter preferences are older than any slot, once a slot was written they are outdated
+  if (!stored)
+    ESP_LOGI(TAG, "No preferences stored, restoring the preferences of earlier versions");
+  for (auto inv : inverters_) {
+    if (!stored)
+      restore_legacy_(inv);
+    inv->set_preferences(this);
+  }
+  loaded_ = true;
+}
+
+void PreferenceStore::restore_(Inverter *inverter, const InverterRecord &record) {
+  InverterStore &store = *inverter->get_store();
+  uint16_t slot = inverter->get_slot();
+  for (uint8_t i = 0; i < 4; i++) {
+    store.energy_today(slot, i) = record.energy_today[i] * 1000LL;
+    store.energy_since_last_reset(slot, i) = record.energy_since_last_reset[i] * 1000LL;
+  }
+  store.poll_timestamp(slot) = record.last_poll_timestamp;
+  if (!inverter->is_paired() && record.pair_id[0] != '\0') {
+    char pair_id[sizeof(record.pair_id) + 1]{};
+    memcpy(pair_id, record.pair_id, sizeof(record.pair_id));
+    inverter->set_id(pair_id);
+  }
+}
+
+void PreferenceStore::restore_legacy_(Inverter *inverter) {
+  InverterPreference legacy{};
+  auto pref = global_preferences->make_preference<InverterPreference>(
+      fnv1_hash(std::string("inv_") + inverter->get_serial()));
+  if (!pref.load(&legacy) || legacy.last_poll_timestamp == LEGACY_MIGRATED)
+    return;
+  InverterStore &store = *inverter->get_store();
+  uint16_t slot = inverter->get_slot();
+  for (uint8_t i = 0; i < 4; i++) {
+    store.energy_today(slot, i) = llround(legacy.energy_today[i] * 1e6);
+    store.energy_since_last_reset(slot, i) = llround(legacy.energy_since_last_reset[i] * 1e6);
+  }
+  store.poll_timestamp(slot) = legacy.last_poll_timestamp;
+  legacy.pair_id[4] = '\0';
+  if (!inverter->is_paired())
+    inverter->set_id(legacy.pair_id);
+  legacy_.push_back(pref);
+  dirty_ = true;  // move it into the slots
+}
+
+void PreferenceStore::fill_(PreferenceBlob &blob, size_t index) {
+  size_t first = index * PREFERENCE_SLOT_RECORDS;
+  blob.version = PREFERENCE_VERSION;
+  blob.count = std::min<size_t>(inverters_.size() - first, PREFERENCE_SLOT_RECORDS);
+  for (uint16_t i = 0; i < blob.count; i++) {
+    Inverter *inv = inverters_[first + i];
+    InverterStore &store = *inv->get_store();
+    uint16_t slot = inv->get_slot();
+    InverterRecord &record = blob.records[i];
+    record.serial_hash = fnv1_hash(inv->get_serial());
+    strncpy(record.pair_id, inv->get_id(), sizeof(record.pair_id));
+    record.last_poll_timestamp = store.poll_timestamp(slot);
+    for (uint8_t p = 0; p < 4; p++) {
+      // rounded to mWh
+      record.energy_today[p] = (std::max<int64_t>(store.energy_today(slot, p), 0) + 500) / 1000;
+      record.energy_since_last_reset[p] =
+          (std::max<int64_t>(store.energy_since_last_reset(slot, p), 0) + 500) / 1000;
+    }
+  }
+  blob.crc = blob_crc(blob);
+}
+
+void PreferenceStore::mark_dirty(bool urgent) {
+  dirty_ = true;
+  urgent_ |= urgent;
+}
+
+void PreferenceStore::loop(uint32_t now) {
+  if (dirty_ && (urgent_ || now - last_commit_ >= commit_interval_))
+    commit();
+}
+
+void PreferenceStore::commit() {
+  if (!loaded_)
+    return;
+  dirty_ = false;
+  urgent_ = false;
+  last_commit_ = millis();
+  uint8_t written = 0;
+  bool saved = true;
+  for (size_t s = 0; s < slots_.size(); s++) {
+    PreferenceSlot &slot = slots_[s];
+    PreferenceBlob blob{};
+    fill_(blob, s);
+    if (blob.crc == slot.committed_crc)
+      continue;
+    if (!slot.pref.save(&blob)) {
+      ESP_LOGW(TAG, "Saving preference slot %u failed", (unsigned) s);
+      saved = false;
+      continue;
+    }
+    slot.committed_crc = blob.crc;
+    bytes_written_ += sizeof(PreferenceBlob);
+    written++;
+  }
+  if (saved && !legacy_.empty()) {
+    // the taken over preferences of earlier versions must not be restored again, they are outdated by now
+    InverterPreference migrated{};
+    migrated.last_poll_timestamp = LEGACY_MIGRATED;
+    for (auto &pref : legacy_)
+      pref.save(&migrated);
+    legacy_.clear();
+  } else if (written == 0) {
+    return;
+  }
+  global_preferences->sync();
+  commits_++;
+  commits_today_++;
+  ESP_LOGD(TAG, "Committed %u preference slots of %u inverters", written, (unsigned) inverters_.size());
+}
+
+}  // namespace apsystems
+}  // namespace esphome
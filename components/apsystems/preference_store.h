@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "esphome/core/preferences.h"
+#include "inverter.h"
+
+namespace esphome {
+namespace apsystems {
+
+static const uint8_t PREFERENCE_VERSION = 3;
+// Records of a preference slot. The stored size must not change with the config, a preference of another size doesn't
+// load anymore. Two slots fit the 512 bytes of flash preferences of the esp8266.
+static const uint8_t PREFERENCE_SLOT_RECORDS = 5;
+// last_poll_timestamp of a per inverter preference of earlier versions that was moved into the slots
+static const int LEGACY_MIGRATED = -1;
+
+// What is restored of an inverter after a reboot, energies in mWh so they fit 32 bit
+struct __attribute__((packed)) InverterRecord {
+  uint32_t serial_hash;  // the record belongs to the inverter with this serial, 0 if unused
+  char pair_id[4];
+  uint16_t last_poll_timestamp;
+  uint32_t energy_today[4];             // [mWh]
+  uint32_t energy_since_last_reset[4];  // [mWh]
+};
+
+// A preference slot with the records of up to PREFERENCE_SLOT_RECORDS inverters, the crc covers version, count and
+// the records
+struct __attribute__((packed)) PreferenceBlob {
+  uint8_t version;
+  uint16_t count;
+  uint16_t crc;
+  InverterRecord records[PREFERENCE_SLOT_RECORDS];
+};
+
+struct PreferenceSlot {
+  ESPPreferenceObject pref;
+  uint16_t committed_crc;  // crc of the blob last written, unchanged blobs are not written again
+};
+
+// Write-back cache of the inverter preferences. Changes only mark the slots dirty, they are written at most once per
+// commit interval and only if their content changed. Pair ids, the midnight rollover and shutdowns (which include
+// OTA updates) commit right away and sync the preferences to flash.
+class PreferenceStore {
+ public:
+  void set_commit_interval(uint32_t commit_interval) { commit_interval_ = commit_interval; }
+  uint32_t get_commit_interval() const { return commit_interval_; }
+  void add_inverter(Inverter *inverter) { inverters_.push_back(inverter); }
+  // Loads the slots stored under key and restores all inverters from them. Only if no slot was ever stored, the
+  // inverters fall back to the per inverter preferences of earlier versions.
+  void load(const std::string &key);
+  // Something to restore changed. Urgent changes are committed on the next loop.
+  void mark_dirty(bool urgent = false);
+  void loop(uint32_t now);
+  // Writes the slots that changed now and syncs the preferences to flash
+  void commit();
+  // Starts counting the commits of a new day
+  void start_day() { commits_today_ = 0; }
+  uint32_t get_bytes_written() const { return bytes_written_; }
+  uint32_t get_commits_today() const { return commits_today_; }
+  uint32_t get_commits() const { return commits_; }
+
+ protected:
+  void fill_(PreferenceBlob &blob, size_t index);
+  void restore_(Inverter *inverter, const InverterRecord &record);
+  void restore_legacy_(Inverter *inverter);
+
+  std::vector<Inverter *> inverters_{};
+  std::vector<PreferenceSlot> slots_{};
+  std::vector<ESPPreferenceObject> legacy_{};  // taken over, invalidated once the slots are written
+  bool loaded_{false};
+  bool dirty_{false};
+  bool urgent_{false};
+  uint32_t commit_interval_{900000};
+  uint32_t last_commit_{0};
+  uint32_t bytes_written_{0};
+  uint32_t commits_today_{0};
+  uint32_t commits_{0};
+};
+
+}  // namespace apsystems
+}  // namespace esphome
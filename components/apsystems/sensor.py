@@ -13,6 +13,7 @@ from esphome.const import (
     CONF_FREQUENCY,
     CONF_SIGNAL_STRENGTH,
     CONF_POWER,
+    CONF_UPDATE_INTERVAL,
     UNIT_WATT_HOURS,
     UNIT_CELSIUS,
     UNIT_VOLT,
@@ -30,7 +31,7 @@ from esphome.const import (
     STATE_CLASS_TOTAL_INCREASING,
     STATE_CLASS_MEASUREMENT,
 )
-from . import CONF_SERIAL, Apsystems, apsystems_ns
+from . import CONF_APSYSTEMS_ID, CONF_SERIAL, Apsystems, apsystems_ns
 
 DEPENDENCIES = ["apsystems"]
 
@@ -40,9 +41,13 @@ CONF_CONNECTED = "connected"
 CONF_DC_POWER = "dc_power"
 CONF_DC_VOLTAGE = "dc_voltage"
 CONF_DC_CURRENT = "dc_current"
-CONF_APSYSTEMS_ID = "apsystems_id"
+CONF_POLL_PRIORITY = "poll_priority"
+CONF_DEADBAND = "deadband"
+CONF_DEADBAND_RELATIVE = "deadband_relative"
+CONF_MAX_AGE = "max_age"
 
 Inverter = apsystems_ns.class_("Inverter")
+PublishFilter = apsystems_ns.struct("PublishFilter")
 
 InverterType = apsystems_ns.enum("InverterType")
 INVERTER_TYPES = {
@@ -60,6 +65,32 @@ def inverter_id(value):
     return value
 
 
+def inverter_sensor_schema(deadband, **kwargs):
+    """Sensor schema with the options of its publish filter.
+
+    The default deadband is half a digit of the default accuracy, so only changes
+    that show are published.
+    """
+    return sensor.sensor_schema(**kwargs).extend(
+        {
+            cv.Optional(CONF_DEADBAND, default=deadband): cv.positive_float,
+            cv.Optional(CONF_DEADBAND_RELATIVE, default=0): cv.percentage,
+            cv.Optional(
+                CONF_MAX_AGE, default="15min"
+            ): cv.positive_time_period_milliseconds,
+        }
+    )
+
+
+def publish_filter(config):
+    return cg.StructInitializer(
+        PublishFilter,
+        ("deadband", config[CONF_DEADBAND]),
+        ("deadband_relative", config[CONF_DEADBAND_RELATIVE]),
+        ("max_age", config[CONF_MAX_AGE]),
+    )
+
+
 def pair_id(value):
     value = cv.string(value)
     match = re.match(r"^[0-F]{4}$", value)
@@ -77,31 +108,36 @@ CONFIG_SCHEMA = cv.Schema(
         cv.Required(CONF_PANELS): cv.Schema(
             {
                 cv.Required(CONF_CONNECTED): cv.ensure_list(cv.boolean),
-                cv.Optional(CONF_ENERGY): sensor.sensor_schema(
+                cv.Optional(CONF_ENERGY): inverter_sensor_schema(
+                    0.005,
                     unit_of_measurement=UNIT_WATT_HOURS,
                     accuracy_decimals=2,
                     device_class=DEVICE_CLASS_ENERGY,
                     state_class=STATE_CLASS_TOTAL_INCREASING,
                 ),
-                cv.Optional(CONF_POWER): sensor.sensor_schema(
+                cv.Optional(CONF_POWER): inverter_sensor_schema(
+                    0.05,
                     unit_of_measurement=UNIT_WATT,
                     accuracy_decimals=1,
                     device_class=DEVICE_CLASS_POWER,
                     state_class=STATE_CLASS_MEASUREMENT,
                 ),
-                cv.Optional(CONF_DC_POWER): sensor.sensor_schema(
+                cv.Optional(CONF_DC_POWER): inverter_sensor_schema(
+                    0.05,
                     unit_of_measurement=UNIT_WATT,
                     accuracy_decimals=1,
                     device_class=DEVICE_CLASS_POWER,
                     state_class=STATE_CLASS_MEASUREMENT,
                 ),
-                cv.Optional(CONF_DC_VOLTAGE): sensor.sensor_schema(
+                cv.Optional(CONF_DC_VOLTAGE): inverter_sensor_schema(
+                    0.05,
                     unit_of_measurement=UNIT_VOLT,
                     accuracy_decimals=1,
                     device_class=DEVICE_CLASS_VOLTAGE,
                     state_class=STATE_CLASS_MEASUREMENT,
                 ),
-                cv.Optional(CONF_DC_CURRENT): sensor.sensor_schema(
+                cv.Optional(CONF_DC_CURRENT): inverter_sensor_schema(
+                    0.005,
                     unit_of_measurement=UNIT_AMPERE,
                     accuracy_decimals=2,
                     device_class=DEVICE_CLASS_CURRENT,
@@ -110,43 +146,52 @@ CONFIG_SCHEMA = cv.Schema(
             }
         ),
         cv.Optional(CONF_PAIR_ID): pair_id,
-        cv.Optional(CONF_ENERGY): sensor.sensor_schema(
+        cv.Optional(CONF_UPDATE_INTERVAL): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_POLL_PRIORITY, default=0): cv.int_range(min=0, max=255),
+        cv.Optional(CONF_ENERGY): inverter_sensor_schema(
+            0.005,
             unit_of_measurement=UNIT_WATT_HOURS,
             accuracy_decimals=2,
             device_class=DEVICE_CLASS_ENERGY,
             state_class=STATE_CLASS_TOTAL_INCREASING,
         ),
-        cv.Optional(CONF_TEMPERATURE): sensor.sensor_schema(
+        cv.Optional(CONF_TEMPERATURE): inverter_sensor_schema(
+            0.05,
             unit_of_measurement=UNIT_CELSIUS,
             accuracy_decimals=1,
             device_class=DEVICE_CLASS_TEMPERATURE,
             state_class=STATE_CLASS_MEASUREMENT,
         ),
-        cv.Optional(CONF_VOLTAGE): sensor.sensor_schema(
+        cv.Optional(CONF_VOLTAGE): inverter_sensor_schema(
+            0.05,
             unit_of_measurement=UNIT_VOLT,
             accuracy_decimals=1,
             device_class=DEVICE_CLASS_VOLTAGE,
             state_class=STATE_CLASS_MEASUREMENT,
         ),
-        cv.Optional(CONF_FREQUENCY): sensor.sensor_schema(
+        cv.Optional(CONF_FREQUENCY): inverter_sensor_schema(
+            0.005,
             unit_of_measurement=UNIT_HERTZ,
             accuracy_decimals=2,
             device_class=DEVICE_CLASS_FREQUENCY,
             state_class=STATE_CLASS_MEASUREMENT,
         ),
-        cv.Optional(CONF_SIGNAL_STRENGTH): sensor.sensor_schema(
+        cv.Optional(CONF_SIGNAL_STRENGTH): inverter_sensor_schema(
+            0.5,
             unit_of_measurement=UNIT_PERCENT,
             accuracy_decimals=0,
             device_class=DEVICE_CLASS_SIGNAL_STRENGTH,
             state_class=STATE_CLASS_MEASUREMENT,
         ),
-        cv.Optional(CONF_POWER): sensor.sensor_schema(
+        cv.Optional(CONF_POWER): inverter_sensor_schema(
+            0.05,
             unit_of_measurement=UNIT_WATT,
             accuracy_decimals=1,
             device_class=DEVICE_CLASS_POWER,
             state_class=STATE_CLASS_MEASUREMENT,
         ),
-        cv.Optional(CONF_DC_POWER): sensor.sensor_schema(
+        cv.Optional(CONF_DC_POWER): inverter_sensor_schema(
+            0.05,
             unit_of_measurement=UNIT_WATT,
             accuracy_decimals=1,
             device_class=DEVICE_CLASS_POWER,
@@ -179,29 +224,40 @@ async def to_code(config):
         cg.add(var.set_panel_connected(i, panel_state))
     if CONF_PAIR_ID in config:
         cg.add(var.set_id(config[CONF_PAIR_ID]))
+    if CONF_UPDATE_INTERVAL in config:
+        cg.add(var.set_update_interval(config[CONF_UPDATE_INTERVAL]))
+    cg.add(var.set_poll_priority(config[CONF_POLL_PRIORITY]))
     cg.add(coordinator.add_inverter(var))
 
     if CONF_ENERGY in config:
         sens = await sensor.new_sensor(config[CONF_ENERGY])
-        cg.add(var.set_energy_sensor(sens))
+        cg.add(var.set_energy_sensor(sens, publish_filter(config[CONF_ENERGY])))
     if CONF_TEMPERATURE in config:
         sens = await sensor.new_sensor(config[CONF_TEMPERATURE])
-        cg.add(var.set_temperature_sensor(sens))
+        cg.add(
+            var.set_temperature_sensor(sens, publish_filter(config[CONF_TEMPERATURE]))
+        )
     if CONF_VOLTAGE in config:
         sens = await sensor.new_sensor(config[CONF_VOLTAGE])
-        cg.add(var.set_ac_voltage_sensor(sens))
+        cg.add(var.set_ac_voltage_sensor(sens, publish_filter(config[CONF_VOLTAGE])))
     if CONF_FREQUENCY in config:
         sens = await sensor.new_sensor(config[CONF_FREQUENCY])
-        cg.add(var.set_ac_frequency_sensor(sens))
+        cg.add(
+            var.set_ac_frequency_sensor(sens, publish_filter(config[CONF_FREQUENCY]))
+        )
     if CONF_SIGNAL_STRENGTH in config:
         sens = await sensor.new_sensor(config[CONF_SIGNAL_STRENGTH])
-        cg.add(var.set_signal_quality_sensor(sens))
+        cg.add(
+            var.set_signal_quality_sensor(
+                sens, publish_filter(config[CONF_SIGNAL_STRENGTH])
+            )
+        )
     if CONF_POWER in config:
         sens = await sensor.new_sensor(config[CONF_POWER])
-        cg.add(var.set_ac_power_sensor(sens))
+        cg.add(var.set_ac_power_sensor(sens, publish_filter(config[CONF_POWER])))
     if CONF_DC_POWER in config:
         sens = await sensor.new_sensor(config[CONF_DC_POWER])
-        cg.add(var.set_dc_power_sensor(sens))
+        cg.add(var.set_dc_power_sensor(sens, publish_filter(config[CONF_DC_POWER])))
 
     for i in range(0, 4):
         if i < len(panel_config[CONF_CONNECTED]) and panel_config[CONF_CONNECTED][i]:
@@ -209,24 +265,44 @@ async def to_code(config):
                 sens = await sensor.new_sensor(
                     make_panel_sensor_config(i, panel_config[CONF_ENERGY])
                 )
-                cg.add(var.set_panel_energy_sensor(i, sens))
+                cg.add(
+                    var.set_panel_energy_sensor(
+                        i, sens, publish_filter(panel_config[CONF_ENERGY])
+                    )
+                )
             if CONF_POWER in panel_config:
                 sens = await sensor.new_sensor(
                     make_panel_sensor_config(i, panel_config[CONF_POWER])
                 )
-                cg.add(var.set_panel_ac_power_sensor(i, sens))
+                cg.add(
+                    var.set_panel_ac_power_sensor(
+                        i, sens, publish_filter(panel_config[CONF_POWER])
+                    )
+                )
             if CONF_DC_POWER in panel_config:
                 sens = await sensor.new_sensor(
                     make_panel_sensor_config(i, panel_config[CONF_DC_POWER])
                 )
-                cg.add(var.set_panel_dc_power_sensor(i, sens))
+                cg.add(
+                    var.set_panel_dc_power_sensor(
+                        i, sens, publish_filter(panel_config[CONF_DC_POWER])
+                    )
+                )
             if CONF_DC_VOLTAGE in panel_config:
                 sens = await sensor.new_sensor(
                     make_panel_sensor_config(i, panel_config[CONF_DC_VOLTAGE])
                 )
-                cg.add(var.set_panel_dc_voltage_sensor(i, sens))
+                cg.add(
+                    var.set_panel_dc_voltage_sensor(
+                        i, sens, publish_filter(panel_config[CONF_DC_VOLTAGE])
+                    )
+                )
             if CONF_DC_CURRENT in panel_config:
                 sens = await sensor.new_sensor(
                     make_panel_sensor_config(i, panel_config[CONF_DC_CURRENT])
                 )
-                cg.add(var.set_panel_dc_current_sensor(i, sens))
+                cg.add(
+                    var.set_panel_dc_current_sensor(
+                        i, sens, publish_filter(panel_config[CONF_DC_CURRENT])
+                    )
+                )
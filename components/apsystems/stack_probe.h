@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace apsystems {
+
+static const uint8_t STACK_PAINT = 0xA5;
+
+// Measures the stack used below a point: paint() fills Size bytes below the caller with a pattern, used() finds the
+// deepest byte that was written since. The stack grows down, so the deepest point is at the start of the area.
+template<size_t Size> class StackProbe {
+ public:
+  void __attribute__((noinline)) paint() {
+    volatile uint8_t area[Size];
+    for (size_t i = 0; i < Size; i++)
+      area[i] = STACK_PAINT;
+    area_ = (uintptr_t) area;
+  }
+  // Bytes of the painted area that were written since, Size if the stack went deeper
+  size_t __attribute__((noinline, no_sanitize_address)) used() const {
+    const volatile uint8_t *area = (const volatile uint8_t *) area_;
+    size_t untouched = 0;
+    while (untouched < Size && area[untouched] == STACK_PAINT)
+      untouched++;
+    return Size - untouched;
+  }
+
+ protected:
+  uintptr_t area_ = 0;
+};
+
+}  // namespace apsystems
+}  // namespace esphome
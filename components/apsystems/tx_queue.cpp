@@ -0,0 +1,33 @@
+#include "tx_queue.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+
+bool TxQueue::push(const uint8_t *data, size_t size) {
+  size_t free = TX_QUEUE_SIZE - size_;
+  if (size > free) {
+    overflows_++;
+    return false;
+  }
+  uint16_t tail = (head_ + size_) % TX_QUEUE_SIZE;
+  size_t first = std::min<size_t>(size, TX_QUEUE_SIZE - tail);
+  memcpy(buffer_ + tail, data, first);
+  memcpy(buffer_, data + first, size - first);
+  size_ += size;
+  return true;
+}
+
+size_t TxQueue::pop(uint8_t *data, size_t max) {
+  size_t count = std::min<size_t>(max, size_);
+  size_t first = std::min<size_t>(count, TX_QUEUE_SIZE - head_);
+  memcpy(data, buffer_ + head_, first);
+  memcpy(data + first, buffer_, count - first);
+  head_ = (head_ + count) % TX_QUEUE_SIZE;
+  size_ -= count;
+  return count;
+}
+
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace apsystems {
+
+static const uint16_t TX_QUEUE_SIZE = 256;
+
+// Ring buffer of the bytes waiting for the uart. Frames are queued whole or not at all, the coordinator hands them
+// to the uart in chunks that fit its hardware fifo, so writing never blocks the main loop.
+class TxQueue {
+ public:
+  // false if the frame doesn't fit, nothing is queued then
+  bool push(const uint8_t *data, size_t size);
+  // Takes up to max bytes out of the queue, returns how many
+  size_t pop(uint8_t *data, size_t max);
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear() { size_ = 0; }
+  uint32_t get_overflows() const { return overflows_; }
+
+ protected:
+  uint8_t buffer_[TX_QUEUE_SIZE];
+  uint16_t head_ = 0;  // oldest byte
+  uint16_t size_ = 0;
+  uint32_t overflows_ = 0;
+};
+
+}  // namespace apsystems
+}  // namespace esphome
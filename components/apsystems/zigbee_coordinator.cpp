@@ -1,60 +1,367 @@
 #include "zigbee_coordinator.h"
+#include "inverter_model.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#endif
+#ifdef USE_ESP8266
+#include <Esp.h>
+#endif
 
 static const char *const TAG = "apsystems.zigbee_coordinator";
-#define CC2530_MAX_MSG_SIZE (230 + 1)  // null char
 namespace esphome {
 namespace apsystems {
 
-// **************************************************************************
-//                               data converters
-// **************************************************************************
-// convert a char to Hex ******************************************************
-int StrToHex(char str[]) { return (int) strtol(str, 0, 16); }
-
-// reverse the ecu id **********************************************************
-std::string ECU_REVERSE(std::string ecu_id) {
-  std::string reverse = ecu_id.substr(10, 12) + ecu_id.substr(8, 10) + ecu_id.substr(6, 8) + ecu_id.substr(4, 6) +
-                        ecu_id.substr(2, 4) + ecu_id.substr(0, 2);
-  return reverse;
+// AF_DATA_REQUEST_EXT header shared by all pairing commands: broadcast to every inverter on endpoint 0x14
+static const uint8_t PAIR_COMMAND_HEADER[] = {0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                                              0xFF, 0xFF, 0x14, 0xFF, 0xFF, 0x14};
+
+// Inverter commands are AF_DATA_REQUESTs to endpoint 0x14, cluster 0x0006, radius 0x0F with 19 data bytes:
+// inverter address (2) | header (8) | ecu address (6) | command tail (13)
+// The templates hold zeros for the address fields, so their compile time FCS only needs the addresses xored in.
+static const uint8_t INVERTER_COMMAND_ADDRESS = 4;
+static const uint8_t INVERTER_COMMAND_TRANS_ID = 10;
+static const uint8_t INVERTER_COMMAND_ECU_ADDRESS = 14;
+static constexpr uint8_t POLL_COMMAND_TEMPLATE[INVERTER_COMMAND_FRAME_SIZE] = {
+    MT_SOF, 0x1D, 0x24, 0x01, 0x00, 0x00, 0x14, 0x14, 0x06, 0x00, 0x01, 0x00, 0x0F, 0x13, 0x00, 0x00, 0x00,
+    0x00,   0x00, 0x00, 0xFB, 0xFB, 0x06, 0xBB, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC1, 0xFE, 0xFE, 0x00};
+static constexpr uint8_t REBOOT_COMMAND_TEMPLATE[INVERTER_COMMAND_FRAME_SIZE] = {
+    MT_SOF, 0x1D, 0x24, 0x01, 0x00, 0x00, 0x14, 0x14, 0x06, 0x00, 0x01, 0x00, 0x0F, 0x13, 0x00, 0x00, 0x00,
+    0x00,   0x00, 0x00, 0xFB, 0xFB, 0x06, 0xC1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA6, 0xFE, 0xFE, 0x00};
+static constexpr uint8_t POLL_COMMAND_FCS = mt_fcs_array(POLL_COMMAND_TEMPLATE + 1, INVERTER_COMMAND_FRAME_SIZE - 2);
+static constexpr uint8_t REBOOT_COMMAND_FCS =
+    mt_fcs_array(REBOOT_COMMAND_TEMPLATE + 1, INVERTER_COMMAND_FRAME_SIZE - 2);
+
+// Broadcast that switches the inverters to normal operation, same layout as the inverter commands with 30 data bytes
+static const uint8_t NORMAL_OPERATION_ECU_ADDRESS = 14;
+static constexpr uint8_t NORMAL_OPERATION_TEMPLATE[NORMAL_OPERATION_FRAME_SIZE] = {
+    MT_SOF, 0x28, 0x24, 0x01, 0xFF, 0xFF, 0x14, 0x14, 0x06, 0x00, 0x01, 0x00, 0x0F, 0x1E, 0x00,
+    0x00,   0x00, 0x00, 0x00, 0x00, 0xFB, 0xFB, 0x11, 0x00, 0x00, 0x0D, 0x60, 0x30, 0xFB, 0xD3,
+    0x00,   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x01, 0x02, 0x81, 0xFE, 0xFE, 0x00};
+static constexpr uint8_t NORMAL_OPERATION_FCS =
+    mt_fcs_array(NORMAL_OPERATION_TEMPLATE + 1, NORMAL_OPERATION_FRAME_SIZE - 2);
+
+// Commands without variable parts
+using PingFrame = MtStaticFrame<MT_SYS_PING>;
+using DeviceInfoFrame = MtStaticFrame<MT_UTIL_GET_DEVICE_INFO>;
+using StartRequestFrame = MtStaticFrame<MT_ZB_START_REQUEST>;
+using ResetRequestFrame = MtStaticFrame<MT_SYS_RESET_REQ, 0x00>;
+using LogicalTypeFrame = MtStaticFrame<MT_ZB_WRITE_CONFIGURATION, 0x87, 0x01, 0x00>;  // coordinator
+using StartupOptionFrame = MtStaticFrame<MT_ZB_WRITE_CONFIGURATION, 0x03, 0x01, 0x03>;  // clear state and config
+using ChannelListFrame = MtStaticFrame<MT_ZB_WRITE_CONFIGURATION, 0x84, 0x04, 0x00, 0x00, 0x01, 0x00>;
+// register an application’s endpoint description
+using RegisterEndpointFrame = MtStaticFrame<MT_AF_REGISTER, 0x14, 0x05, 0x0F, 0x00, 0x01, 0x01, 0x00, 0x02, 0x00,
+                                            0x00, 0x15, 0x00, 0x00>;
+
+// Poll answers shorter than this don't carry inverter data
+static const uint8_t POLL_RESPONSE_MIN_DATA_SIZE = 76;
+// A pair answer carries the serial, the pair id and the ecu address, anything as long as a poll answer is none
+static const uint8_t PAIR_RESPONSE_MIN_DATA_SIZE = 18;
+
+void ZigbeeCoordinator::add_inverter(Inverter *inverter) {
+  this->inverters_.push_back(inverter);
+  // a "*" command queues one command per inverter, they all have to fit
+  commands_.set_capacity(inverters_.size());
+  poll_scheduler_.add_inverter(inverter, millis());
+  index_valid_ = false;
+  // the command frames carry the ecu address of the coordinator that built them
+  inverter->get_command_frames().valid = false;
 }
 
-char *split(const char *str, const char *delim) {
-  char *p = strstr(str, delim);
+bool ZigbeeCoordinator::remove_inverter(Inverter *inverter) {
+  if (is_pairing(inverter) || rebooting_inverter_ == inverter || commands_.contains(inverter))
+    return false;
+  for (auto &slot : poll_slots_) {
+    if (slot.inverter == inverter)
+      return false;
+  }
+  auto it = std::find(inverters_.begin(), inverters_.end(), inverter);
+  if (it == inverters_.end())
+    return false;
+  inverters_.erase(it);
+  poll_scheduler_.remove_inverter(inverter);
+  discovery_.forget(inverter);
+  index_valid_ = false;
+  return true;
+}
+void ZigbeeCoordinator::set_reset_pin(GPIOPin *pin) { reset_pin_ = pin; }
+void ZigbeeCoordinator::set_uart_device(uart::UARTDevice *uart) { uart_ = uart; }
 
-  if (p == NULL)
-    return NULL;             // delimiter not found
+ZigbeeCoordinator::ZigbeeCoordinator() {
+  parser_.set_on_frame(
+      [this](const MtFrame &frame, const uint8_t *raw, size_t raw_size) { zb_receive(frame, raw, raw_size); });
+}
 
-  *p = '\0';                 // terminate string after head
-  return p + strlen(delim);  // return tail substring
+// Free heap for the state profiling, 0 where it isn't known
+static uint32_t free_heap() {
+#if defined(USE_ESP32)
+  return heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+#elif defined(USE_ESP8266)
+  return ESP.getFreeHeap();
+#else
+  return 0;
+#endif
 }
 
-std::string checkSumString(const char *command) {
-  char bufferCRC[254] = {0};
-  char bufferCRC_2[254] = {0};
+void ZigbeeCoordinator::loop() {
+  if (!state_profiling_) {
+    step();
+    return;
+  }
+  // the loop counts for the state it started in
+  uint8_t state = state_;
+  stack_probe_.paint();
+  step();
+  metrics_.state_stack[state] = std::max<uint16_t>(metrics_.state_stack[state], stack_probe_.used());
+  uint32_t heap = free_heap();
+  if (metrics_.state_free_heap[state] == 0 || heap < metrics_.state_free_heap[state])
+    metrics_.state_free_heap[state] = heap;
+}
 
-  strncpy(bufferCRC, command, 2);  // as starting point perhaps called "seed" use the first two chars from "command"
-  delayMicroseconds(250);          // give memset a little bit of time to empty all the buffers
+void ZigbeeCoordinator::step() {
+  frame_received_ = false;
+  uint8_t chunk[32];
+  size_t available;
+  while ((available = uart_->available()) > 0) {
+    size_t len = std::min(available, sizeof(chunk));
+    if (!uart_->read_array(chunk, len))
+      break;
+    for (size_t i = 0; i < len; i++)
+      parser_.feed(chunk[i]);
+  }
+#ifdef USE_HOST
+  zb_replay();
+#endif
+  zb_transmit();
+  if (state_ == ZigbeeCoordinatorState::CS_STOPPED)
+    return;
+  // run when a waiting command received a frame or the deadline of the current state passed, sleep otherwise
+  if ((frame_received_ && data_state_ == DataReadState::DS_WAITING) || (int32_t) (millis() - next_run_) >= 0)
+    run();
+  zb_transmit();  // start what run queued right away
+}
 
-  for (uint8_t i = 1; i <= (strlen(command) / 2 - 1); i++) {
-    strncpy(bufferCRC_2, command + i * 2, 2);  // use every iteration the next two chars starting with char 2+3
-    delayMicroseconds(250);                    // give memset a little bit of time to empty all the buffers
-    sprintf(bufferCRC, "%02X", StrToHex(bufferCRC) ^ StrToHex(bufferCRC_2));
-    delayMicroseconds(250);                    // give memset a little bit of time to empty all the buffers
+void ZigbeeCoordinator::zb_receive(const MtFrame &frame, const uint8_t *raw, size_t raw_size) {
+  ESP_LOGVV(TAG, "  read zb %s", format_hex_pretty(raw, raw_size).c_str());
+  capture_.record(CaptureDirection::CD_RX, micros(), raw, raw_size);
+  // answers of inverters nobody waits for are used right away, before a send clears the buffer
+  if (frame.is(MT_AF_INCOMING_MSG) && zb_dispatch(frame))
+    return;
+  if (rx_size_ + raw_size > ZB_RX_BUFFER_SIZE) {
+    ESP_LOGW(TAG, "receive buffer full, dropping frame %04X", frame.command);
+    return;
   }
-  return std::string(bufferCRC);
+  memcpy(rx_buffer_ + rx_size_, raw, raw_size);
+  rx_size_ += raw_size;
+  frame_received_ = true;
 }
 
-void ZigbeeCoordinator::add_inverter(Inverter *inverter) { this->inverters_.push_back(inverter); }
-void ZigbeeCoordinator::set_reset_pin(GPIOPin *pin) { reset_pin_ = pin; }
-void ZigbeeCoordinator::set_uart_device(uart::UARTDevice *uart) { uart_ = uart; }
+bool ZigbeeCoordinator::zb_dispatch(const MtFrame &frame) {
+  // pairing and discovery take every answer themselves, short answers aren't poll answers
+  if (pair_count_ > 0 || state_ == ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS ||
+      frame.length < AF_INCOMING_MSG_DATA + POLL_RESPONSE_MIN_DATA_SIZE)
+    return false;
+  const uint8_t *address = frame.payload + AF_INCOMING_MSG_SRC_ADDR;
+  for (auto &slot : poll_slots_) {
+    if (slot.inverter != nullptr && memcmp(slot.address, address, 2) == 0)
+      return false;  // the poll in flight takes it
+  }
+  Inverter *inverter = find_inverter_by_address(address);
+  if (inverter == nullptr)
+    return false;
+  mark_alive();
+  if (zb_decode_poll_response(inverter, frame, true)) {
+    metrics_.late_answers++;
+    inverter->set_unsuccessfull_polls(0);
+  }
+  return true;
+}
+
+Inverter *ZigbeeCoordinator::find_inverter_by_address(const uint8_t *address) { return get_index().find(address); }
+
+void ZigbeeCoordinator::build_index() {
+  index_.build(inverters_);
+  index_valid_ = true;
+}
+
+const InverterIndex &ZigbeeCoordinator::get_index() {
+  if (!index_valid_)
+    build_index();
+  return index_;
+}
+
+#ifdef USE_HOST
+bool ZigbeeCoordinator::replay_capture(std::vector<uint8_t> &&capture) {
+  if (!FrameCapture::parse(capture.data(), capture.size(), [](CaptureDirection, uint32_t, const uint8_t *, size_t) {}))
+    return false;
+  replay_ = std::move(capture);
+  replay_pos_ = sizeof(CAPTURE_MAGIC);
+  replay_first_ = replay_pos_ < replay_.size() ? FrameCapture::record_timestamp(replay_.data() + replay_pos_) : 0;
+  replay_started_ = micros();
+  ESP_LOGI(TAG, "replaying a capture of %u bytes", (unsigned) replay_.size());
+  return true;
+}
+
+void ZigbeeCoordinator::zb_replay() {
+  // the capture was validated, each record is complete
+  while (replay_pos_ < replay_.size()) {
+    const uint8_t *header = replay_.data() + replay_pos_;
+    size_t raw_size = header[5];
+    if (header[0] == CaptureDirection::CD_RX) {
+      uint32_t offset = FrameCapture::record_timestamp(header) - replay_first_;
+      if (micros() - replay_started_ < offset)
+        return;
+      for (size_t i = 0; i < raw_size; i++)
+        parser_.feed(header[CAPTURE_RECORD_HEADER_SIZE + i]);
+    }
+    replay_pos_ += CAPTURE_RECORD_HEADER_SIZE + raw_size;
+  }
+  if (!replay_.empty()) {
+    ESP_LOGI(TAG, "replay finished");
+    replay_.clear();
+  }
+}
+#endif
+
+void ZigbeeCoordinator::set_next_run(uint32_t delay_ms) { next_run_ = millis() + delay_ms; }
+
+bool ZigbeeCoordinator::has_pending_work() {
+  return pair_count_ > 0 || rebooting_inverter_ != nullptr || discovery_requested_ || !commands_.empty() ||
+         poll_scheduler_.is_due(millis());
+}
+
+bool ZigbeeCoordinator::queue_command(CommandType type, Inverter *inverter, CommandCallback &&callback) {
+  if (!commands_.push(type, inverter, std::move(callback))) {
+    ESP_LOGW(TAG, "command queue full, dropping command for inverter %s", inverter->get_serial());
+    if (callback)
+      callback(false);
+    return false;
+  }
+  if (state_ == ZigbeeCoordinatorState::CS_IDLE)
+    next_run_ = millis();  // idle picks it up right away
+  return true;
+}
 
-void ZigbeeCoordinator::set_delay_to_next_execution(int delay_ms) { delay_to_next_execution_ = delay_ms; }
-int ZigbeeCoordinator::get_delay_to_next_execution() { return delay_to_next_execution_; }
+void ZigbeeCoordinator::complete_active_command(bool success) {
+  CommandCallback callback = std::move(active_callback_);
+  active_callback_ = nullptr;
+  if (callback)
+    callback(success);
+}
+
+void ZigbeeCoordinator::start_poll_scheduler(uint32_t default_interval) {
+  poll_scheduler_.start(millis(), default_interval);
+}
+
+static const char *state_name(uint8_t state) {
+  switch (state) {
+    case CS_STOPPED:
+      return "stopped";
+    case CS_CHECK_1:
+      return "check 1";
+    case CS_CHECK_2:
+      return "check 2";
+    case CS_RECOVER:
+      return "recover";
+    case CS_HARD_RESET_COORDINATOR:
+      return "hard reset";
+    case CS_INITIALIZE_COORDINATOR:
+      return "initialize";
+    case CS_ENTER_NORMAL_OPERATION:
+      return "enter normal operation";
+    case CS_SOFT_RESET_COORDINATOR:
+      return "soft reset";
+    case CS_IDLE:
+      return "idle";
+    case CS_POLL_INVERTER:
+      return "poll";
+    case CS_PAIR_INVERTER:
+      return "pair";
+    case CS_REBOOT_INVERTER:
+      return "reboot";
+    case CS_DISCOVER_INVERTERS:
+      return "discover";
+    default:
+      return "unknown";
+  }
+}
+
+void ZigbeeCoordinator::dump_config() {
+  const CoordinatorMetrics &m = metrics_;
+  if (m.polls > 0) {
+    ESP_LOGCONFIG(TAG, "  Polls: %u, %u%% answered", (unsigned) m.polls,
+                  (unsigned) ((m.polls - m.failed_polls) * 100ULL / m.polls));
+    ESP_LOGCONFIG(TAG, "    Round trip: p50 %ums, p95 %ums, max %ums", (unsigned) m.poll_rtt.percentile(50),
+                  (unsigned) m.poll_rtt.percentile(95), (unsigned) m.poll_rtt.get_max());
+    ESP_LOGCONFIG(TAG, "    Decoding: p50 %uus, p95 %uus, max %uus", (unsigned) m.decode_time.percentile(50),
+                  (unsigned) m.decode_time.percentile(95), (unsigned) m.decode_time.get_max());
+    if (m.late_answers > 0)
+      ESP_LOGCONFIG(TAG, "    Late answers used: %u", (unsigned) m.late_answers);
+  }
+  if (m.sweeps > 0)
+    ESP_LOGCONFIG(TAG, "  Sweep over the inverters: %ums, %u sweeps", (unsigned) m.sweep_time, (unsigned) m.sweeps);
+  ESP_LOGCONFIG(TAG, "  Coordinator responses: p50 %ums, p95 %ums, max %ums",
+                (unsigned) m.response_time.percentile(50), (unsigned) m.response_time.percentile(95),
+                (unsigned) m.response_time.get_max());
+  ESP_LOGCONFIG(TAG, "  Recovery attempts: %u resyncs, %u soft resets, %u full resets, %u resets today",
+                (unsigned) m.recovery_attempts[RT_RESYNC], (unsigned) m.recovery_attempts[RT_SOFT_RESET],
+                (unsigned) m.recovery_attempts[RT_FULL], (unsigned) m.resets_today);
+  // the current state counts up to now
+  uint32_t time[COORDINATOR_STATES];
+  uint64_t total = 0;
+  for (uint8_t s = 0; s < COORDINATOR_STATES; s++) {
+    time[s] = m.state_time[s] + (s == state_ ? millis() - state_entered_ : 0);
+    total += time[s];
+  }
+  if (total == 0)
+    return;
+  ESP_LOGCONFIG(TAG, "  Time per state:");
+  for (uint8_t s = 0; s < COORDINATOR_STATES; s++) {
+    if (time[s] == 0)
+      continue;
+    if (!state_profiling_) {
+      ESP_LOGCONFIG(TAG, "    %s: %u.%u%%", state_name(s), (unsigned) (time[s] * 100ULL / total),
+                    (unsigned) (time[s] * 1000ULL / total % 10));
+    } else {
+      // a stack use of the whole probe means at least that much, the free heap isn't known on every platform
+      char heap[32] = "";
+      if (m.state_free_heap[s] > 0)
+        snprintf(heap, sizeof(heap), ", free heap %u bytes", (unsigned) m.state_free_heap[s]);
+      ESP_LOGCONFIG(TAG, "    %s: %u.%u%%, stack %s%u bytes%s", state_name(s), (unsigned) (time[s] * 100ULL / total),
+                    (unsigned) (time[s] * 1000ULL / total % 10), m.state_stack[s] >= ZB_STACK_PROBE_SIZE ? ">" : "",
+                    (unsigned) m.state_stack[s], heap);
+    }
+  }
+}
 
-void ZigbeeCoordinator::restart(std::string ecu_id, bool hard) {
-  ecu_id.copy(ecu_id_, 12, 0);
-  ECU_REVERSE(ecu_id).copy(ecu_id_reverse_, 12, 0);
+void ZigbeeCoordinator::restart(const char *ecu_id, bool hard) {
+  strncpy(ecu_id_, ecu_id, sizeof(ecu_id_) - 1);
+  uint8_t ecu_bytes[6];
+  parse_hex(ecu_id_, ecu_bytes, 6);
+  uint8_t ecu_address[6];
+  for (int i = 0; i < 6; i++)
+    ecu_address[i] = ecu_bytes[5 - i];
+  if (!frames_valid_ || memcmp(ecu_address, ecu_address_, 6) != 0) {
+    memcpy(ecu_address_, ecu_address, 6);
+    zb_build_frames();
+  }
+  for (auto &slot : poll_slots_) {
+    if (slot.inverter == nullptr)
+      continue;
+    slot.inverter = nullptr;
+    CommandCallback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    if (callback)
+      callback(false);
+  }
+  poll_request_pending_ = nullptr;
+  if (state_ == ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS)
+    zb_discover_complete(false);
+  tx_.clear();
   reset_pin_->digital_write(true);
   if (hard)
     set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
@@ -62,38 +369,98 @@ void ZigbeeCoordinator::restart(std::string ecu_id, bool hard) {
     set_state(ZigbeeCoordinatorState::CS_CHECK_1);
 }
 
+void ZigbeeCoordinator::zb_build_frames() {
+  ecu_address_fcs_ = mt_checksum(ecu_address_, 6);
+  memcpy(normal_operation_frame_, NORMAL_OPERATION_TEMPLATE, NORMAL_OPERATION_FRAME_SIZE);
+  memcpy(normal_operation_frame_ + NORMAL_OPERATION_ECU_ADDRESS, ecu_address_, 6);
+  normal_operation_frame_[NORMAL_OPERATION_FRAME_SIZE - 1] = NORMAL_OPERATION_FCS ^ ecu_address_fcs_;
+  frames_valid_ = true;
+  // the inverter commands carry the ecu address as well
+  for (auto inv : inverters_) {
+    inv->get_command_frames().valid = false;
+    if (inv->is_paired())
+      zb_build_inverter_frames(inv);
+  }
+}
+
+void ZigbeeCoordinator::zb_build_inverter_frames(Inverter *inverter) {
+  uint8_t address[2];
+  parse_hex(inverter->get_id(), address, 2);
+  uint8_t fcs = address[0] ^ address[1] ^ ecu_address_fcs_;
+  InverterCommandFrames &frames = inverter->get_command_frames();
+  memcpy(frames.poll, POLL_COMMAND_TEMPLATE, INVERTER_COMMAND_FRAME_SIZE);
+  memcpy(frames.reboot, REBOOT_COMMAND_TEMPLATE, INVERTER_COMMAND_FRAME_SIZE);
+  for (uint8_t *frame : {frames.poll, frames.reboot}) {
+    memcpy(frame + INVERTER_COMMAND_ADDRESS, address, 2);
+    memcpy(frame + INVERTER_COMMAND_ECU_ADDRESS, ecu_address_, 6);
+  }
+  frames.poll[INVERTER_COMMAND_FRAME_SIZE - 1] = POLL_COMMAND_FCS ^ fcs;
+  frames.reboot[INVERTER_COMMAND_FRAME_SIZE - 1] = REBOOT_COMMAND_FCS ^ fcs;
+  frames.valid = true;
+}
+
+void ZigbeeCoordinator::mark_alive() {
+  healthcheck_due_ = millis() + healthcheck_quiet_period_;
+  healthcheck_required_ = false;
+}
+
+void ZigbeeCoordinator::request_healthcheck() {
+  healthcheck_due_ = millis();
+  healthcheck_required_ = true;
+}
+
 void ZigbeeCoordinator::set_state(ZigbeeCoordinatorState state) {
+  // account the time from entering the first check until leaving the checks
+  bool checking = state == ZigbeeCoordinatorState::CS_CHECK_1 || state == ZigbeeCoordinatorState::CS_CHECK_2;
+  bool was_checking = state_ == ZigbeeCoordinatorState::CS_CHECK_1 || state_ == ZigbeeCoordinatorState::CS_CHECK_2;
+  if (checking && !was_checking) {
+    healthcheck_started_ = millis();
+  } else if (!checking && was_checking) {
+    healthcheck_time_ += millis() - healthcheck_started_;
+    healthchecks_++;
+  }
   switch (state_) {
     case ZigbeeCoordinatorState::CS_CHECK_1:
     case ZigbeeCoordinatorState::CS_CHECK_2:
-      if (state == state_)
-        set_delay_to_next_execution(700);  // wait until next try
-      else
-        set_delay_to_next_execution(100);  // Can continue quickly
+      set_next_run(state == state_ ? ZB_CHECK_RETRY_DELAY : 0);  // wait until next try or continue right away
       break;
     case ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR:
-      set_delay_to_next_execution(2500);  // wait for cc2530 to reboot
+      set_next_run(state == state_ ? ZB_RESET_PULSE : ZB_HARD_RESET_DELAY);  // release the pin or wait for reboot
+      break;
+    case ZigbeeCoordinatorState::CS_SOFT_RESET_COORDINATOR:
+    case ZigbeeCoordinatorState::CS_RECOVER:
+      set_next_run(0);
       break;
     case ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR:
-      set_delay_to_next_execution(1000);  // wait for cc2530 to initialize
+      set_next_run(ZB_INITIALIZE_DELAY);
       break;
     case ZigbeeCoordinatorState::CS_ENTER_NORMAL_OPERATION:
-      set_delay_to_next_execution(500);  // wait for start of normal operation
+      set_next_run(ZB_NORMAL_OPERATION_DELAY);
       break;
     case ZigbeeCoordinatorState::CS_PAIR_INVERTER:
+      set_next_run(ZB_PAIR_COMMAND_DELAY);
+      break;
     case ZigbeeCoordinatorState::CS_POLL_INVERTER:
+    case ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS:
     case ZigbeeCoordinatorState::CS_IDLE:
-      set_delay_to_next_execution(100);  // Can continue quickly
+      set_next_run(0);  // Can continue right away
       break;
     case ZigbeeCoordinatorState::CS_REBOOT_INVERTER:
-      set_delay_to_next_execution(2000);  // Wait for reboot until we read the response
+      set_next_run(ZB_REBOOT_DELAY);
       break;
     case ZigbeeCoordinatorState::CS_STOPPED:
       break;
   }
-  if (state == ZigbeeCoordinatorState::CS_IDLE)
-    set_delay_to_next_execution(1000);
+  // idle sleeps until new work is queued, the next poll or the next healthcheck is due
+  if (state == ZigbeeCoordinatorState::CS_IDLE && !has_pending_work()) {
+    next_run_ = healthcheck_due_;
+    if (!poll_scheduler_.empty() && (int32_t) (poll_scheduler_.get_next_due() - next_run_) < 0)
+      next_run_ = poll_scheduler_.get_next_due();
+  }
   if (state_ != state) {
+    uint32_t now = millis();
+    metrics_.state_time[state_] += now - state_entered_;
+    state_entered_ = now;
     state_ = state;
     state_tries_ = 0;
   }
@@ -104,22 +471,17 @@ void ZigbeeCoordinator::run() {
     return;
   ZigbeeCoordinatorState oldState = state_;
   if (state_ != ZigbeeCoordinatorState::CS_IDLE)
-    ESP_LOGVV(TAG, "coordinator run starting (state %i:%i - data state %i:%i)", state_, state_tries_, data_state_,
-              data_state_tries_);
+    ESP_LOGVV(TAG, "coordinator run starting (state %i:%i - data state %i)", state_, state_tries_, data_state_);
   AsyncBoolResult cmdResult;
-  bool found_current_inverter;
   switch (state_) {
     case ZigbeeCoordinatorState::CS_CHECK_1:
       if ((cmdResult = zb_ping())) {
         if (cmdResult == AsyncBoolResult::AB_SUCCESS) {
           // Ping successfoll -> go to second check
           set_state(ZigbeeCoordinatorState::CS_CHECK_2);
-        } else if (state_tries_ < 3) {
-          // Zigbee Coordinator not responding -> try again
-          set_state(ZigbeeCoordinatorState::CS_CHECK_1);
         } else {
-          // Zigbee Coordinator not working -> initialize
-          set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+          // Zigbee Coordinator not responding -> recover
+          recover();
         }
       }
       break;
@@ -127,32 +489,59 @@ void ZigbeeCoordinator::run() {
       if ((cmdResult = zb_check())) {
         if (cmdResult == AsyncBoolResult::AB_SUCCESS) {
           // Ping successfull -> go to IDLE
-          if (pairing_inverter_ != nullptr)
+          mark_alive();
+          if (recovering_) {
+            recovering_ = false;
+            recovery_time_ = millis() - recovery_started_;
+            recoveries_++;
+            ESP_LOGI(TAG, "coordinator recovered in %ums (%s)", (unsigned) recovery_time_,
+                     recovery_tier_ == RecoveryTier::RT_RESYNC       ? "resync"
+                     : recovery_tier_ == RecoveryTier::RT_SOFT_RESET ? "soft reset"
+                                                                     : "full initialization");
+          }
+          if (pair_count_ > 0)
             set_state(ZigbeeCoordinatorState::CS_PAIR_INVERTER);  // start pairing
           else
             set_state(ZigbeeCoordinatorState::CS_IDLE);
-        } else if (state_tries_ < 3) {
-          // Zigbee Coordinator not responding -> try again
-          set_state(ZigbeeCoordinatorState::CS_CHECK_2);
         } else {
-          // Zigbee Coordinator not working -> initialize
-          set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+          // Zigbee Coordinator not working -> recover
+          recover();
         }
       }
       break;
+    case ZigbeeCoordinatorState::CS_RECOVER:
+      if (recovery_tier_ == RecoveryTier::RT_RESYNC) {
+        zb_resync();
+        set_state(ZigbeeCoordinatorState::CS_CHECK_1);
+      } else if (recovery_tier_ == RecoveryTier::RT_SOFT_RESET) {
+        set_state(ZigbeeCoordinatorState::CS_SOFT_RESET_COORDINATOR);
+      } else {
+        set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+      }
+      break;
     case ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR:
-      zb_hardreset();
-      set_state(ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR);
+      if (zb_hardreset())
+        set_state(ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR);
+      break;
+    case ZigbeeCoordinatorState::CS_SOFT_RESET_COORDINATOR:
+      if ((cmdResult = zb_soft_reset())) {
+        if (cmdResult != AsyncBoolResult::AB_SUCCESS)
+          recover();
+        else if (pair_count_ > 0)
+          set_state(ZigbeeCoordinatorState::CS_CHECK_1);  // We are pairing, skip entering NO
+        else
+          set_state(ZigbeeCoordinatorState::CS_ENTER_NORMAL_OPERATION);
+      }
       break;
     case ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR:
       if ((cmdResult = zb_initialize())) {
         if (cmdResult == AsyncBoolResult::AB_SUCCESS) {
-          if (pairing_inverter_ != nullptr)
+          if (pair_count_ > 0)
             set_state(ZigbeeCoordinatorState::CS_CHECK_1);  // We are pairing, skip entering NO
           else
             set_state(ZigbeeCoordinatorState::CS_ENTER_NORMAL_OPERATION);
         } else
-          set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+          recover();
       }
       break;
     case ZigbeeCoordinatorState::CS_ENTER_NORMAL_OPERATION:
@@ -160,81 +549,66 @@ void ZigbeeCoordinator::run() {
         if (cmdResult == AsyncBoolResult::AB_SUCCESS)
           set_state(ZigbeeCoordinatorState::CS_CHECK_1);
         else
-          set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+          recover();
       }
       break;
     case ZigbeeCoordinatorState::CS_IDLE:
-      // Check connection about every 30 seconds
-      healthcheck_idle_counter_++;
-      if (healthcheck_idle_counter_ > 30) {
-        healthcheck_idle_counter_ = 0;
+      // Check the connection after an error, or once it was quiet for a while and no command would prove it alive
+      if ((int32_t) (millis() - healthcheck_due_) >= 0 && (healthcheck_required_ || !has_pending_work())) {
         set_state(ZigbeeCoordinatorState::CS_CHECK_1);
-      } else if (pairing_inverter_ != nullptr) {
-        restart(ecu_id_, true);
-      } else if (rebooting_inverter_ != nullptr) {
+      } else if (!commands_.empty() && commands_.peek()->type == CommandType::COMMAND_PAIR) {
+        zb_pair_start();
+        // the initialization resets the coordinator by itself, the reset pin is only needed if it hangs
+        set_state(ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR);
+      } else if (!commands_.empty() && commands_.peek()->type == CommandType::COMMAND_REBOOT) {
+        Command command;
+        commands_.pop(command);
+        active_callback_ = std::move(command.callback);
+        ESP_LOGI(TAG, "rebooting inverter %s", command.inverter->get_serial());
+        rebooting_inverter_ = command.inverter;
         set_state(ZigbeeCoordinatorState::CS_REBOOT_INVERTER);
-      } else if (polling_inverter_ != nullptr) {
+      } else if (discovery_requested_) {
+        discovery_requested_ = false;
+        discovery_.clear();
+        discovery_phase_ = DiscoveryPhase::DP_NEIGHBORS;
+        discovery_index_ = 0;
+        discovery_request_pending_ = false;
+        ESP_LOGI(TAG, "discovering inverters");
+        set_state(ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS);
+      } else if (!commands_.empty() || poll_scheduler_.is_due(millis())) {
         set_state(ZigbeeCoordinatorState::CS_POLL_INVERTER);
       }
       break;
     case ZigbeeCoordinatorState::CS_PAIR_INVERTER:
-      if ((cmdResult = zb_pair(pairing_inverter_))) {
-        auto paired_inverter = pairing_inverter_;
-        pairing_inverter_ = nullptr;
-        if (pair_all_mode_) {
-          pair_all_mode_ = false;
-          found_current_inverter = false;
-          for (auto inv : inverters_) {
-            if (!found_current_inverter) {
-              if (inv == paired_inverter)
-                found_current_inverter = true;
-            } else if (!inv->is_paired()) {
-              pairing_inverter_ = inv;
-              pair_all_mode_ = true;
-              break;
-            }
-          }
-        }
-        if (pair_all_mode_) {
-          state_tries_ = -1;  // restart pair with new inverter
+      if ((cmdResult = zb_pair())) {
+        // pairings queued meanwhile follow right away, the coordinator is still set up for pairing
+        const Command *next = commands_.peek();
+        if (next != nullptr && next->type == CommandType::COMMAND_PAIR) {
+          zb_pair_start();
         } else if (cmdResult == AsyncBoolResult::AB_SUCCESS) {
           set_state(ZigbeeCoordinatorState::CS_ENTER_NORMAL_OPERATION);
         } else {
-          set_state(ZigbeeCoordinatorState::CS_HARD_RESET_COORDINATOR);
+          set_state(ZigbeeCoordinatorState::CS_INITIALIZE_COORDINATOR);  // leave the pairing setup
         }
       }
       break;
     case ZigbeeCoordinatorState::CS_POLL_INVERTER:
-      if ((cmdResult = zb_poll(polling_inverter_))) {
-        auto polled_inverter = polling_inverter_;
-        polling_inverter_ = nullptr;
-        if (poll_all_mode_) {
-          poll_all_mode_ = false;
-          found_current_inverter = false;
-          for (auto inv : inverters_) {
-            if (!found_current_inverter) {
-              if (inv == polled_inverter)
-                found_current_inverter = true;
-            } else if (inv->is_paired()) {
-              polling_inverter_ = inv;
-              poll_all_mode_ = true;
-              break;
-            }
-          }
-        }
-        if (poll_all_mode_) {
-          state_tries_ = -1;  // restart poll with new inverter
-        } else {
-          set_state(ZigbeeCoordinatorState::CS_IDLE);
-        }
-      }
+      if (zb_poll())
+        set_state(ZigbeeCoordinatorState::CS_IDLE);
       break;
     case ZigbeeCoordinatorState::CS_REBOOT_INVERTER:
       if ((cmdResult = zb_reboot_inverter(rebooting_inverter_))) {
+        if (cmdResult == AsyncBoolResult::AB_SUCCESS)
+          mark_alive();
         rebooting_inverter_ = nullptr;
+        complete_active_command(cmdResult == AsyncBoolResult::AB_SUCCESS);
         set_state(ZigbeeCoordinatorState::CS_IDLE);
       }
       break;
+    case ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS:
+      if (zb_discover())
+        set_state(ZigbeeCoordinatorState::CS_IDLE);
+      break;
     case ZigbeeCoordinatorState::CS_STOPPED:
       break;
   }
@@ -244,6 +618,7 @@ void ZigbeeCoordinator::run() {
   }
 }
 
+
 AsyncBoolResult ZigbeeCoordinator::zb_initialize() {
   if (data_state_ == DataReadState::DS_IDLE) {
     /*
@@ -274,39 +649,44 @@ AsyncBoolResult ZigbeeCoordinator::zb_initialize() {
     if (state_tries_ == 0) {
       ESP_LOGD(TAG, "init zb coordinator");
     }
-    // yield();
-    char initCmd[254] = {0};
-    // commands for setting up coordinater
-    char initBaseCommand[][254] = {
-        "2605030103",                      // ok   this is a ZB_WRITE_CONFIGURATION CMD //changed to 01
-        "410000",                          // ok   ZB_SYS_RESET_REQ
-        "26050108FFFF",                    // + ecu_id_reverse,  this is a ZB_WRITE_CONFIGURATION CMD
-        "2605870100",                      // ok
-        "26058302",                        // + ecu_id.substring(0,2) + ecu_id.substring(2,4),
-        "2605840400000100",                // ok
-        "240014050F00010100020000150000",  // AF_REGISTER register an application’s endpoint description
-        "2600",                            // ok ZB_START_REQUEST
-    };
-
-    // construct some of the commands
-    // ***************************** command 2 ********************************************
-    // command 2 this is 26050108FFFF we add ecu_id reversed
-    strncat(initBaseCommand[2], ecu_id_reverse_, 12);
-    // DebugPrintln("initBaseCmd 2 constructed = " + String(initBaseCommand[2]));  // ok
-
-    // ***************************** command 4 ********************************************
-    // command 4 this is 26058302 + ecu_id_short
-    strncat(initBaseCommand[4], ecu_id_, 2);
-    strncat(initBaseCommand[4], ecu_id_ + 2, 2);
-
     ESP_LOGVV(TAG, "init send cmd %i", state_tries_);
 
-    zb_send(initBaseCommand[state_tries_]);
+    // commands for setting up coordinater
+    switch (state_tries_) {
+      case 0:
+        zb_send(StartupOptionFrame::DATA, StartupOptionFrame::SIZE, MT_ZB_WRITE_CONFIGURATION_SRSP);
+        break;
+      case 1:
+        zb_send(ResetRequestFrame::DATA, ResetRequestFrame::SIZE, MT_SYS_RESET_IND);
+        break;
+      case 2: {
+        MtFrameBuilder &frame = zb_frame(MT_ZB_WRITE_CONFIGURATION);  // extended pan id FFFF + ecu id reversed
+        frame.add(0x01).add(0x08).add(0xFF).add(0xFF).add(ecu_address_, 6);
+        zb_send(frame, MT_ZB_WRITE_CONFIGURATION_SRSP);
+        break;
+      }
+      case 3:
+        zb_send(LogicalTypeFrame::DATA, LogicalTypeFrame::SIZE, MT_ZB_WRITE_CONFIGURATION_SRSP);
+        break;
+      case 4: {
+        MtFrameBuilder &frame = zb_frame(MT_ZB_WRITE_CONFIGURATION);  // pan id, the first 2 bytes of the ecu id
+        frame.add(0x83).add(0x02).add(ecu_address_[5]).add(ecu_address_[4]);
+        zb_send(frame, MT_ZB_WRITE_CONFIGURATION_SRSP);
+        break;
+      }
+      case 5:
+        zb_send(ChannelListFrame::DATA, ChannelListFrame::SIZE, MT_ZB_WRITE_CONFIGURATION_SRSP);
+        break;
+      case 6:
+        zb_send(RegisterEndpointFrame::DATA, RegisterEndpointFrame::SIZE, MT_AF_REGISTER_SRSP);
+        break;
+      default:
+        zb_send(StartRequestFrame::DATA, StartRequestFrame::SIZE, MT_ZB_START_REQUEST_SRSP);
+        break;
+    }
   }
-  int bytesRead = 0;
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};  // provide a buffer for the call to readZB
   // check if anything was received
-  if (!zb_read(s_d, bytesRead))  // we read but flush the answer
+  if (!zb_read())  // we read but flush the answer
     return AsyncBoolResult::AB_INCOMPLETE;
   if (state_tries_ < 7)
     return AsyncBoolResult::AB_INCOMPLETE;
@@ -316,11 +696,83 @@ AsyncBoolResult ZigbeeCoordinator::zb_initialize() {
 // *************************************************************************
 //                          hard reset the cc25xx
 // *************************************************************************
-void ZigbeeCoordinator::zb_hardreset() {
-  reset_pin_->digital_write(false);
-  delay(50);
+AsyncBoolResult ZigbeeCoordinator::zb_hardreset() {
+  if (state_tries_ == 0) {
+    reset_pin_->digital_write(false);  // released on the next run
+    return AsyncBoolResult::AB_INCOMPLETE;
+  }
   reset_pin_->digital_write(true);
   ESP_LOGV(TAG, "zb module hard reset");
+  return AsyncBoolResult::AB_SUCCESS;
+}
+
+// *************************************************************************
+//          reset the ZNP, it restarts the network stored in NV
+// *************************************************************************
+AsyncBoolResult ZigbeeCoordinator::zb_soft_reset() {
+  if (data_state_ == DataReadState::DS_IDLE) {
+    if (state_tries_ == 0)
+      ESP_LOGD(TAG, "soft reset zb coordinator");
+    // the endpoint registration is lost with the reset, the network configuration is kept
+    switch (state_tries_) {
+      case 0:
+        zb_send(ResetRequestFrame::DATA, ResetRequestFrame::SIZE, MT_SYS_RESET_IND);
+        break;
+      case 1:
+        zb_send(RegisterEndpointFrame::DATA, RegisterEndpointFrame::SIZE, MT_AF_REGISTER_SRSP);
+        break;
+      default:
+        zb_send(StartRequestFrame::DATA, StartRequestFrame::SIZE, MT_ZB_START_REQUEST_SRSP);
+        break;
+    }
+  }
+  AsyncBoolResult result = zb_read();
+  if (result != AsyncBoolResult::AB_SUCCESS)
+    return result;
+  if (state_tries_ < 2)
+    return AsyncBoolResult::AB_INCOMPLETE;
+  return AsyncBoolResult::AB_SUCCESS;
+}
+
+// Drops everything unread and a partial frame, a glitch on the uart can leave the parser waiting for a frame that
+// never completes
+void ZigbeeCoordinator::zb_resync() {
+  uint8_t chunk[32];
+  size_t available;
+  while ((available = uart_->available()) > 0) {
+    if (!uart_->read_array(chunk, std::min(available, sizeof(chunk))))
+      break;
+  }
+  parser_.reset();
+  rx_size_ = 0;
+  data_state_ = DataReadState::DS_IDLE;
+  ESP_LOGV(TAG, "zb uart resync");
+}
+
+// Escalates from a resync over a soft reset to the full initialization, with a backoff that doubles per attempt
+void ZigbeeCoordinator::recover() {
+  if (!recovering_) {
+    recovering_ = true;
+    recovery_started_ = millis();
+    recovery_attempt_ = 0;
+  }
+  if (recovery_attempt_ < ZB_RESYNC_ATTEMPTS)
+    recovery_tier_ = RecoveryTier::RT_RESYNC;
+  else if (recovery_attempt_ == ZB_RESYNC_ATTEMPTS)
+    recovery_tier_ = RecoveryTier::RT_SOFT_RESET;
+  else
+    recovery_tier_ = RecoveryTier::RT_FULL;
+  uint32_t backoff = ZB_RECOVERY_BACKOFF_MAX;
+  if (recovery_attempt_ < 16)
+    backoff = std::min(ZB_RECOVERY_BACKOFF_MIN << recovery_attempt_, ZB_RECOVERY_BACKOFF_MAX);
+  if (recovery_attempt_ < UINT8_MAX)
+    recovery_attempt_++;
+  metrics_.recovery_attempts[recovery_tier_]++;
+  if (recovery_tier_ != RecoveryTier::RT_RESYNC)
+    metrics_.resets_today++;
+  ESP_LOGD(TAG, "coordinator recovery attempt %u in %ums", recovery_attempt_, (unsigned) backoff);
+  set_state(ZigbeeCoordinatorState::CS_RECOVER);
+  next_run_ = millis() + backoff;
 }
 
 // **************************************************************************************
@@ -328,32 +780,15 @@ void ZigbeeCoordinator::zb_hardreset() {
 // **************************************************************************************
 AsyncBoolResult ZigbeeCoordinator::zb_enter_normal_operation() {
   if (data_state_ == DataReadState::DS_IDLE) {
-    char noCmd[100] = {0};  //  this buffer must have the right length
-
-    snprintf(noCmd, sizeof(noCmd), "2401FFFF1414060001000F1E%sFBFB1100000D6030FBD3000000000000000004010281FEFE",
-             ecu_id_reverse_);
-    // lenth=36+12+1
-    // Serial.println("noCmd = " + String(noCmd));
-
-    // add sln at the beginning
-    // char comMand[100];
-    // sprintf(comMand, "%02X", (strlen(noCmd) / 2 - 2));
-    // strcat(comMand, noCmd);
-
-    // add the CRC at the end of the command is done by sendZigbee
-    ESP_LOGVV(TAG, "send normal ops initCmd = %s", noCmd);
-    zb_send(noCmd);
+    ESP_LOGVV(TAG, "send normal ops initCmd");
+    zb_send(normal_operation_frame_, NORMAL_OPERATION_FRAME_SIZE, MT_AF_DATA_REQUEST_SRSP);
   }
 
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};  // provide a buffer for the call to readZB
-  int bytesRead = 0;
   // check if anything was received
-  // waitSerial2Available();
-  if (!zb_read(s_d, bytesRead))
+  if (!zb_read())
     return AsyncBoolResult::AB_INCOMPLETE;
 
   // do nothing with the returned value
-  // if(readCounter == 0) Serial.println("no answer");
 
   ESP_LOGVV(TAG, "zb initializing ready, now check running");
   return AsyncBoolResult::AB_SUCCESS;
@@ -364,8 +799,6 @@ AsyncBoolResult ZigbeeCoordinator::zb_check() {
     // We entered for the first time, so send the 2700 command
     //  the answer can mean that the coordinator is up, not yet started or no answer
     //  we evaluate that
-    //  first empty serial2, comming from coordinator this is necessary;
-    //  empty_serial2(); is done in the loop
 
     // the response = 67 00, status 1 bt, IEEEAddr 8bt, ShortAddr 2bt, DeviceType 1bt, Device State 1bt
     //  FE0E 67 00 00 FFFF 80971B01A3D8 0000 0709001
@@ -374,39 +807,20 @@ AsyncBoolResult ZigbeeCoordinator::zb_check() {
     // Device State 09 started as zigbeecoordinator
 
     ESP_LOGV(TAG, "check zb radio");
-    // if(log) Update_Log("zigbee", "checking zb module");
-    // check the radio, send FE00670067
-    //  when ok the returned string = FE0E670000FFFF + ECU_ID REVERSE + 00000709001
-    //  so we check if we have this
-
-    char checkCommand[10];  // we send 2700 to the zb
-    strncpy(checkCommand, "2700", 5);
-
-    char received[254] = {0};  // a buffer for the received message
-    zb_send(checkCommand);
+    zb_send(DeviceInfoFrame::DATA, DeviceInfoFrame::SIZE, MT_UTIL_GET_DEVICE_INFO_SRSP);
   }
 
-  char *tail;
-  int bytes_read = 0;
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};
   // now read the answer if there is one
-  if (!zb_read(s_d, bytes_read))
+  if (!zb_read())
     return AsyncBoolResult::AB_INCOMPLETE;
 
-  // if ( waitSerial2Available() ) { readZigbee(); } else { readCounter = 0;} // when nothing available we don't read
-  // ESP_LOGD(TAG, "cc inMessage = " + String(inMessage) + " rc = " + String(readCounter))
-
   // we get this : FE0E670000 FFFF80971B01A3D8 0000 07090011 or
   //    received : FE0E670000 FFFF80971B01A3D6 0000 0709001F when ok
-
-  // check if ecu_id_reverse is in the string, then split it there + 2 bytes
-  if (strstr(s_d, ecu_id_reverse_)) {
-    tail = split(s_d, ecu_id_reverse_ + 4);
-    // the tail should contain 0709
-    if (strstr(tail, "0709")) {
-      ESP_LOGVV(TAG, "check ok");
-      return AsyncBoolResult::AB_SUCCESS;
-    }
+  MtFrame info;
+  if (zb_find_frame(MT_UTIL_GET_DEVICE_INFO_SRSP, info) && info.length >= 13 &&
+      memcmp(info.payload + 3, ecu_address_, 6) == 0 && info.get_u8(11) == 0x07 && info.get_u8(12) == 0x09) {
+    ESP_LOGVV(TAG, "check ok");
+    return AsyncBoolResult::AB_SUCCESS;
   }
 
   ESP_LOGVV(TAG, "check failed");
@@ -416,20 +830,14 @@ AsyncBoolResult ZigbeeCoordinator::zb_check() {
 AsyncBoolResult ZigbeeCoordinator::zb_ping() {
   if (data_state_ == DataReadState::DS_IDLE) {
     // if the ping command failed then we have to restart the coordinator
-    // Update_Log("zigbee", "check serial loopback");
-    // these commands already have the length 00 and checksum 20 resp 26
-    char pingCmd[5] = {"2101"};  // ping
     ESP_LOGVV(TAG, "send zb ping");
-
-    zb_send(pingCmd);  // answer should be FE02 6101 79 07 1C
+    zb_send(PingFrame::DATA, PingFrame::SIZE, MT_SYS_PING_SRSP);  // answer should be FE02 6101 79 07 1C
   }
-  char received[254] = {0};
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};
-  int bytes_read = 0;
-  if (!zb_read(s_d, bytes_read))  // READ INCOMPLETE
+  if (!zb_read())  // READ INCOMPLETE
     return AsyncBoolResult::AB_INCOMPLETE;
 
-  if (strstr(s_d, "FE026101") == NULL) {
+  MtFrame pong;
+  if (!zb_find_frame(MT_SYS_PING_SRSP, pong)) {
     ESP_LOGVV(TAG, "pinging zigbee coordinator failed");
     return AsyncBoolResult::AB_FAIL;
   } else {
@@ -442,99 +850,91 @@ AsyncBoolResult ZigbeeCoordinator::zb_ping() {
 //                            read zigbee
 // *****************************************************************************
 
-AsyncBoolResult ZigbeeCoordinator::zb_read(char buf[], int &bytes_read) {
-  bytes_read = 0;
-  buf[0] = '\0';
-
+AsyncBoolResult ZigbeeCoordinator::zb_read() {
   if (data_state_ == DataReadState::DS_IDLE) {
-    if (!uart_->available()) {
-      {
-        data_state_tries_ = 0;
-        data_state_ = DataReadState::DS_WAITING;
-      }
-    }
-  }
-
-  if (data_state_ == DataReadState::DS_WAITING) {
-    data_state_tries_++;
-    if (!uart_->available()) {
-      if (data_state_tries_ > 20) {
-        data_state_ = DataReadState::DS_IDLE;
-        return AsyncBoolResult::AB_FAIL;
-      } else {
-        return AsyncBoolResult::AB_INCOMPLETE;
-      }
-    }
+    data_state_ = DataReadState::DS_WAITING;
+    read_started_ = millis();
   }
 
-  if (data_state_ == DataReadState::DS_READING &&
-      (uart_->available() == data_state_tries_ || uart_->available() >= CC2530_MAX_MSG_SIZE - 1)) {
-    char oneChar[10] = {0};
-    // fullIncomingMessage[0] = '\0'; //terminate otherwise all is appended
-    // memset( &inMessage, 0, sizeof(inMessage) ); //zero out the
-    // delayMicroseconds(250);
-
-    while (uart_->available()) {
-      // Serial.print("#");
-      //  here we have the danger that when readcounter reaches 512, there are 1024 bytes processed
-      //  the length of a poll answer is usually not more than 223
-      if (bytes_read < CC2530_MAX_MSG_SIZE - 1) {
-        sprintf(oneChar, "%02X", uart_->read());  // always uppercase
-        strncat(buf, oneChar, 2);                 // append
-        bytes_read += 1;
-      } else {
-        while (uart_->available()) {
-          uart_->read();
-        }  // remove all excess data in the buffer at once
-      }
-    }
-    // with swaps we get F8 sometimes, this removes it
-    if (buf[0] == 'F' && buf[1] == '8') {
-      ESP_LOGVV(TAG, "found F8");
-      strcpy(buf, &buf[2]);
-    }
-
-    ESP_LOGVV(TAG, "  read zb %s  rc=%i", buf, bytes_read);
+  MtFrame frame;
+  if (zb_find_frame(response_, frame)) {
     data_state_ = DataReadState::DS_IDLE;
-    data_state_tries_ = 0;
+    metrics_.response_time.add(millis() - read_started_);
     return AsyncBoolResult::AB_SUCCESS;
   }
-
-  data_state_ = DataReadState::DS_READING;
-  data_state_tries_ = uart_->available();
-  set_delay_to_next_execution(120);
+  // a failed AF request won't be answered, no need to wait for the timeout
+  if ((zb_find_frame(MT_AF_DATA_REQUEST_SRSP, frame) || zb_find_frame(MT_AF_DATA_REQUEST_EXT_SRSP, frame) ||
+       zb_find_frame(MT_AF_DATA_CONFIRM, frame)) &&
+      frame.get_u8(0) != 0x00) {
+    data_state_ = DataReadState::DS_IDLE;
+    return AsyncBoolResult::AB_FAIL;
+  }
+  if (millis() - read_started_ > ZB_RESPONSE_TIMEOUT) {
+    ESP_LOGVV(TAG, "  read zb timeout waiting for %04X", response_);
+    data_state_ = DataReadState::DS_IDLE;
+    return AsyncBoolResult::AB_FAIL;
+  }
   return AsyncBoolResult::AB_INCOMPLETE;
 }
 
+bool ZigbeeCoordinator::zb_find_frame(uint16_t command, MtFrame &frame) {
+  size_t pos = 0;
+  while (mt_next_frame(rx_buffer_, rx_size_, pos, frame)) {
+    if (frame.is(command))
+      return true;
+  }
+  return false;
+}
+
 // *****************************************************************************
 //                 send to zigbee radio
 // *****************************************************************************
-void ZigbeeCoordinator::zb_send(char printString[]) {
-  char bufferSend[254] = {0};
-  char byteSend[3];                                            // never more than 2 bytes
-  sprintf(bufferSend, "%02X", (strlen(printString) / 2 - 2));  // now contains a hex representation of the length
-  // first add length and the checksum
-  strcat(bufferSend, printString);
-
-  strcat(bufferSend, checkSumString(bufferSend).c_str());
-
-  // Clear read buffer
-  while (uart_->available())
-    uart_->read();
+void ZigbeeCoordinator::zb_send(MtFrameBuilder &frame, uint16_t response) {
+  const uint8_t *data = frame.finish();
+  zb_send(data, frame.get_size(), response);
+}
 
-  uart_->write(0xFE);  // we have to send "FE" at start of each command
-  for (uint8_t i = 0; i <= strlen(bufferSend) / 2 - 1; i++) {
-    // we use 2 characters to make a byte
-    strncpy(byteSend, bufferSend + i * 2, 2);
+void ZigbeeCoordinator::zb_send(const uint8_t *frame, size_t size, uint16_t response) {
+  // Forget frames that belong to earlier commands
+  rx_size_ = 0;
 
-    uart_->write(StrToHex(byteSend));  // turn the two chars to a byte and send this
+  // a frame that doesn't fit is lost like a frame garbled on the wire, the response times out
+  if (!tx_.push(frame, size)) {
+    ESP_LOGW(TAG, "transmit queue full, dropping frame");
+  } else {
+    capture_.record(CaptureDirection::CD_TX, micros(), frame, size);
   }
 
-  uart_->flush();  // wait till the full command was sent
+  ESP_LOGVV(TAG, "  send zb %s", format_hex_pretty(frame, size).c_str());
 
-  ESP_LOGVV(TAG, "  send zb FE%s", bufferSend);
+  response_ = response;
+  data_state_ = DataReadState::DS_WAITING;
+  read_started_ = millis();
+  tx_waiting_ = true;
+  // sleep until the answer arrives, or run once more to report the timeout
+  next_run_ = read_started_ + ZB_RESPONSE_TIMEOUT + 1;
+}
 
-  // else if (diagNose == 2) ws.textAll("sendZB FE" + String(bufferSend));
+void ZigbeeCoordinator::zb_transmit() {
+  uint32_t now = micros();
+  if ((int32_t) (now - tx_idle_at_) < 0)
+    return;  // the uart is still sending the last chunk
+  if (!tx_.empty()) {
+    uint8_t chunk[ZB_TX_CHUNK];
+    size_t size = tx_.pop(chunk, sizeof(chunk));
+    uart_->write_array(chunk, size);
+    tx_idle_at_ = now + size * ZB_BYTE_TIME_US;
+    return;
+  }
+  if (!tx_waiting_)
+    return;
+  // the frame is on the wire, the timeouts count from now
+  tx_waiting_ = false;
+  uint32_t sent = millis();
+  next_run_ += sent - read_started_;
+  read_started_ = sent;
+  if (poll_request_pending_ != nullptr)
+    poll_request_pending_->sent = sent;
 }
 
 // ******************************************************************************
@@ -542,403 +942,609 @@ void ZigbeeCoordinator::zb_send(char printString[]) {
 // *******************************************************************************
 AsyncBoolResult ZigbeeCoordinator::zb_reboot_inverter(Inverter *inverter) {
   if (data_state_ == DataReadState::DS_IDLE && state_tries_ == 0) {
-    char rebootCmd[57];
-
-    char command[][30] = {
-        "2401",
-        "1414060001000F13",
-        "FBFB06C1000000000000A6FEFE",
-    };
-    // length = 46 + 4 + 12 + 1= 53
-
-    // construct the command
-    strncpy(rebootCmd, command[0], 4);
-    strncat(rebootCmd, inverter->get_id(), 4);  // add inv_id
-    strncat(rebootCmd, command[1], 16);
-    strncat(rebootCmd, ecu_id_reverse_, 12);
-    strncat(rebootCmd, command[2], 26);
-    // String term = "the rebootCmd = " + String(rebootCmd);
-    // should be 2401 3A10 1414060001000F13 80971B01B3D7 FBFB06C1000000000000A6FEFE
-
-    //} else
-
     // should be 2401 103A 1414060001000F13 80 97 1B 01 A3 D6 FBFB06C1000000000000A6FEFE
-    //           2401 A310 1414060001000F13 80 97 1B 01 A3 D6 FBFB06C1000000000000A6FEFE
-    //           2401 3A10 1414060001000F13 80 97 1B 01 B3 D7 FBFB06C1000000000000A6FEFE
-
-    // put in the CRC at the end of the command in sendZigbee
-
-    zb_send(rebootCmd);
+    if (!inverter->get_command_frames().valid)
+      zb_build_inverter_frames(inverter);
+    zb_send(inverter->get_command_frames().reboot, INVERTER_COMMAND_FRAME_SIZE, MT_AF_DATA_CONFIRM);
     return AsyncBoolResult::AB_INCOMPLETE;  // WAIT A BIT
   }
-  int bytesRead = 0;
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};
-  if (!zb_read(s_d, bytesRead))
+  if (!zb_read())
     return AsyncBoolResult::AB_INCOMPLETE;
-  return AsyncBoolResult::AB_SUCCESS;
+  // only a confirm with status 00 means the inverter took the command, zb_read also ends on a failure or timeout
+  MtFrame confirm;
+  if (zb_find_frame(MT_AF_DATA_CONFIRM, confirm) && confirm.length >= 1 && confirm.get_u8(0) == 0x00)
+    return AsyncBoolResult::AB_SUCCESS;
+  ESP_LOGW(TAG, "rebooting inverter %s was not confirmed", inverter->get_serial());
+  request_healthcheck();
+  return AsyncBoolResult::AB_FAIL;
 }
 
-bool ZigbeeCoordinator::start_pair_inverter(const char *serial) {
-  for (auto inv : inverters_) {
-    if (serial[0] == '*') {
-      if (!inv->is_paired()) {
-        pairing_inverter_ = inv;
-        pair_all_mode_ = true;
-        break;
-      }
-    } else {
-      if (strcmp(serial, inv->get_serial()) == 0) {
-        pairing_inverter_ = inv;
-        break;
-      }
+Inverter *ZigbeeCoordinator::find_inverter(const char *serial) { return get_index().find(serial); }
+
+bool ZigbeeCoordinator::start_pair_inverter(const char *serial, CommandCallback &&callback) {
+  if (serial[0] == '*') {
+    std::vector<Inverter *> unpaired;
+    for (auto inv : inverters_) {
+      if (!inv->is_paired())
+        unpaired.push_back(inv);
+    }
+    if (unpaired.empty()) {
+      ESP_LOGI(TAG, "pairing skipped: all inverters are already paired");
+      if (callback)
+        callback(true);
+      return false;
     }
+    ESP_LOGI(TAG, "pairing all unpaired inverters");
+    CommandCallback group = make_group_callback(unpaired.size(), std::move(callback));
+    bool queued = true;
+    for (auto inv : unpaired)
+      queued &= queue_command(CommandType::COMMAND_PAIR, inv, CommandCallback(group));
+    return queued;
   }
 
-  if (pairing_inverter_ == nullptr) {
-    if (serial[0] == '*')
-      ESP_LOGI(TAG, "pairing skipped: all inverters are already paired");
-    else
-      ESP_LOGE(TAG, "pairing failed: inverter with serial %s is not configured", serial);
-  } else if (state_ != ZigbeeCoordinatorState::CS_IDLE) {
-    ESP_LOGI(TAG, "pairing defered: coordinator busy or not configured", serial);
-  } else {
-    if (pair_all_mode_)
-      ESP_LOGI(TAG, "pairing all unpaired inverters");
-    else
-      ESP_LOGI(TAG, "pairing inverter %s", pairing_inverter_->get_serial());
-    restart(ecu_id_, true);
-    return true;
+  Inverter *inverter = find_inverter(serial);
+  if (inverter == nullptr) {
+    ESP_LOGE(TAG, "pairing failed: inverter with serial %s is not configured", serial);
+    if (callback)
+      callback(false);
+    return false;
   }
-  return false;
+  ESP_LOGD(TAG, "queued pairing of inverter %s", serial);
+  return queue_command(CommandType::COMMAND_PAIR, inverter, std::move(callback));
 }
 
-AsyncBoolResult ZigbeeCoordinator::zb_pair(Inverter *inverter) {
-  static bool success;
-  if (data_state_ == DataReadState::DS_IDLE) {
-    // the pairing process consistst of 4 commands sent to the coordinator
-    char pairCmd[254] = {0};
+void ZigbeeCoordinator::zb_pair_start() {
+  Command command;
+  pair_count_ = 0;
+  while (pair_count_ < ZB_PAIR_BATCH && commands_.pop(CommandType::COMMAND_PAIR, command)) {
+    PairSlot &slot = pair_slots_[pair_count_++];
+    slot.inverter = command.inverter;
+    slot.answered = false;
+    slot.callback = std::move(command.callback);
+  }
+  pair_command_ = 0;
+  pair_next_ = 0;
+  pair_request_pending_ = false;
+  pair_started_ = millis();
+  ESP_LOGI(TAG, "pairing %u inverters", pair_count_);
+}
 
-    char ecu_short[5] = {0};
-    strncat(ecu_short, ecu_id_ + 2, 2);  // D8A3011B9780 should be A3D8
-    strncat(ecu_short, ecu_id_, 2);
+bool ZigbeeCoordinator::is_pairing(const Inverter *inverter) const {
+  for (uint8_t i = 0; i < pair_count_; i++) {
+    if (pair_slots_[i].inverter == inverter)
+      return true;
+  }
+  return false;
+}
 
-    switch (state_tries_) {
-      case 0:
-        success = false;
-        ESP_LOGI(TAG, "starting pair of %s", inverter->get_serial());
-        // command 0
-        // build command 0 this is "24020FFFFFFFFFFFFFFFFF14FFFF14" + "0D0200000F1100" + String(invSerial) +
-        // "FFFF10FFFF" + ecu_id_reverse
-        snprintf(pairCmd, sizeof(pairCmd), "24020FFFFFFFFFFFFFFFFF14FFFF140D0200000F1100%sFFFF10FFFF%s",
-                 inverter->get_serial(), ecu_id_reverse_);
-        break;
-      case 1:
-        // build command 1 this is "24020FFFFFFFFFFFFFFFFF14FFFF14" + "0C0201000F0600"  + inv serial,
-        snprintf(pairCmd, sizeof(pairCmd), "24020FFFFFFFFFFFFFFFFF14FFFF140C0201000F0600%s", inverter->get_serial());
-        break;
-      case 2:
-        // build command 2 this is "24020FFFFFFFFFFFFFFFFF14FFFF14" + "0F0102000F1100"  + invSerial + short
-        // ecu_id_reverse, + 10FFF + ecu_id_reverse
+// Pairs the inverters of the batch in one pairing session of the coordinator. The pairing consists of 4 commands,
+// they go out in rounds: each round sends its command to every inverter of the batch, one after the other as the
+// coordinator takes them. The inverters answer the commands 1 and 2 with their pair id, the answers are matched by
+// serial whenever they arrive, the last answer wins. Command 3 only carries the ecu address, it goes out once.
+AsyncBoolResult ZigbeeCoordinator::zb_pair() {
+  zb_pair_receive();
+  uint32_t now = millis();
+  if (pair_request_pending_ && now - pair_sent_ > ZB_RESPONSE_TIMEOUT) {
+    ESP_LOGD(TAG, "did not receive AF_DATA_REQUEST_EXT_SRSP while pairing");
+    pair_request_pending_ = false;
+    request_healthcheck();
+  }
 
-        snprintf(pairCmd, sizeof(pairCmd), "24020FFFFFFFFFFFFFFFFF14FFFF140F0102000F1100%s%s10FFFF%s",
-                 inverter->get_serial(), ecu_short, ecu_id_reverse_);
-        break;
-      case 3:
-        // now build command 3 this is "24020FFFFFFFFFFFFFFFFF14FFFF14"  + "010103000F0600" + ecu_id_reverse,
-        snprintf(pairCmd, sizeof(pairCmd), "24020FFFFFFFFFFFFFFFFF14FFFF14010103000F0600%s", ecu_id_reverse_);
+  bool answering = pair_command_ == 1 || pair_command_ == 2;
+  uint8_t requests = pair_command_ == 3 ? 1 : pair_count_;
+  if (!pair_request_pending_) {
+    if (pair_next_ < requests) {
+      if (now - pair_sent_ >= ZB_PAIR_COMMAND_DELAY || pair_next_ == 0)
+        zb_pair_send(pair_slots_[pair_next_++].inverter);
+    } else {
+      // the round is done once the coordinator took all requests and all inverters answered or timed out
+      bool waiting = false;
+      for (uint8_t i = 0; i < pair_count_ && answering; i++)
+        waiting |= !pair_slots_[i].answered;
+      if (!waiting || now - pair_sent_ > ZB_RESPONSE_TIMEOUT) {
+        if (pair_command_ == 3)
+          return zb_pair_complete();
+        pair_command_++;
+        pair_next_ = 0;
+        ESP_LOGD(TAG, "pairing command %u", pair_command_);
+        next_run_ = now + ZB_PAIR_COMMAND_DELAY;
+        data_state_ = DataReadState::DS_WAITING;
+        return AsyncBoolResult::AB_INCOMPLETE;
+      }
     }
-    // send
-    ESP_LOGVV(TAG, "pair command %i = %s", state_tries_, pairCmd);
-    // else if(diagNose == 2) ws.textAll(term);
+  }
 
-    zb_send(pairCmd);
+  // sleep until the next frame arrives, the next request is due or the round times out
+  if (pair_request_pending_ || pair_next_ >= requests) {
+    next_run_ = pair_sent_ + ZB_RESPONSE_TIMEOUT + 1;
+  } else {
+    next_run_ = pair_sent_ + ZB_PAIR_COMMAND_DELAY;
   }
-  int bytesRead = 0;
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};
-  if (!zb_read(s_d, bytesRead))
-    return AsyncBoolResult::AB_INCOMPLETE;
+  data_state_ = DataReadState::DS_WAITING;
+  return AsyncBoolResult::AB_INCOMPLETE;
+}
 
-  // if not y == 1 or y == 2 we waste the received message
-  if (state_tries_ == 1 || state_tries_ == 2) {
-    // if y 1 or 2 we catch and decode the answer
-    if (zb_check_pair_response(s_d, bytesRead, inverter)) {
-      success = true;  // if at least one of these 2 where true we had success
+void ZigbeeCoordinator::zb_pair_send(Inverter *inverter) {
+  uint8_t serial[6];
+  parse_hex(inverter->get_serial(), serial, 6);
+  MtFrameBuilder &frame = zb_frame(MT_AF_DATA_REQUEST_EXT);
+  frame.add(PAIR_COMMAND_HEADER, sizeof(PAIR_COMMAND_HEADER));
+
+  switch (pair_command_) {
+    case 0: {
+      // command 0: 0D0200000F1100 + serial + FFFF10FFFF + ecu_id_reverse
+      static const uint8_t CMD[] = {0x0D, 0x02, 0x00, 0x00, 0x0F, 0x11, 0x00};
+      static const uint8_t SEP[] = {0xFF, 0xFF, 0x10, 0xFF, 0xFF};
+      frame.add(CMD, sizeof(CMD)).add(serial, 6).add(SEP, sizeof(SEP)).add(ecu_address_, 6);
+      break;
+    }
+    case 1: {
+      // command 1: 0C0201000F0600 + serial
+      static const uint8_t CMD[] = {0x0C, 0x02, 0x01, 0x00, 0x0F, 0x06, 0x00};
+      frame.add(CMD, sizeof(CMD)).add(serial, 6);
+      break;
+    }
+    case 2: {
+      // command 2: 0F0102000F1100 + serial + short ecu_id_reverse + 10FFFF + ecu_id_reverse
+      static const uint8_t CMD[] = {0x0F, 0x01, 0x02, 0x00, 0x0F, 0x11, 0x00};
+      static const uint8_t SEP[] = {0x10, 0xFF, 0xFF};
+      frame.add(CMD, sizeof(CMD)).add(serial, 6).add(ecu_address_[4]).add(ecu_address_[5]);
+      frame.add(SEP, sizeof(SEP)).add(ecu_address_, 6);
+      break;
+    }
+    default: {
+      // command 3: 010103000F0600 + ecu_id_reverse
+      static const uint8_t CMD[] = {0x01, 0x01, 0x03, 0x00, 0x0F, 0x06, 0x00};
+      frame.add(CMD, sizeof(CMD)).add(ecu_address_, 6);
+      break;
     }
   }
-  if (state_tries_ == 3) {
-    // now all 4 commands have been sent
-    if (success) {
-      ESP_LOGI(TAG, "pairing successfull! inverter %s has pair id %s", inverter->get_serial(), inverter->get_id());
-      return AsyncBoolResult::AB_SUCCESS;
-    } else {
-      inverter->set_id("");
-      ESP_LOGE(TAG, "pairing failed");
-      return AsyncBoolResult::AB_FAIL;
-    }  // when paired 0x103A
+  ESP_LOGVV(TAG, "pair command %u for %s", pair_command_, inverter->get_serial());
+  pair_request_pending_ = true;
+  pair_sent_ = millis();
+  zb_send(frame, MT_AF_DATA_REQUEST_EXT_SRSP);
+}
+
+void ZigbeeCoordinator::zb_pair_receive() {
+  size_t pos = 0;
+  MtFrame frame;
+  while (mt_next_frame(rx_buffer_, rx_size_, pos, frame)) {
+    if (frame.is(MT_AF_DATA_REQUEST_EXT_SRSP) && pair_request_pending_) {
+      pair_request_pending_ = false;
+      if (frame.get_u8(0) != 0x00) {  // 00=success
+        ESP_LOGE(TAG, "AF_DATA_REQUEST_EXT failed while pairing");
+        request_healthcheck();
+      }
+    } else if (frame.is(MT_AF_DATA_CONFIRM)) {
+      mark_alive();
+    } else if (frame.is(MT_AF_INCOMING_MSG)) {
+      mark_alive();
+      // an inverter may answer both commands, the last answer wins like it did in the pairing of a single inverter
+      for (uint8_t i = 0; i < pair_count_; i++) {
+        PairSlot &slot = pair_slots_[i];
+        if (!zb_decode_pair_response(slot.inverter, frame))
+          continue;
+        if (slot.answered)
+          break;
+        slot.answered = true;
+        uint8_t answered = std::count_if(pair_slots_, pair_slots_ + pair_count_,
+                                         [](const PairSlot &s) { return s.answered; });
+        ESP_LOGI(TAG, "inverter %s has pair id %s (%u/%u)", slot.inverter->get_serial(), slot.inverter->get_id(),
+                 answered, pair_count_);
+        break;
+      }
+    }
   }
-  return AsyncBoolResult::AB_INCOMPLETE;
+  rx_size_ = 0;
 }
 
-bool ZigbeeCoordinator::zb_check_pair_response(const char *msg, int bytes_read, Inverter *inverter) {
-  char _CC2530_answer_string[] = "44810000";
-  char _noAnswerFromInverter[32] = "FE0164010064FE034480CD14011F";
-  char *result;
-  char temp[13];
-
-  // Serial.println("messageToDecode = " + String(messageToDecode));
-  ESP_LOGVV(TAG, "decoding: %s", msg);
-  if (bytes_read == 0 || strlen(msg) < 6)  // invalid message
-  {
-    ESP_LOGV(TAG, "no usable code, returning..");
-    return false;
+// Completes the commands of the batch, succeeds if any inverter was paired
+AsyncBoolResult ZigbeeCoordinator::zb_pair_complete() {
+  uint32_t elapsed = millis() - pair_started_;
+  uint8_t paired = 0;
+  for (uint8_t i = 0; i < pair_count_; i++) {
+    PairSlot &slot = pair_slots_[i];
+    if (slot.answered) {
+      paired++;
+    } else {
+      slot.inverter->set_id("");
+      index_valid_ = false;
+      ESP_LOGE(TAG, "pairing inverter %s failed", slot.inverter->get_serial());
+    }
+    CommandCallback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    slot.inverter = nullptr;
+    if (callback)
+      callback(slot.answered);
   }
-  // can we conclude that a valid pair answer cannot be less than 60 bytes
-  if (bytes_read > 111 || bytes_read < 60) {
-    // term = "no pairing code, returning...";
+  ESP_LOGI(TAG, "paired %u of %u inverters in %ums (%u per minute)", paired, pair_count_, (unsigned) elapsed,
+           (unsigned) (paired * 60000ULL / std::max<uint32_t>(elapsed, 1)));
+  pair_count_ = 0;
+  data_state_ = DataReadState::DS_IDLE;
+  return paired > 0 ? AsyncBoolResult::AB_SUCCESS : AsyncBoolResult::AB_FAIL;
+}
+
+bool ZigbeeCoordinator::zb_decode_pair_response(Inverter *inverter, const MtFrame &frame) {
+  // a truncated answer must not set a bogus pair id
+  uint8_t length = frame.get_u8(AF_INCOMING_MSG_DATA_LENGTH);
+  if (frame.length < AF_INCOMING_MSG_DATA + length || length < PAIR_RESPONSE_MIN_DATA_SIZE ||
+      length >= POLL_RESPONSE_MIN_DATA_SIZE) {
     ESP_LOGV(TAG, "no valid pairing code, returning...");
     return false;
   }
+  MtFrame msg = frame.slice(AF_INCOMING_MSG_DATA);
+  msg.length = length;
+  uint8_t serial[6];
+  parse_hex(inverter->get_serial(), serial, 6);
+
+  // the pair id are the 2 bytes right behind the last occurence of the serialnr in the inverter answer
+  int found = msg.find_last(serial, 6);
+  if (found < 0 || found + 8 > msg.length)
+    return false;
+  char pair_id[5];
+  snprintf(pair_id, sizeof(pair_id), "%02X%02X", msg.get_u8(found + 6), msg.get_u8(found + 7));
+  inverter->set_id(pair_id);
+  index_valid_ = false;
+  zb_build_inverter_frames(inverter);
+  ESP_LOGV(TAG, "found pair id %s", inverter->get_id());
+  return true;
+}
 
-  if (!strstr(msg, inverter->get_serial())) {
-    ESP_LOGV(TAG, "not found serialnr, returning");
+bool ZigbeeCoordinator::start_reboot_inverter(const char *serial, CommandCallback &&callback) {
+  Inverter *inverter = find_inverter(serial);
+  if (inverter == nullptr || !inverter->is_paired()) {
+    ESP_LOGE(TAG, "rebooting failed: inverter with serial %s is not paired", serial);
+    if (callback)
+      callback(false);
     return false;
   }
+  ESP_LOGD(TAG, "queued reboot of inverter %s", serial);
+  return queue_command(CommandType::COMMAND_REBOOT, inverter, std::move(callback));
+}
 
-  result = split(msg, inverter->get_serial());
-  ESP_LOGV(TAG, "result after 1st splitting: %s", result);
-
-  // now we keep splitting as long as result contains the serial nr
-  while (strstr(result, inverter->get_serial())) {
-    result = split(result, inverter->get_serial());
+bool ZigbeeCoordinator::start_poll_inverter(const char *serial, CommandCallback &&callback) {
+  if (serial[0] == '*') {
+    std::vector<Inverter *> paired;
+    for (auto inv : inverters_) {
+      if (inv->is_paired())
+        paired.push_back(inv);
+    }
+    if (paired.empty()) {
+      ESP_LOGV(TAG, "polling skipped: no inverters are paired");
+      if (callback)
+        callback(true);
+      return false;
+    }
+    ESP_LOGV(TAG, "polling all paired inverters");
+    CommandCallback group = make_group_callback(paired.size(), std::move(callback));
+    bool queued = true;
+    for (auto inv : paired)
+      queued &= queue_command(CommandType::COMMAND_POLL, inv, CommandCallback(group));
+    return queued;
   }
-  ESP_LOGV(TAG, "result after splitting: %s", result);
-  // result are the bytes behind the serialnr
-  // now we know that it is what we expect, a string right behind the last occurence of the serialnr
-  result[4] = '\0';
-  inverter->set_id(result);
-
-  ESP_LOGV(TAG, "found pair id %s", inverter->get_id());
 
-  return true;
+  Inverter *inverter = find_inverter(serial);
+  if (inverter == nullptr || !inverter->is_paired()) {
+    ESP_LOGE(TAG, "polling failed: inverter with serial %s is not paired", serial);
+    if (callback)
+      callback(false);
+    return false;
+  }
+  ESP_LOGI(TAG, "polling inverter %s", serial);
+  return queue_command(CommandType::COMMAND_POLL, inverter, std::move(callback));
 }
 
-bool ZigbeeCoordinator::start_reboot_inverter(const char *serial) {
-  for (auto inv : inverters_) {
-    if (strcmp(serial, inv->get_serial()) == 0 && inv->is_paired()) {
-      rebooting_inverter_ = inv;
+// Polls the queued inverters, followed by the inverters the poll scheduler has due, with up to ZB_POLL_WINDOW
+// requests in flight. The coordinator takes the next request once the previous one was acknowledged by its SRSP.
+// No new requests are started while a reboot or pairing is queued, so they can run once the window drained.
+AsyncBoolResult ZigbeeCoordinator::zb_poll() {
+  zb_poll_receive();
+
+  uint32_t now = millis();
+  for (auto &slot : poll_slots_) {
+    if (slot.inverter != nullptr && now - slot.sent > ZB_RESPONSE_TIMEOUT) {
+      if (slot.confirmed) {
+        ESP_LOGD(TAG, "did not receive AF_INCOMING_MSG while polling inverter %s", slot.inverter->get_serial());
+      } else {
+        // the coordinator confirms every request, even those the inverter didn't get
+        ESP_LOGD(TAG, "did not receive AF_DATA_CONFIRM while polling inverter %s", slot.inverter->get_serial());
+        request_healthcheck();
+      }
+      zb_poll_complete(slot, false);
+    }
+  }
+
+  const Command *next = commands_.peek();
+  if (poll_request_pending_ == nullptr && (next == nullptr || next->type == CommandType::COMMAND_POLL)) {
+    for (auto &slot : poll_slots_) {
+      if (slot.inverter != nullptr)
+        continue;
+      Command command;
+      Inverter *inverter;
+      if (commands_.pop(CommandType::COMMAND_POLL, command))
+        zb_poll_send(slot, command.inverter, std::move(command.callback));
+      else if ((inverter = poll_scheduler_.pop_due(now)) != nullptr)
+        zb_poll_send(slot, inverter, nullptr);
       break;
     }
   }
 
-  if (rebooting_inverter_ == nullptr) {
-    ESP_LOGE(TAG, "rebooting failed: inverter with serial %s is not paired", serial);
-  } else if (state_ != ZigbeeCoordinatorState::CS_IDLE) {
-    ESP_LOGI(TAG, "rebooting defered: coordinator busy or not configured", serial);
-  } else {
-    ESP_LOGI(TAG, "rebooting inverter %s", rebooting_inverter_->get_serial());
-    set_state(ZigbeeCoordinatorState::CS_REBOOT_INVERTER);
-    return true;
+  // sleep until the next answer arrives or the oldest request times out
+  bool in_flight = false;
+  for (auto &slot : poll_slots_) {
+    if (slot.inverter == nullptr)
+      continue;
+    uint32_t timeout = slot.sent + ZB_RESPONSE_TIMEOUT + 1;
+    if (!in_flight || (int32_t) (timeout - next_run_) < 0)
+      next_run_ = timeout;
+    in_flight = true;
   }
-  return false;
+  if (in_flight) {
+    data_state_ = DataReadState::DS_WAITING;
+    return AsyncBoolResult::AB_INCOMPLETE;
+  }
+  data_state_ = DataReadState::DS_IDLE;
+  return AsyncBoolResult::AB_SUCCESS;
 }
 
-bool ZigbeeCoordinator::start_poll_inverter(const char *serial) {
-  for (auto inv : inverters_) {
-    if (serial[0] == '*') {
-      if (inv->is_paired()) {
-        polling_inverter_ = inv;
-        poll_all_mode_ = true;
-        break;
+void ZigbeeCoordinator::zb_poll_send(PollSlot &slot, Inverter *inverter, CommandCallback &&callback) {
+  InverterCommandFrames &frames = inverter->get_command_frames();
+  if (!frames.valid)
+    zb_build_inverter_frames(inverter);
+  // every request gets its own transaction id, patch it into the cached frame and keep the FCS valid
+  uint8_t *frame = frames.poll;
+  frame[INVERTER_COMMAND_FRAME_SIZE - 1] ^= frame[INVERTER_COMMAND_TRANS_ID] ^ next_trans_id_;
+  frame[INVERTER_COMMAND_TRANS_ID] = next_trans_id_;
+
+  slot.inverter = inverter;
+  slot.callback = std::move(callback);
+  memcpy(slot.address, frame + INVERTER_COMMAND_ADDRESS, 2);
+  slot.trans_id = next_trans_id_++;
+  slot.confirmed = false;
+  slot.sent = millis();
+  poll_request_pending_ = &slot;
+  zb_send(frame, INVERTER_COMMAND_FRAME_SIZE, MT_AF_DATA_REQUEST_SRSP);
+}
+
+void ZigbeeCoordinator::zb_poll_receive() {
+  size_t pos = 0;
+  MtFrame frame;
+  while (mt_next_frame(rx_buffer_, rx_size_, pos, frame)) {
+    if (frame.is(MT_AF_DATA_REQUEST_SRSP) && poll_request_pending_ != nullptr) {
+      PollSlot &slot = *poll_request_pending_;
+      poll_request_pending_ = nullptr;
+      if (frame.get_u8(0) != 0x00) {  // 00=success
+        ESP_LOGE(TAG, "AF_DATA_REQUEST failed while polling inverter %s", slot.inverter->get_serial());
+        request_healthcheck();
+        zb_poll_complete(slot, false);
       }
-    } else {
-      if (strcmp(serial, inv->get_serial()) == 0 && inv->is_paired()) {
-        polling_inverter_ = inv;
+    } else if (frame.is(MT_AF_DATA_CONFIRM)) {
+      // any confirm, even a failed one, comes from a coordinator with a running network
+      mark_alive();
+      for (auto &slot : poll_slots_) {
+        if (slot.inverter == nullptr || slot.trans_id != frame.get_u8(AF_DATA_CONFIRM_TRANS_ID))
+          continue;
+        if (frame.get_u8(0) != 0x00) {
+          ESP_LOGD(TAG, "AF_DATA_CONFIRM failed while polling inverter %s", slot.inverter->get_serial());
+          zb_poll_complete(slot, false);
+        } else {
+          slot.confirmed = true;
+        }
         break;
       }
+    } else if (frame.is(MT_AF_INCOMING_MSG)) {
+      mark_alive();
+      for (auto &slot : poll_slots_) {
+        if (slot.inverter != nullptr && frame.get_u8(AF_INCOMING_MSG_SRC_ADDR) == slot.address[0] &&
+            frame.get_u8(AF_INCOMING_MSG_SRC_ADDR + 1) == slot.address[1]) {
+          zb_poll_complete(slot, zb_decode_poll_response(slot.inverter, frame));
+          break;
+        }
+      }
     }
   }
-
-  if (polling_inverter_ == nullptr) {
-    if (serial[0] == '*')
-      ESP_LOGV(TAG, "polling skipped: no inverters are paired");
-    else
-      ESP_LOGE(TAG, "polling failed: inverter with serial %s is not paired", serial);
-  } else if (state_ != ZigbeeCoordinatorState::CS_IDLE) {
-    ESP_LOGV(TAG, "polling defered: coordinator busy or not configured", serial);
-  } else {
-    if (poll_all_mode_)
-      ESP_LOGV(TAG, "polling all paired inverters");
-    else
-      ESP_LOGI(TAG, "polling inverter %s", polling_inverter_->get_serial());
-    set_state(ZigbeeCoordinatorState::CS_POLL_INVERTER);
-    return true;
-  }
-  return false;
+  rx_size_ = 0;
 }
 
-AsyncBoolResult ZigbeeCoordinator::zb_poll(Inverter *inverter) {
-  if (data_state_ == DataReadState::DS_IDLE) {
-    char pollCommand[65] = {0};
-    snprintf(pollCommand, sizeof(pollCommand), "2401%s1414060001000F13%sFBFB06BB000000000000C1FEFE", inverter->get_id(),
-             ecu_id_reverse_);
-
-    zb_send(pollCommand);
+void ZigbeeCoordinator::zb_poll_complete(PollSlot &slot, bool success) {
+  uint32_t now = millis();
+  metrics_.polls++;
+  if (success)
+    metrics_.poll_rtt.add(now - slot.sent);
+  else
+    metrics_.failed_polls++;
+  if (++sweep_polls_ >= sweep_size_) {
+    if (sweep_size_ > 0) {
+      metrics_.sweep_time = now - sweep_started_;
+      metrics_.sweeps++;
+    }
+    sweep_started_ = now;
+    sweep_polls_ = 0;
+    sweep_size_ = get_index().get_paired();
   }
-  int bytesRead = 0;
-  char s_d[CC2530_MAX_MSG_SIZE * 2] = {0};
-  if (!zb_read(s_d, bytesRead))
-    return AsyncBoolResult::AB_INCOMPLETE;
 
-  if (zb_decode_poll_response(s_d, bytesRead, inverter)) {
+  Inverter *inverter = slot.inverter;
+  CommandCallback callback = std::move(slot.callback);
+  slot.inverter = nullptr;
+  slot.callback = nullptr;
+  if (poll_request_pending_ == &slot)
+    poll_request_pending_ = nullptr;
+  if (callback)
+    callback(success);
+  inverter->record_poll(success);
+  if (success) {
     inverter->set_unsuccessfull_polls(0);
-    return AsyncBoolResult::AB_SUCCESS;
+    return;
   }
   inverter->set_unsuccessfull_polls(inverter->get_unsuccessfull_polls() + 1);
   if (inverter->get_unsuccessfull_polls() == 10) {
-    auto data = inverter->get_data();
-    data.ac_frequency = NAN;
-    for (int i = 0; i < 4; i++) {
-      data.dc_current[i] = NAN;
-      data.dc_voltage[i] = NAN;
-    }
-    data.ac_voltage = NAN;
-    data.signal_quality = NAN;
-    data.temperature = NAN;
-    for (int i = 0; i < 5; i++) {
-      data.ac_power[i] = NAN;
-      data.dc_power[i] = NAN;
-    }
-    inverter->set_data(data);
+    inverter->set_data_unknown();
   }
-  return AsyncBoolResult::AB_FAIL;
-}
-
-// *******************************************************************************************************************
-//                             extract values
-// *******************************************************************************************************************
-float extractValue(uint8_t startPosition, uint8_t valueLength, float valueSlope, float valueOffset,
-                   const char *toDecode) {
-  char tempMsgBuffer[64] = {0};  // was 254
-  strncpy(tempMsgBuffer, toDecode + startPosition, valueLength);
-  return (valueSlope * (float) strtol(tempMsgBuffer, 0, 16)) + valueOffset;
 }
 
 // ******************************************************************
-//                    decode polling answer
+//                    discover inverters
 // ******************************************************************
-bool ZigbeeCoordinator::zb_decode_poll_response(const char *msg, int bytes_read, Inverter *inv) {
-  uint8_t message_start_offset = 0;
-
-  InverterData old_data = inv->get_data();
-  InverterData new_data{};
-  bool new_data_valid = true;
-
-  if (bytes_read == 0) {
-    ESP_LOGE(TAG, "no answer to poll request for inverter %s", inv->get_serial());
-
-    return false;  // no answer
-  }
-
-  ESP_LOGV(TAG, "decode poll response for inverter %s", inv->get_serial());
-
-  char *tail;
-
-  if (strstr(msg, "FE01640100") == NULL) {  // answer to AF_DATA_REQUEST 00=success
-    ESP_LOGE(TAG, "AF_DATA_REQUEST failed while polling inverter %s", inv->get_serial());
-    return false;
-  } else if (strstr(msg, "FE03448000") == NULL) {  //  AF_DATA_CONFIRM the 00 byte = success
-    ESP_LOGD(TAG, "did not receive AF_DATA_CONFIRM while polling inverter %s", inv->get_serial());
-    return false;
-  } else if (strstr(msg, "4481") == NULL) {
-    ESP_LOGD(TAG, "did not receive AF_INCOMING_MSG while polling inverter %s", inv->get_serial());
+bool ZigbeeCoordinator::start_discovery(uint32_t duration, CommandCallback &&callback) {
+  if (discovery_requested_ || state_ == ZigbeeCoordinatorState::CS_DISCOVER_INVERTERS) {
+    ESP_LOGW(TAG, "discovery is already running");
+    if (callback)
+      callback(false);
     return false;
   }
+  discovery_requested_ = true;
+  discovery_duration_ = duration;
+  discovery_callback_ = std::move(callback);
+  if (state_ == ZigbeeCoordinatorState::CS_IDLE)
+    next_run_ = millis();  // idle picks it up right away
+  return true;
+}
 
-  if (strlen(msg) < 223)  // this message is not long enough to be valid inverter data
-  {
-    ESP_LOGD(TAG, "received message was too short while polling inverter %s", inv->get_serial());
-    return false;
+// Builds a table of the devices on the channel. The neighbor table of the coordinator lists the joined devices with
+// their ieee address, which holds the serial of an inverter. A poll broadcast to all inverters then gets an answer
+// from every inverter in normal operation, its layout tells the model. Device announcements of inverters that join
+// meanwhile are collected as well.
+AsyncBoolResult ZigbeeCoordinator::zb_discover() {
+  zb_discover_receive();
+  uint32_t now = millis();
+  if (discovery_request_pending_ && now - discovery_sent_ > ZB_RESPONSE_TIMEOUT) {
+    ESP_LOGD(TAG, "did not receive an answer while discovering inverters");
+    discovery_request_pending_ = false;
+    discovery_phase_ = discovery_phase_ == DiscoveryPhase::DP_NEIGHBORS ? DiscoveryPhase::DP_BROADCAST
+                                                                         : DiscoveryPhase::DP_LISTEN;
+    discovery_deadline_ = now + discovery_duration_;
+    request_healthcheck();
   }
 
-  // shorten the message by removing everything before 4481
-  tail = split(msg, "44810000");  // remove the 0000 as well
-
-  new_data.signal_quality = extractValue(14, 2, 1, 0, tail) * 100 / 255;
-
-  char s_d[CC2530_MAX_MSG_SIZE * 2];
-  strncpy(s_d, tail + 30, strlen(tail));
+  if (!discovery_request_pending_) {
+    if (discovery_phase_ == DiscoveryPhase::DP_NEIGHBORS) {
+      // ZDO_MGMT_LQI_REQ: DstAddr(2) of the coordinator, StartIndex
+      MtFrameBuilder &frame = zb_frame(MT_ZDO_MGMT_LQI_REQ);
+      frame.add(0x00).add(0x00).add(discovery_index_);
+      discovery_request_pending_ = true;
+      discovery_sent_ = now;
+      zb_send(frame, MT_ZDO_MGMT_LQI_RSP);
+    } else if (discovery_phase_ == DiscoveryPhase::DP_BROADCAST) {
+      uint8_t frame[INVERTER_COMMAND_FRAME_SIZE];
+      memcpy(frame, POLL_COMMAND_TEMPLATE, INVERTER_COMMAND_FRAME_SIZE);
+      frame[INVERTER_COMMAND_ADDRESS] = 0xFF;
+      frame[INVERTER_COMMAND_ADDRESS + 1] = 0xFF;
+      memcpy(frame + INVERTER_COMMAND_ECU_ADDRESS, ecu_address_, 6);
+      frame[INVERTER_COMMAND_FRAME_SIZE - 1] = POLL_COMMAND_FCS ^ ecu_address_fcs_;  // FF ^ FF cancel out
+      discovery_request_pending_ = true;
+      discovery_sent_ = now;
+      zb_send(frame, INVERTER_COMMAND_FRAME_SIZE, MT_AF_DATA_REQUEST_SRSP);
+    } else if ((int32_t) (now - discovery_deadline_) >= 0) {
+      zb_discover_complete(true);
+      return AsyncBoolResult::AB_SUCCESS;
+    }
+  }
 
-  if (inv->get_type() == InverterType::INVERTER_TYPE_DS3) {
-    ESP_LOGV(TAG, "decoding DS3 inverter");
+  // sleep until the next frame arrives, the request times out or the listening ends
+  if (discovery_request_pending_) {
+    next_run_ = discovery_sent_ + ZB_RESPONSE_TIMEOUT + 1;
+  } else if (discovery_phase_ == DiscoveryPhase::DP_LISTEN) {
+    next_run_ = discovery_deadline_;
+  } else {
+    next_run_ = now;
+  }
+  data_state_ = DataReadState::DS_WAITING;
+  return AsyncBoolResult::AB_INCOMPLETE;
+}
 
-    // ACV offset 34
-    new_data.ac_voltage = extractValue(68, 4, 1, 0, s_d) / 3.8;
+void ZigbeeCoordinator::zb_discover_receive() {
+  size_t pos = 0;
+  MtFrame frame;
+  while (mt_next_frame(rx_buffer_, rx_size_, pos, frame)) {
+    if ((frame.is(MT_ZDO_MGMT_LQI_REQ_SRSP) || frame.is(MT_AF_DATA_REQUEST_SRSP)) && discovery_request_pending_) {
+      if (frame.get_u8(0) != 0x00) {  // 00=success
+        ESP_LOGE(TAG, "request %04X failed while discovering inverters", frame.command);
+        request_healthcheck();
+        discovery_request_pending_ = false;
+        discovery_phase_ = frame.is(MT_AF_DATA_REQUEST_SRSP) ? DiscoveryPhase::DP_LISTEN : DiscoveryPhase::DP_BROADCAST;
+        discovery_deadline_ = millis() + discovery_duration_;
+      } else if (frame.is(MT_AF_DATA_REQUEST_SRSP)) {
+        // the broadcast is out, the answers come in while listening
+        discovery_request_pending_ = false;
+        discovery_phase_ = DiscoveryPhase::DP_LISTEN;
+        discovery_deadline_ = millis() + discovery_duration_;
+      }
+    } else if (frame.is(MT_ZDO_MGMT_LQI_RSP) && discovery_phase_ == DiscoveryPhase::DP_NEIGHBORS) {
+      mark_alive();
+      discovery_request_pending_ = false;
+      uint8_t count = frame.get_u8(ZDO_MGMT_LQI_RSP_COUNT);
+      if (frame.get_u8(ZDO_MGMT_LQI_RSP_STATUS) != 0x00 ||
+          ZDO_MGMT_LQI_RSP_ENTRIES + count * ZDO_NEIGHBOR_SIZE > frame.length) {
+        ESP_LOGD(TAG, "the coordinator did not list its neighbors");
+        discovery_phase_ = DiscoveryPhase::DP_BROADCAST;
+        continue;
+      }
+      for (uint8_t i = 0; i < count; i++) {
+        const uint8_t *neighbor = frame.payload + ZDO_MGMT_LQI_RSP_ENTRIES + i * ZDO_NEIGHBOR_SIZE;
+        discovery_.add_device(neighbor + ZDO_NEIGHBOR_SHORT_ADDR, neighbor + ZDO_NEIGHBOR_IEEE_ADDR,
+                              neighbor[ZDO_NEIGHBOR_LQI]);
+      }
+      // the table is paged, ask for the next page until all entries are in
+      discovery_index_ = frame.get_u8(ZDO_MGMT_LQI_RSP_START_INDEX) + count;
+      if (count == 0 || discovery_index_ >= frame.get_u8(ZDO_MGMT_LQI_RSP_TOTAL))
+        discovery_phase_ = DiscoveryPhase::DP_BROADCAST;
+    } else if (frame.is(MT_ZDO_END_DEVICE_ANNCE_IND) && frame.length >= ZDO_END_DEVICE_ANNCE_IEEE_ADDR + 8) {
+      discovery_.add_device(frame.payload + ZDO_END_DEVICE_ANNCE_SHORT_ADDR,
+                            frame.payload + ZDO_END_DEVICE_ANNCE_IEEE_ADDR, 0);
+    } else if (frame.is(MT_AF_DATA_CONFIRM)) {
+      mark_alive();
+    } else if (frame.is(MT_AF_INCOMING_MSG) && frame.length > AF_INCOMING_MSG_DATA) {
+      mark_alive();
+      discovery_.add_answer(frame);
+    }
+  }
+  rx_size_ = 0;
+}
 
-    // FREQ offset 36
-    new_data.ac_frequency = extractValue(72, 4, 1, 0, s_d) / 100;
+void ZigbeeCoordinator::zb_discover_complete(bool success) {
+  if (success) {
+    discovery_.resolve(inverters_);
+    discovery_.log(TAG, inverters_);
+  } else {
+    ESP_LOGW(TAG, "discovery was interrupted");
+  }
+  discovery_request_pending_ = false;
+  data_state_ = DataReadState::DS_IDLE;
+  CommandCallback callback = std::move(discovery_callback_);
+  discovery_callback_ = nullptr;
+  if (callback)
+    callback(success);
+}
 
-    // TEMP offset 48
-    new_data.temperature = extractValue(96, 4, 1, 0, s_d) * 0.0198 - 23.84;
+// ******************************************************************
+//                    decode polling answer
+// ******************************************************************
+bool ZigbeeCoordinator::zb_decode_poll_response(Inverter *inv, const MtFrame &frame, bool late) {
+  InverterStore &store = *inv->get_store();
+  uint16_t slot = inv->get_slot();
 
-    // ******************  dc voltage   *****************************************
-    // voltage ch1 offset 28
-    new_data.dc_voltage[0] = extractValue(52, 4, 1, 0, s_d) / 48.0f;
-    // voltage ch2 offset 26
-    new_data.dc_voltage[1] = extractValue(56, 4, 1, 0, s_d) / 48.0f;
-    // ******************  current   *****************************************
-    // current ch1 offset 30
-    new_data.dc_current[0] = extractValue(60, 4, 1, 0, s_d) * 0.0125f;
-    // current ch2 offset 34
-    new_data.dc_current[1] = extractValue(64, 4, 1, 0, s_d) * 0.0125f;
+  ESP_LOGV(TAG, "decode poll response for inverter %s", inv->get_serial());
 
-  } else {
-    if (inv->get_type() == InverterType::INVERTER_TYPE_YC600) {
-      ESP_LOGV(TAG, "decoding YC600 inverter");
-    } else if (inv->get_type() == InverterType::INVERTER_TYPE_QS1) {
-      ESP_LOGV(TAG, "decoding QS1 inverter");
-    } else {
-      ESP_LOGV(TAG, "decoding unspecified inverter (trying like QS1)");
-    }
+  // the inverter data starts behind the AF_INCOMING_MSG header
+  MtFrame msg = frame.slice(AF_INCOMING_MSG_DATA);
+  if (msg.length < POLL_RESPONSE_MIN_DATA_SIZE) {  // this message is not long enough to be valid inverter data
+    ESP_LOGD(TAG, "received message was too short while polling inverter %s", inv->get_serial());
+    return false;
+  }
 
-    // yc600 or QS1
-    //  frequency ac voltage and temperature
-    //  ACV offset 28
-    new_data.ac_voltage = extractValue(56, 4, 1, 0, s_d) / 5.3108f;
-    // FREQ offset 12
-    new_data.ac_frequency = 50000000 / extractValue(24, 6, 1, 0, s_d);
-    // TEMP offset 10
-    new_data.temperature = extractValue(20, 4, 0.2752f, -258.7f, s_d);
-
-    // ******************  dc voltage   *****************************************
-    // voltage ch1 offset 24
-    new_data.dc_voltage[0] = (extractValue(48, 2, 16, 0, s_d) + extractValue(46, 1, 1, 0, s_d)) * 82.5f / 4096.0f;
-    // voltage ch2 offset 27
-    new_data.dc_voltage[1] = (extractValue(54, 2, 16, 0, s_d) + extractValue(52, 1, 1, 0, s_d)) * 82.5f / 4096.0f;
-
-    // ******************  current   *****************************************
-    // current ch1 offset 22
-    new_data.dc_current[0] = (extractValue(47, 1, 256, 0, s_d) + extractValue(44, 2, 1, 0, s_d)) * 27.5f / 4096.0f;
-    // current ch2 offset 25
-    new_data.dc_current[1] = (extractValue(53, 1, 256, 0, s_d) + extractValue(50, 2, 1, 0, s_d)) * 27.5f / 4096.0f;
-
-    //********************************************************************************************
-    //                                     QS1
-    //********************************************************************************************
-    if (inv->get_type() == InverterType::INVERTER_TYPE_QS1) {
-      ESP_LOGV(TAG, "extracting dc values for panels 3 and 4");
-
-      // ******************  dc voltage   *****************************************
-      // voltage ch3 offset 21
-      new_data.dc_voltage[2] = (extractValue(42, 2, 16, 0, s_d) + extractValue(40, 1, 1, 0, s_d)) * 82.5f / 4096.0f;
-      // voltage ch4 offset 18
-      new_data.dc_voltage[3] = (extractValue(36, 2, 16, 0, s_d) + extractValue(34, 1, 1, 0, s_d)) * 82.5f / 4096.0f;
-
-      // ******************  current   *****************************************
-      // current ch3 offset 19
-      new_data.dc_current[2] = (extractValue(41, 1, 256, 0, s_d) + extractValue(38, 2, 1, 0, s_d)) * 27.5f / 4096.0f;
-      // current ch4 offset 16
-      new_data.dc_current[3] = (extractValue(35, 1, 256, 0, s_d) + extractValue(32, 2, 1, 0, s_d)) * 27.5f / 4096.0f;
-    }
+  const InverterModel &model = get_inverter_model(inv->get_type());
+  ESP_LOGV(TAG, "decoding %s inverter", model.name);
+  uint8_t connected_panels = inv->get_connected_panels();
+  int64_t values[FIELD_COUNT]{};
+  uint32_t decode_started = micros();
+  bool new_data_valid = model.decode(msg, connected_panels, values);
+  metrics_.decode_time.add(micros() - decode_started);
+
+  int poll_timestamp = values[FIELD_TIMESTAMP];
+  int last_poll_timestamp = store.poll_timestamp(slot);
+  if (late && poll_timestamp <= last_poll_timestamp) {
+    ESP_LOGD(TAG, "ignoring stale answer of inverter %s", inv->get_serial());
+    return false;
   }
 
   // we extract a value out of the inverter answer: en_extr
@@ -950,129 +1556,95 @@ bool ZigbeeCoordinator::zb_decode_poll_response(const char *msg, int bytes_read,
   // **********************************************************************
   //               calculation of the power per panel
   // **********************************************************************
-  ESP_LOGI(TAG, "successfully polled inverter %s", inv->get_serial());
-
-  // 1st the time period
-  // at the start of this we have a value of the t_new[which] of the former poll
-  // if this is 0 there was no former poll
-  switch (inv->get_type()) {
-    case InverterType::INVERTER_TYPE_YC600:                      // yc600
-      new_data.poll_timestamp = extractValue(34, 4, 1, 0, s_d);  // dataframe timestamp
-      break;
-    case InverterType::INVERTER_TYPE_QS1:                        // qs1
-      new_data.poll_timestamp = extractValue(60, 4, 1, 0, s_d);  // dataframe timestamp
-      break;
-    case InverterType::INVERTER_TYPE_DS3:                        // ds3 offset 38
-      new_data.poll_timestamp = extractValue(76, 4, 1, 0, s_d);  // dataframe timestamp ds3
-      break;
-  }
+  ESP_LOGI(TAG, late ? "used late answer of inverter %s" : "successfully polled inverter %s", inv->get_serial());
 
   // if the inverter had a reset, time new would be smaller than time old
-  // t_saved is globally defined so we remember the last. With the new we can calculate the timeperiod
-  if (new_data.poll_timestamp < old_data.poll_timestamp || old_data.poll_timestamp == 0) {  // there has been a reset
-    old_data.poll_timestamp = 0;
+  // the store remembers the last timestamp, with the new one we can calculate the timeperiod
+  if (poll_timestamp < last_poll_timestamp || last_poll_timestamp == 0) {  // there has been a reset
+    last_poll_timestamp = 0;
   }
 
-  int time_since_last_poll = new_data.poll_timestamp - old_data.poll_timestamp;
-
-  // now for each channel
-  int increment = 10;  // offset to the next energy value
-  int btc = 6;         // amount of bytes
-  int offst = 74;      // this is incremented with 10
-  if (inv->get_type() == InverterType::INVERTER_TYPE_DS3) {
-    // for the DS3 we have different offset/increment
-    offst = 100;
-    increment = 8;
-    btc = 8;
-  }
-  // for every panel of inverter which we go through this loop
+  int time_since_last_poll = poll_timestamp - last_poll_timestamp;
 
+  // for every panel of inverter which we go through this loop, the results are only stored if all are plausible
+  int64_t energy_increase[4]{0};
+  int32_t dc_power[4]{0};
+  int32_t ac_power[4]{0};
   for (int x = 0; x < 4; x++) {
     if (inv->is_panel_connected(x)) {  // is this panel connected ? otherwise skip
 
       ESP_LOGV(TAG, "decoding panel %i", x);
 
-      // now we extract a new energy_new[which][x]
-      int extracted_energy_value =
-          extractValue(offst + x * increment, btc, 1, 0, s_d);  // offset 74 todays module energy channel 0
-
-      // we calculate a new energy value for this panel and remember it
-      if (inv->get_type() == InverterType::INVERTER_TYPE_DS3) {
-        new_data.energy_since_last_reset[x] = extracted_energy_value / 100000.0f * 1.66f;  //[Wh]
-      } else {
-        new_data.energy_since_last_reset[x] = extracted_energy_value * 8.311F / 3600.0f;   //[Wh]
+      // the energy the inverter produced since its last reset [µWh]
+      energy_increase[x] = values[FIELD_ENERGY + x];
+      if (last_poll_timestamp != 0) {
+        energy_increase[x] -= store.energy_since_last_reset(slot, x);
       }
 
-      float energy_increase = new_data.energy_since_last_reset[x];
-      if (old_data.poll_timestamp != 0) {
-        energy_increase -= old_data.energy_since_last_reset[x];
+      // calculate the power for this panel, µV * µA = pW
+      int64_t dc = (values[FIELD_DC_VOLTAGE + x] * values[FIELD_DC_CURRENT + x] + 500000000) / 1000000000;
+      // µWh / s * 3600 / 1000 = mW
+      int64_t ac = VALUE_UNKNOWN;
+      if (time_since_last_poll > 0) {
+        ac = (energy_increase[x] * 18 + time_since_last_poll * 5 / 2) / (time_since_last_poll * 5);
+      } else if (energy_increase[x] != 0) {
+        new_data_valid = false;  // energy without time passing, the power would be infinite
       }
 
-      new_data.energy_today[x] =
-          old_data.energy_today[x] + energy_increase;  // totalize the energy increase for this poll
-
-      // calculate the power for this panel
-      new_data.dc_power[x] = new_data.dc_voltage[x] * new_data.dc_current[x];
-      new_data.ac_power[x] = energy_increase / (time_since_last_poll / 3600.0f);  //[W]
-
       // reject invalid value ranges
-      if (inv->get_type() == InverterType::INVERTER_TYPE_YC600) {
-        if (new_data.dc_power[x] > 450 || new_data.ac_power[x] > 450) {
-          new_data_valid = false;
-        }
-      }
-      if (inv->get_type() == InverterType::INVERTER_TYPE_QS1) {
-        if (new_data.dc_power[x] > 480 || new_data.ac_power[x] > 480) {
-          new_data_valid = false;
-        }
-      }
-      if (inv->get_type() == InverterType::INVERTER_TYPE_DS3) {
-        if (new_data.dc_power[x] > 750 || new_data.ac_power[x] > 750) {
-          new_data_valid = false;
-        }
-      }
-      if (new_data.dc_power[x] < 0 || new_data.ac_power[x] < 0 || new_data.dc_current[x] < 0 ||
-          new_data.dc_voltage[x] < 0 || new_data.ac_frequency < 30 || new_data.ac_frequency > 80 ||
-          new_data.ac_voltage < 80 || new_data.ac_voltage > 290 || new_data.signal_quality < 0 ||
-          new_data.signal_quality > 100) {
+      if (dc > model.max_panel_power || ac > model.max_panel_power || dc < 0 || (ac < 0 && ac != VALUE_UNKNOWN)) {
         new_data_valid = false;
       }
-
-      new_data.dc_power[4] += new_data.dc_power[x];
-      new_data.ac_power[4] += new_data.ac_power[x];
-      new_data.energy_since_last_reset[4] += new_data.energy_since_last_reset[x];
-      new_data.energy_today[4] += new_data.energy_today[x];
+      dc_power[x] = dc;
+      ac_power[x] = ac;
     }
-  }  // stack the increase
+  }
 
   ESP_LOGV(TAG, "done parsing poll response");
-  if (new_data_valid) {
-    inv->set_data(new_data);
-  } else {
+  if (!new_data_valid) {
     ESP_LOGW(TAG, "ignoring invalid data from inverter!");
+    return true;
   }
 
+  // update the values of the inverter in place
+  store.signal_quality(slot) = (frame.get_u8(AF_INCOMING_MSG_LINK_QUALITY) * 100000 + 127) / 255;
+  store.ac_voltage(slot) = values[FIELD_AC_VOLTAGE];
+  store.ac_frequency(slot) = values[FIELD_AC_FREQUENCY];
+  store.temperature(slot) = values[FIELD_TEMPERATURE];
+  store.poll_timestamp(slot) = poll_timestamp;
+  for (int x = 0; x < 4; x++) {
+    store.dc_voltage(slot, x) = values[FIELD_DC_VOLTAGE + x];
+    store.dc_current(slot, x) = values[FIELD_DC_CURRENT + x];
+    if (inv->is_panel_connected(x)) {
+      store.energy_since_last_reset(slot, x) = values[FIELD_ENERGY + x];
+      store.energy_today(slot, x) += energy_increase[x];  // totalize the energy increase for this poll
+      store.dc_power(slot, x) = dc_power[x];
+      store.ac_power(slot, x) = ac_power[x];
+    }
+  }
+  inv->publish_data();
+
   yield();
   ESP_LOGV(TAG, "inverter data: %s", inv->get_serial());
-  ESP_LOGV(TAG, "                   time = %i", new_data.poll_timestamp);
+  ESP_LOGV(TAG, "                   time = %i", poll_timestamp);
   ESP_LOGV(TAG, "               timespan = %i", time_since_last_poll);
-  ESP_LOGV(TAG, "            temperature = %.2f", new_data.temperature);
-  ESP_LOGV(TAG, "         signal_quality = %.2f", new_data.signal_quality);
-  ESP_LOGV(TAG, "             ac_voltage = %.2f", new_data.ac_voltage);
-  ESP_LOGV(TAG, "              frequency = %.2f", new_data.ac_frequency);
-  ESP_LOGV(TAG, "             dc_voltage = %5.2f %5.2f %5.2f %5.2f", new_data.dc_voltage[0], new_data.dc_voltage[1],
-           new_data.dc_voltage[2], new_data.dc_voltage[3]);
-  ESP_LOGV(TAG, "             dc_current = %5.2f %5.2f %5.2f %5.2f", new_data.dc_current[0], new_data.dc_current[1],
-           new_data.dc_current[2], new_data.dc_current[3]);
-  ESP_LOGV(TAG, "               dc_power = %8.2f +%8.2f +%8.2f +%8.2f =%9.2f", new_data.dc_power[0],
-           new_data.dc_power[1], new_data.dc_power[2], new_data.dc_power[3], new_data.dc_power[4]);
-  ESP_LOGV(TAG, "energy_since_last_reset = %8.2f +%8.2f +%8.2f +%8.2f =%9.2f", new_data.energy_since_last_reset[0],
-           new_data.energy_since_last_reset[1], new_data.energy_since_last_reset[2],
-           new_data.energy_since_last_reset[3], new_data.energy_since_last_reset[4]);
-  ESP_LOGV(TAG, "                  power = %8.2f +%8.2f +%8.2f +%8.2f =%9.2f", new_data.ac_power[0],
-           new_data.ac_power[1], new_data.ac_power[2], new_data.ac_power[3], new_data.ac_power[4]);
-  ESP_LOGV(TAG, "           energy_today = %8.2f +%8.2f +%8.2f +%8.2f =%9.2f", new_data.energy_today[0],
-           new_data.energy_today[1], new_data.energy_today[2], new_data.energy_today[3], new_data.energy_today[4]);
+  ESP_LOGV(TAG, "            temperature = %.2f", fixed_to_float(store.temperature(slot), UNIT_MILLI));
+  ESP_LOGV(TAG, "         signal_quality = %.2f", fixed_to_float(store.signal_quality(slot), UNIT_MILLI));
+  ESP_LOGV(TAG, "             ac_voltage = %.2f", fixed_to_float(store.ac_voltage(slot), UNIT_MILLI));
+  ESP_LOGV(TAG, "              frequency = %.2f", fixed_to_float(store.ac_frequency(slot), UNIT_MILLI));
+  for (int x = 0; x < 4; x++) {
+    ESP_LOGV(TAG, "                panel %i = %.2f V %.2f A %.2f W dc, %.2f W ac, %.2f Wh since reset, %.2f Wh today",
+             x + 1, fixed_to_float(store.dc_voltage(slot, x), UNIT_MICRO),
+             fixed_to_float(store.dc_current(slot, x), UNIT_MICRO), fixed_to_float(store.dc_power(slot, x), UNIT_MILLI),
+             fixed_to_float(store.ac_power(slot, x), UNIT_MILLI),
+             fixed_to_float(store.energy_since_last_reset(slot, x), UNIT_MICRO),
+             fixed_to_float(store.energy_today(slot, x), UNIT_MICRO));
+  }
+  ESP_LOGV(TAG, "                  total = %.2f W dc, %.2f W ac, %.2f Wh since reset, %.2f Wh today",
+           fixed_to_float(store.total_dc_power(slot, connected_panels), UNIT_MILLI),
+           fixed_to_float(store.total_ac_power(slot, connected_panels), UNIT_MILLI),
+           fixed_to_float(store.total_energy_since_last_reset(slot, connected_panels), UNIT_MICRO),
+           fixed_to_float(store.total_energy_today(slot, connected_panels), UNIT_MICRO));
 
   return true;
 }
@@ -3,6 +3,15 @@
 #include <string>
 #include <vector>
 #include "inverter.h"
+#include "inverter_index.h"
+#include "mt_frame.h"
+#include "poll_scheduler.h"
+#include "command_queue.h"
+#include "tx_queue.h"
+#include "metrics.h"
+#include "frame_capture.h"
+#include "discovery.h"
+#include "stack_probe.h"
 #include "esphome/core/component.h"
 #include "esphome/components/uart/uart.h"
 
@@ -14,60 +23,258 @@ enum ZigbeeCoordinatorState {
   CS_STOPPED = 0,
   CS_CHECK_1 = 1,
   CS_CHECK_2 = 2,
+  CS_RECOVER = 3,  // waits out the recovery backoff
   CS_HARD_RESET_COORDINATOR = 10,
   CS_INITIALIZE_COORDINATOR = 11,
   CS_ENTER_NORMAL_OPERATION = 12,
+  CS_SOFT_RESET_COORDINATOR = 13,
   CS_IDLE = 20,
   CS_POLL_INVERTER = 21,
   CS_PAIR_INVERTER = 22,
-  CS_REBOOT_INVERTER = 23
+  CS_REBOOT_INVERTER = 23,
+  CS_DISCOVER_INVERTERS = 24
 };
 
-enum DataReadState { DS_IDLE = 0, DS_WAITING = 1, DS_READING = 2 };
+// Steps of a discovery scan
+enum DiscoveryPhase : uint8_t {
+  DP_NEIGHBORS = 0,  // page through the neighbor table of the coordinator
+  DP_BROADCAST = 1,  // poll all inverters at once
+  DP_LISTEN = 2,     // collect the answers and device announcements
+};
+
+enum DataReadState { DS_IDLE = 0, DS_WAITING = 1 };
 
 enum AsyncBoolResult { AB_INCOMPLETE = 0, AB_SUCCESS = 1, AB_FAIL = 2 };
 
+// Recovery steps of a coordinator that failed a check, each failed attempt escalates to the next one
+enum RecoveryTier : uint8_t {
+  RT_RESYNC = 0,      // drop the unread bytes and a partial frame, then check again
+  RT_SOFT_RESET = 1,  // ZNP reset, the network state stays in NV
+  RT_FULL = 2,        // reset pin and full initialization
+};
+
+static const uint16_t ZB_RX_BUFFER_SIZE = 460;
+static const uint32_t ZB_RESPONSE_TIMEOUT = 2000;
+// Deadlines of the coordinator states in ms, counted from the moment a state is entered or retried
+static const uint32_t ZB_CHECK_RETRY_DELAY = 700;
+static const uint32_t ZB_RESET_PULSE = 50;               // reset pin held low
+static const uint32_t ZB_HARD_RESET_DELAY = 2500;        // wait for cc2530 to reboot
+static const uint32_t ZB_INITIALIZE_DELAY = 1000;        // wait for cc2530 to initialize
+static const uint32_t ZB_NORMAL_OPERATION_DELAY = 500;   // wait for start of normal operation
+static const uint32_t ZB_PAIR_COMMAND_DELAY = 100;       // gap between the pairing commands
+static const uint32_t ZB_REBOOT_DELAY = 2000;            // wait for reboot until we read the response
+static const uint32_t ZB_RECOVERY_BACKOFF_MIN = 250;     // backoff before the first recovery attempt
+static const uint8_t ZB_RESYNC_ATTEMPTS = 3;             // a starting network needs a moment to come up
+static const uint32_t ZB_RECOVERY_BACKOFF_MAX = 60000;   // doubled per attempt up to this
+static const uint32_t ZB_HEALTHCHECK_QUIET_PERIOD = 60000;  // default, probe after this long without traffic
+static const uint8_t ZB_POLL_WINDOW = 4;  // poll requests in flight at the same time
+static const uint8_t ZB_PAIR_BATCH = 16;  // inverters paired in one pairing session
+static const uint32_t ZB_BYTE_TIME_US = 87;  // 115200 baud 8N1
+static const uint8_t ZB_TX_CHUNK = 64;       // written at once, half the hardware fifo of the uart
+// stack painted below the loop with state profiling, the loop of the esp8266 has only 4kB of stack in total
+#ifdef USE_ESP8266
+static const uint16_t ZB_STACK_PROBE_SIZE = 512;
+#else
+static const uint16_t ZB_STACK_PROBE_SIZE = 1536;
+#endif
+
+// A poll request in flight, its AF_DATA_CONFIRM is matched by transaction id and the answer by source address
+struct PollSlot {
+  Inverter *inverter{nullptr};
+  uint8_t address[2]{0};
+  uint8_t trans_id{0};
+  bool confirmed{false};
+  uint32_t sent{0};
+  CommandCallback callback{nullptr};
+};
+// An inverter of the pairing batch
+struct PairSlot {
+  Inverter *inverter{nullptr};
+  bool answered{false};  // the inverter answered with its pair id
+  CommandCallback callback{nullptr};
+};
+static const uint8_t NORMAL_OPERATION_FRAME_SIZE = 45;
+
 class ZigbeeCoordinator {
  public:
+  ZigbeeCoordinator();
   void add_inverter(Inverter *inverter);
+  // Removes an inverter that has no command queued or running, returns false if it is busy
+  bool remove_inverter(Inverter *inverter);
+  const std::vector<Inverter *> &get_inverters() const { return inverters_; }
+  // Builds the inverter index, it is rebuilt on the next lookup once the inverters or their pair ids change
+  void build_index();
+  // The coordinator is initialized and takes commands
+  bool is_ready() const { return state_ >= ZigbeeCoordinatorState::CS_IDLE; }
   void set_reset_pin(GPIOPin *pin);
   void set_uart_device(uart::UARTDevice *uart);
-  void restart(std::string ecu_id, bool hard);
+  void restart(const char *ecu_id, bool hard);
+  void start_poll_scheduler(uint32_t default_interval);
+  // Traffic from the coordinator proves it is alive, it is only probed after this long without any or after an error
+  void set_healthcheck_quiet_period(uint32_t quiet_period) { healthcheck_quiet_period_ = quiet_period; }
+  uint32_t get_healthcheck_quiet_period() const { return healthcheck_quiet_period_; }
+  uint32_t get_healthchecks() const { return healthchecks_; }
+  uint32_t get_healthcheck_time() const { return healthcheck_time_; }  // [ms] spent in health checks since boot
+  uint32_t get_recoveries() const { return recoveries_; }
+  uint32_t get_recovery_time() const { return recovery_time_; }  // [ms] from the failed check to the last recovery
+  RecoveryTier get_recovery_tier() const { return recovery_tier_; }  // tier that completed the last recovery
+  const CoordinatorMetrics &get_metrics() const { return metrics_; }
+  // Starts counting the resets of a new day
+  void start_day() { metrics_.resets_today = 0; }
+  // Logs a summary of the metrics
+  void dump_config();
+  // Measures the stack and heap use of every loop per state, for the log config. Costs painting the stack each loop.
+  void set_state_profiling(bool state_profiling) { state_profiling_ = state_profiling; }
+  // Raw frames on the uart in both directions
+  FrameCapture &get_capture() { return capture_; }
+#ifdef USE_HOST
+  // Feeds the received frames of a capture to the coordinator as if the uart received them, at their recorded pace.
+  // The sent frames of the capture are skipped, the coordinator sends its own. False if the capture is malformed.
+  bool replay_capture(std::vector<uint8_t> &&capture);
+#endif
+  void loop();
   void run();
-  bool start_pair_inverter(const char *serial);
-  bool start_poll_inverter(const char *serial);
-  bool start_reboot_inverter(const char *serial);
-  int get_delay_to_next_execution();
+  // Queue a command, "*" pairs every unpaired or polls every paired inverter. The callback is called on completion.
+  bool start_pair_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  bool start_poll_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  bool start_reboot_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  // Scans the channel for inverters, listening for duration ms for answers. The callback is called once the
+  // results are in get_discovery().
+  bool start_discovery(uint32_t duration, CommandCallback &&callback = nullptr);
+  const DiscoveryTable &get_discovery() const { return discovery_; }
 
  protected:
+  // Reads the uart, runs the state machine when it is due and hands queued frames to the uart
+  void step();
   AsyncBoolResult zb_reboot_inverter(Inverter *inverter);
   AsyncBoolResult zb_check();
   AsyncBoolResult zb_ping();
-  AsyncBoolResult zb_poll(Inverter *inverter);
-  bool zb_decode_poll_response(const char * msg, int bytes_read, Inverter *inverter);
-  AsyncBoolResult zb_pair(Inverter *inverter);
-  bool zb_check_pair_response(const char * msg, int bytes_read, Inverter *inverter);
+  AsyncBoolResult zb_poll();
+  void zb_poll_send(PollSlot &slot, Inverter *inverter, CommandCallback &&callback);
+  void zb_poll_receive();
+  void zb_poll_complete(PollSlot &slot, bool success);
+  // A late answer is only taken if it is newer than the last one, it can't be told apart from a reset otherwise
+  bool zb_decode_poll_response(Inverter *inverter, const MtFrame &frame, bool late = false);
+  // Routes a poll answer no request in flight waits for to its inverter by source address, true if it took it
+  bool zb_dispatch(const MtFrame &frame);
+  Inverter *find_inverter_by_address(const uint8_t *address);
+  // Takes the queued pairings into the batch
+  void zb_pair_start();
+  AsyncBoolResult zb_pair();
+  void zb_pair_send(Inverter *inverter);
+  void zb_pair_receive();
+  AsyncBoolResult zb_pair_complete();
+  bool is_pairing(const Inverter *inverter) const;
+  bool zb_decode_pair_response(Inverter *inverter, const MtFrame &frame);
+  AsyncBoolResult zb_discover();
+  void zb_discover_receive();
+  void zb_discover_complete(bool success);
   AsyncBoolResult zb_initialize();
-  void zb_hardreset();
+  AsyncBoolResult zb_hardreset();
+  AsyncBoolResult zb_soft_reset();
+  void zb_resync();
+  // Schedules the next recovery attempt after a failed check or initialization
+  void recover();
   AsyncBoolResult zb_enter_normal_operation();
-  AsyncBoolResult zb_read(char buf[], int &bytes_read);
-  void zb_send(char printString[]);
-  void set_delay_to_next_execution(int delay_ms);
+  void zb_receive(const MtFrame &frame, const uint8_t *raw, size_t raw_size);
+#ifdef USE_HOST
+  void zb_replay();
+#endif
+  AsyncBoolResult zb_read();
+  bool zb_find_frame(uint16_t command, MtFrame &frame);
+  // The frame builder of the coordinator, a frame is copied into the transmit queue when it is sent so one is enough
+  MtFrameBuilder &zb_frame(uint16_t command) {
+    tx_frame_.reset(command);
+    return tx_frame_;
+  }
+  void zb_send(MtFrameBuilder &frame, uint16_t response);
+  void zb_send(const uint8_t *frame, size_t size, uint16_t response);
+  // Hands the next chunk of the transmit queue to the uart once the previous one is on the wire
+  void zb_transmit();
+  void zb_build_frames();
+  void zb_build_inverter_frames(Inverter *inverter);
+  void set_next_run(uint32_t delay_ms);
+  bool has_pending_work();
+  bool queue_command(CommandType type, Inverter *inverter, CommandCallback &&callback);
+  void complete_active_command(bool success);
+  Inverter *find_inverter(const char *serial);
+  const InverterIndex &get_index();
   void set_state(ZigbeeCoordinatorState state);
+  // The coordinator answered in a way only a running coordinator does, the next health check moves out
+  void mark_alive();
+  // The coordinator failed a request, it is checked before the next command
+  void request_healthcheck();
   ZigbeeCoordinatorState state_ = ZigbeeCoordinatorState::CS_STOPPED;
   DataReadState data_state_ = DataReadState::DS_IDLE;
-  bool pair_all_mode_ = false;
-  bool poll_all_mode_ = false;
-  Inverter *pairing_inverter_ = nullptr;
-  Inverter *polling_inverter_ = nullptr;
+  CommandQueue commands_;
+  CommandCallback active_callback_{nullptr};  // completes the running pairing or reboot
+  PairSlot pair_slots_[ZB_PAIR_BATCH];
+  uint8_t pair_count_ = 0;             // inverters in the batch, 0 if not pairing
+  uint8_t pair_command_ = 0;           // pairing command of the current round
+  uint8_t pair_next_ = 0;              // slot that gets the command of the round next
+  bool pair_request_pending_ = false;  // pairing request waiting for its SRSP
+  uint32_t pair_sent_ = 0;
+  uint32_t pair_started_ = 0;
   Inverter *rebooting_inverter_ = nullptr;
-  int healthcheck_idle_counter_ = 0;
+  DiscoveryTable discovery_;
+  bool discovery_requested_ = false;
+  uint32_t discovery_duration_ = DISCOVERY_DEFAULT_DURATION;
+  CommandCallback discovery_callback_{nullptr};
+  DiscoveryPhase discovery_phase_ = DiscoveryPhase::DP_NEIGHBORS;
+  uint8_t discovery_index_ = 0;            // next neighbor table entry to ask for
+  bool discovery_request_pending_ = false;  // waiting for the answer to the last request
+  uint32_t discovery_sent_ = 0;
+  uint32_t discovery_deadline_ = 0;
+  PollSlot poll_slots_[ZB_POLL_WINDOW];
+  PollSlot *poll_request_pending_ = nullptr;  // poll request waiting for its SRSP
+  uint8_t next_trans_id_ = 1;
+  PollScheduler poll_scheduler_;
+  uint32_t healthcheck_due_ = 0;
+  uint32_t healthcheck_quiet_period_ = ZB_HEALTHCHECK_QUIET_PERIOD;
+  bool healthcheck_required_ = false;  // after an error, checked even if work is pending
+  uint32_t healthcheck_started_ = 0;
+  uint32_t healthcheck_time_ = 0;
+  uint32_t healthchecks_ = 0;
+  bool recovering_ = false;
+  uint8_t recovery_attempt_ = 0;
+  RecoveryTier recovery_tier_ = RecoveryTier::RT_RESYNC;
+  uint32_t recovery_started_ = 0;
+  uint32_t recovery_time_ = 0;
+  uint32_t recoveries_ = 0;
+  CoordinatorMetrics metrics_;
+  bool state_profiling_ = false;
+  StackProbe<ZB_STACK_PROBE_SIZE> stack_probe_;
+  uint32_t state_entered_ = 0;
+  uint32_t sweep_started_ = 0;
+  uint16_t sweep_polls_ = 0;
+  uint16_t sweep_size_ = 0;
   int state_tries_ = 0;
-  int data_state_tries_ = 0;
-  int delay_to_next_execution_ = 0;
+  uint32_t read_started_ = 0;
+  uint16_t response_ = 0;  // frame that completes the pending command
+  TxQueue tx_;
+  MtFrameBuilder tx_frame_{0};
+  uint32_t tx_idle_at_ = 0;   // [µs] the uart sent the last chunk by then
+  bool tx_waiting_ = false;   // the response timeout starts once the queued frame was sent
+  uint32_t next_run_ = 0;  // deadline of the current state, run() is due when it passed
   char ecu_id_[13] = "\0";//"D8A3011B9780";
-  char ecu_id_reverse_[13];
+  uint8_t ecu_address_[6]{0};  // ecu id in over the air byte order (reversed)
+  uint8_t ecu_address_fcs_ = 0;
+  uint8_t normal_operation_frame_[NORMAL_OPERATION_FRAME_SIZE];
+  bool frames_valid_ = false;
+  uint8_t rx_buffer_[ZB_RX_BUFFER_SIZE];
+  uint16_t rx_size_ = 0;
+  bool frame_received_ = false;
+  MtFrameParser parser_;
+  FrameCapture capture_;
+#ifdef USE_HOST
+  std::vector<uint8_t> replay_{};
+  size_t replay_pos_ = 0;
+  uint32_t replay_started_ = 0;  // [µs]
+  uint32_t replay_first_ = 0;    // [µs] timestamp of the first frame of the capture
+#endif
   std::vector<Inverter *> inverters_{};
+  InverterIndex index_;
+  bool index_valid_ = false;
   GPIOPin *reset_pin_;
   uart::UARTDevice *uart_;
 };
@@ -0,0 +1,33 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components.apsystems import apsystems_ns
+from esphome.const import CONF_ID
+
+CODEOWNERS = ["@derrohrbach"]
+
+DEPENDENCIES = ["apsystems"]
+
+CONF_ITERATIONS = "iterations"
+CONF_EXIT_ON_COMPLETION = "exit_on_completion"
+
+benchmark_ns = apsystems_ns.namespace("benchmark")
+DecoderBenchmark = benchmark_ns.class_("DecoderBenchmark", cg.Component)
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(DecoderBenchmark),
+            cv.Optional(CONF_ITERATIONS, 10000): cv.int_range(min=1),
+            cv.Optional(CONF_EXIT_ON_COMPLETION, True): cv.boolean,
+        }
+    ).extend(cv.COMPONENT_SCHEMA),
+    cv.only_on(["host", "esp8266", "esp32"]),
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    cg.add(var.set_iterations(config[CONF_ITERATIONS]))
+    cg.add(var.set_exit_on_completion(config[CONF_EXIT_ON_COMPLETION]))
@@ -0,0 +1,432 @@
+#include "decoder_benchmark.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include "esphome/components/apsystems/inverter_model.h"
+#include "esphome/components/apsystems/stack_probe.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef USE_HOST
+// Counts the heap allocations of the measured routines. The global allocator is only replaced on the host, on the
+// targets the allocations are not counted.
+static uint32_t heap_allocations = 0;
+
+void *operator new(size_t size) {
+  heap_allocations++;
+  void *ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr)
+    abort();
+  return ptr;
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t size) noexcept { free(ptr); }
+#endif
+
+namespace esphome {
+namespace apsystems {
+namespace benchmark {
+
+static const char *const TAG = "apsystems_benchmark";
+
+static const float DRIFT_TOLERANCE_ABSOLUTE = 0.001f;
+static const float DRIFT_TOLERANCE_RELATIVE = 0.00001f;
+// the probe paints this much below the caller, it has to fit into the stack of the loop task
+#if defined(USE_ESP8266)
+static const size_t STACK_PROBE_SIZE = 1024;
+#elif defined(USE_ESP32)
+static const size_t STACK_PROBE_SIZE = 4096;
+#else
+static const size_t STACK_PROBE_SIZE = 16384;
+#endif
+// the watchdog is fed between batches of iterations, outside of the measured time
+static const uint32_t ITERATION_BATCH = 100;
+static const size_t MAX_GOLDEN_POLLS = 16;
+// The decode benchmark cycles through copies of the corpus that are POLL_STEP later each, so every answer is newer
+// than the one decoded before and the power and energy of the interval are computed. Past the last copy the
+// timestamps go back, which the decoder takes as a reset of the inverter.
+static const uint8_t POLL_STEPS = 16;
+static const uint32_t POLL_STEP = 3600;     // [s]
+static const double POLL_STEP_POWER = 100;  // [W] per panel the energy counters advance by
+
+static StackProbe<STACK_PROBE_SIZE> stack_probe;
+
+void BenchmarkCoordinator::set_rx_buffer(const uint8_t *data, size_t size) {
+  memcpy(rx_buffer_, data, size);
+  rx_size_ = size;
+}
+
+bool BenchmarkCoordinator::decode_pair_responses(Inverter *inverter) {
+  size_t pos = 0;
+  MtFrame frame;
+  bool found = false;
+  while (mt_next_frame(rx_buffer_, rx_size_, pos, frame)) {
+    if (frame.is(MT_AF_INCOMING_MSG) && zb_decode_pair_response(inverter, frame))
+      found = true;
+  }
+  return found;
+}
+
+// Copies a poll answer with its timestamp and energy counters step * POLL_STEP later
+static void advance_poll(const uint8_t *golden, uint8_t *data, const InverterModel &model, uint32_t step) {
+  for (uint8_t i = 0; i < model.field_count; i++) {
+    const FieldDescriptor &field = model.fields[i];
+    uint64_t increase;
+    if (field.field == FIELD_TIMESTAMP) {
+      increase = step * POLL_STEP;
+    } else if (field.field >= FIELD_ENERGY && field.field < FIELD_ENERGY + 4) {
+      // a raw unit of the counter is mul / 2^shift µWh
+      double energy = POLL_STEP_POWER * step * POLL_STEP / 3600.0 * 1000000.0;
+      increase = energy * (1ULL << field.shift) / field.mul;
+    } else {
+      continue;
+    }
+    uint8_t width = field.encoding == ENCODING_U16 ? 2 : field.encoding == ENCODING_U24 ? 3 : 4;
+    uint64_t raw = 0;
+    for (uint8_t b = 0; b < width; b++)
+      raw = raw << 8 | golden[field.offset + b];
+    raw += increase;
+    for (int b = width - 1; b >= 0; b--, raw >>= 8)
+      data[field.offset + b] = raw;
+  }
+}
+
+// The hex string decoder of the first release read its fields by offset in hex digits and decoded them in float.
+// The float reference does the same on the binary frame, on targets without an FPU it shows what the fixed point
+// decoder saves. Its values are only kept so the compiler can't drop the math.
+struct ReferenceData {
+  int poll_timestamp;
+  float energy_since_last_reset[4];
+  float energy_today[4];
+  float sum;
+};
+
+// Value of length hex digits starting at hex digit start of the answer data
+static uint32_t hex_digits(const MtFrame &msg, uint8_t start, uint8_t length) {
+  uint32_t value = 0;
+  for (uint8_t i = start; i < start + length; i++) {
+    uint8_t byte = msg.get_u8(i / 2);
+    value = value << 4 | (i % 2 == 0 ? byte >> 4 : byte & 0x0F);
+  }
+  return value;
+}
+
+static float reference_value(const MtFrame &msg, uint8_t start, uint8_t length, float slope = 1, float offset = 0) {
+  return slope * (float) hex_digits(msg, start, length) + offset;
+}
+
+static bool reference_decode(InverterType type, uint8_t panels, const MtFrame &frame, ReferenceData &data) {
+  MtFrame msg = frame.slice(AF_INCOMING_MSG_DATA);
+  float signal_quality = frame.get_u8(AF_INCOMING_MSG_LINK_QUALITY) * 100 / 255.0f;
+  float ac_voltage, ac_frequency, temperature, dc_voltage[4]{}, dc_current[4]{};
+  int poll_timestamp;
+  if (type == INVERTER_TYPE_DS3) {
+    ac_voltage = reference_value(msg, 68, 4) / 3.8;
+    ac_frequency = reference_value(msg, 72, 4) / 100;
+    temperature = reference_value(msg, 96, 4) * 0.0198 - 23.84;
+    dc_voltage[0] = reference_value(msg, 52, 4) / 48.0f;
+    dc_voltage[1] = reference_value(msg, 56, 4) / 48.0f;
+    dc_current[0] = reference_value(msg, 60, 4) * 0.0125f;
+    dc_current[1] = reference_value(msg, 64, 4) * 0.0125f;
+    poll_timestamp = reference_value(msg, 76, 4);
+  } else {
+    ac_voltage = reference_value(msg, 56, 4) / 5.3108f;
+    ac_frequency = 50000000 / reference_value(msg, 24, 6);
+    temperature = reference_value(msg, 20, 4, 0.2752f, -258.7f);
+    dc_voltage[0] = (reference_value(msg, 48, 2, 16) + reference_value(msg, 46, 1)) * 82.5f / 4096.0f;
+    dc_voltage[1] = (reference_value(msg, 54, 2, 16) + reference_value(msg, 52, 1)) * 82.5f / 4096.0f;
+    dc_current[0] = (reference_value(msg, 47, 1, 256) + reference_value(msg, 44, 2)) * 27.5f / 4096.0f;
+    dc_current[1] = (reference_value(msg, 53, 1, 256) + reference_value(msg, 50, 2)) * 27.5f / 4096.0f;
+    if (type == INVERTER_TYPE_QS1) {
+      dc_voltage[2] = (reference_value(msg, 42, 2, 16) + reference_value(msg, 40, 1)) * 82.5f / 4096.0f;
+      dc_voltage[3] = (reference_value(msg, 36, 2, 16) + reference_value(msg, 34, 1)) * 82.5f / 4096.0f;
+      dc_current[2] = (reference_value(msg, 41, 1, 256) + reference_value(msg, 38, 2)) * 27.5f / 4096.0f;
+      dc_current[3] = (reference_value(msg, 35, 1, 256) + reference_value(msg, 32, 2)) * 27.5f / 4096.0f;
+    }
+    poll_timestamp = reference_value(msg, type == INVERTER_TYPE_QS1 ? 60 : 34, 4);
+  }
+
+  int last_poll_timestamp = data.poll_timestamp;
+  if (poll_timestamp < last_poll_timestamp)
+    last_poll_timestamp = 0;
+  int time_since_last_poll = poll_timestamp - last_poll_timestamp;
+  bool valid = ac_frequency >= 30 && ac_frequency <= 80 && ac_voltage >= 80 && ac_voltage <= 290;
+  float max_power = type == INVERTER_TYPE_DS3 ? 750 : type == INVERTER_TYPE_QS1 ? 480 : 450;
+  ReferenceData decoded = data;
+  decoded.poll_timestamp = poll_timestamp;
+  decoded.sum = signal_quality + temperature;
+  for (int x = 0; x < panels; x++) {
+    uint8_t offset = type == INVERTER_TYPE_DS3 ? 100 + x * 8 : 74 + x * 10;
+    float energy = type == INVERTER_TYPE_DS3 ? reference_value(msg, offset, 8) / 100000.0f * 1.66f
+                                             : reference_value(msg, offset, 6) * 8.311F / 3600.0f;
+    decoded.energy_since_last_reset[x] = energy;
+    float energy_increase = last_poll_timestamp != 0 ? energy - data.energy_since_last_reset[x] : energy;
+    decoded.energy_today[x] = data.energy_today[x] + energy_increase;
+    float dc_power = dc_voltage[x] * dc_current[x];
+    float ac_power = energy_increase / (time_since_last_poll / 3600.0f);
+    valid &= dc_power >= 0 && ac_power >= 0 && dc_power <= max_power && ac_power <= max_power;
+    decoded.sum += dc_power + ac_power;
+  }
+  if (valid)
+    data = decoded;
+  return valid;
+}
+
+void DecoderBenchmark::setup() {
+  coordinator_.set_uart_device(&device_);
+  bool golden = check_polls_();
+  golden &= check_pairs_();
+  run_benchmarks_();
+  if (!golden) {
+    ESP_LOGE(TAG, "%u decoded values drifted from the golden frame corpus", drifted_);
+    this->mark_failed();
+  }
+#ifdef USE_HOST
+  if (exit_on_completion_)
+    exit(golden ? EXIT_SUCCESS : EXIT_FAILURE);
+#endif
+}
+
+void DecoderBenchmark::dump_config() {
+  ESP_LOGCONFIG(TAG, "APsystems decoder benchmark:");
+  ESP_LOGCONFIG(TAG, "  Iterations: %u", iterations_);
+  ESP_LOGCONFIG(TAG, "  Golden values drifted: %u", drifted_);
+}
+
+bool DecoderBenchmark::check_value_(const char *name, const char *field, float value, float expected) {
+  if (std::isnan(value) && std::isnan(expected))
+    return true;
+  if (std::fabs(value - expected) <= DRIFT_TOLERANCE_ABSOLUTE + std::fabs(expected) * DRIFT_TOLERANCE_RELATIVE)
+    return true;
+  ESP_LOGE(TAG, "%s: %s is %.6f, expected %.6f", name, field, value, expected);
+  drifted_++;
+  return false;
+}
+
+bool DecoderBenchmark::check_polls_() {
+  bool golden = true;
+  for (const GoldenInverter &golden_inverter : GOLDEN_INVERTERS) {
+    InverterStore store;
+    Inverter inverter{};
+    inverter.set_store(&store, store.add_slot());
+    store.allocate();
+    inverter.set_type(golden_inverter.type);
+    for (int i = 0; i < golden_inverter.panels; i++)
+      inverter.set_panel_connected(i, true);
+    uint8_t panels = inverter.get_connected_panels();
+
+    for (uint8_t p = 0; p < golden_inverter.poll_count; p++) {
+      const GoldenPoll &poll = golden_inverter.polls[p];
+      char name[32];
+      snprintf(name, sizeof(name), "%s %s", golden_inverter.name, poll.name);
+      size_t pos = 0;
+      MtFrame frame;
+      if (!mt_next_frame(poll.frame, poll.size, pos, frame)) {
+        ESP_LOGE(TAG, "%s: frame not found", name);
+        drifted_++;
+        golden = false;
+        continue;
+      }
+      coordinator_.zb_decode_poll_response(&inverter, frame);
+
+      const GoldenValues &expected = poll.expected;
+      golden &= check_value_(name, "poll_timestamp", store.poll_timestamp(0), expected.poll_timestamp);
+      golden &= check_value_(name, "ac_frequency", fixed_to_float(store.ac_frequency(0), UNIT_MILLI),
+                             expected.ac_frequency);
+      golden &= check_value_(name, "signal_quality", fixed_to_float(store.signal_quality(0), UNIT_MILLI),
+                             expected.signal_quality);
+      golden &= check_value_(name, "temperature", fixed_to_float(store.temperature(0), UNIT_MILLI),
+                             expected.temperature);
+      golden &= check_value_(name, "ac_voltage", fixed_to_float(store.ac_voltage(0), UNIT_MILLI), expected.ac_voltage);
+      for (int i = 0; i < 4; i++) {
+        golden &= check_value_(name, "dc_current", fixed_to_float(store.dc_current(0, i), UNIT_MICRO),
+                               expected.dc_current[i]);
+        golden &= check_value_(name, "dc_voltage", fixed_to_float(store.dc_voltage(0, i), UNIT_MICRO),
+                               expected.dc_voltage[i]);
+        golden &= check_value_(name, "dc_power", fixed_to_float(store.dc_power(0, i), UNIT_MILLI),
+                               expected.dc_power[i]);
+        golden &= check_value_(name, "ac_power", fixed_to_float(store.ac_power(0, i), UNIT_MILLI),
+                               expected.ac_power[i]);
+        golden &= check_value_(name, "energy_since_last_reset",
+                               fixed_to_float(store.energy_since_last_reset(0, i), UNIT_MICRO),
+                               expected.energy_since_last_reset[i]);
+        golden &= check_value_(name, "energy_today", fixed_to_float(store.energy_today(0, i), UNIT_MICRO),
+                               expected.energy_today[i]);
+      }
+      golden &= check_value_(name, "dc_power", fixed_to_float(store.total_dc_power(0, panels), UNIT_MILLI),
+                             expected.dc_power[4]);
+      golden &= check_value_(name, "ac_power", fixed_to_float(store.total_ac_power(0, panels), UNIT_MILLI),
+                             expected.ac_power[4]);
+      golden &= check_value_(name, "energy_since_last_reset",
+                             fixed_to_float(store.total_energy_since_last_reset(0, panels), UNIT_MICRO),
+                             expected.energy_since_last_reset[4]);
+      golden &= check_value_(name, "energy_today", fixed_to_float(store.total_energy_today(0, panels), UNIT_MICRO),
+                             expected.energy_today[4]);
+    }
+  }
+  return golden;
+}
+
+bool DecoderBenchmark::check_pairs_() {
+  bool golden = true;
+  for (const GoldenPair &pair : GOLDEN_PAIRS) {
+    Inverter inverter{};
+    inverter.set_serial(pair.serial);
+    coordinator_.set_rx_buffer(pair.frame, pair.size);
+    coordinator_.decode_pair_responses(&inverter);
+    if (strcmp(inverter.get_id(), pair.pair_id) != 0) {
+      ESP_LOGE(TAG, "pair %s: pair id is '%s', expected '%s'", pair.serial, inverter.get_id(), pair.pair_id);
+      drifted_++;
+      golden = false;
+    }
+  }
+  return golden;
+}
+
+template<typename F> BenchmarkResult DecoderBenchmark::measure_(uint32_t frames, F &&run) {
+  BenchmarkResult result{};
+  stack_probe.paint();
+#ifdef USE_HOST
+  uint32_t allocations = heap_allocations;
+  run();
+  result.allocations = (heap_allocations - allocations) / (float) frames;
+#else
+  run();
+  result.allocations = NAN;
+#endif
+  result.stack = stack_probe.used();
+
+  uint64_t elapsed = 0;  // [µs]
+  for (uint32_t done = 0; done < iterations_;) {
+    uint32_t batch = std::min(iterations_ - done, ITERATION_BATCH);
+    uint32_t start = micros();
+    for (uint32_t i = 0; i < batch; i++)
+      run();
+    elapsed += micros() - start;
+    done += batch;
+    arch_feed_wdt();
+  }
+  result.ns_per_frame = elapsed * 1000.0f / iterations_ / frames;
+  return result;
+}
+
+void DecoderBenchmark::report_(const char *routine, const BenchmarkResult &result) {
+  if (std::isnan(result.allocations)) {
+    ESP_LOGI(TAG, "  %-22s %9.1f ns/frame %6u bytes stack", routine, result.ns_per_frame, (unsigned) result.stack);
+  } else {
+    ESP_LOGI(TAG, "  %-22s %9.1f ns/frame %6u bytes stack %5.2f allocations/frame", routine, result.ns_per_frame,
+             (unsigned) result.stack, result.allocations);
+  }
+}
+
+void DecoderBenchmark::run_benchmarks_() {
+  // the corpus parsed once up front, so every benchmark covers only its own routine
+  static Inverter inverters[sizeof(GOLDEN_INVERTERS) / sizeof(GoldenInverter)];
+  for (Inverter &inverter : inverters)
+    inverter.set_store(&store_, store_.add_slot());
+  store_.allocate();
+  Inverter *poll_inverters[MAX_GOLDEN_POLLS];
+  MtFrame poll_frames[MAX_GOLDEN_POLLS];
+  static uint8_t step_buffers[POLL_STEPS][MAX_GOLDEN_POLLS][MT_MAX_FRAME_SIZE];
+  static MtFrame step_frames[POLL_STEPS][MAX_GOLDEN_POLLS];
+  const GoldenPoll *polls[MAX_GOLDEN_POLLS];
+  uint32_t poll_count = 0;
+  for (size_t n = 0; n < sizeof(GOLDEN_INVERTERS) / sizeof(GoldenInverter); n++) {
+    const GoldenInverter &golden_inverter = GOLDEN_INVERTERS[n];
+    inverters[n].set_type(golden_inverter.type);
+    for (int i = 0; i < golden_inverter.panels; i++)
+      inverters[n].set_panel_connected(i, true);
+    for (uint8_t p = 0; p < golden_inverter.poll_count && poll_count < MAX_GOLDEN_POLLS; p++) {
+      size_t pos = 0;
+      if (!mt_next_frame(golden_inverter.polls[p].frame, golden_inverter.polls[p].size, pos, poll_frames[poll_count]))
+        continue;
+      const MtFrame &golden = poll_frames[poll_count];
+      for (uint8_t step = 0; step < POLL_STEPS; step++) {
+        uint8_t *buffer = step_buffers[step][poll_count];
+        memcpy(buffer, golden_inverter.polls[p].frame, golden_inverter.polls[p].size);
+        uint8_t *payload = buffer + (golden.payload - golden_inverter.polls[p].frame);
+        advance_poll(golden.payload + AF_INCOMING_MSG_DATA, payload + AF_INCOMING_MSG_DATA,
+                     get_inverter_model(golden_inverter.type), step);
+        step_frames[step][poll_count] = MtFrame{golden.command, golden.length, payload};
+      }
+      poll_inverters[poll_count] = &inverters[n];
+      polls[poll_count++] = &golden_inverter.polls[p];
+    }
+  }
+  const uint32_t pair_count = sizeof(GOLDEN_PAIRS) / sizeof(GoldenPair);
+  static Inverter pair_inverters[pair_count];
+  for (uint32_t i = 0; i < pair_count; i++)
+    pair_inverters[i].set_serial(GOLDEN_PAIRS[i].serial);
+
+  ESP_LOGI(TAG, "Results over %u iterations of %u poll and %u pair frames:", iterations_, poll_count, pair_count);
+
+  MtFrameParser parser;
+  volatile uint32_t sink = 0;
+  parser.set_on_frame([&sink](const MtFrame &frame, const uint8_t *raw, size_t raw_size) { sink = sink + 1; });
+  report_("frame parser", measure_(poll_count, [&]() {
+            for (uint32_t i = 0; i < poll_count; i++) {
+              for (uint8_t p = 0; p < polls[i]->size; p++)
+                parser.feed(polls[i]->frame[p]);
+            }
+          }));
+
+  report_("checksum", measure_(poll_count, [&]() {
+            for (uint32_t i = 0; i < poll_count; i++)
+              sink = sink + mt_checksum(polls[i]->frame + 1, polls[i]->size - 2);
+          }));
+
+  // every field of the answer, as u8, u16, u24 and u32
+  report_("field access", measure_(poll_count, [&]() {
+            for (uint32_t i = 0; i < poll_count; i++) {
+              const MtFrame &frame = poll_frames[i];
+              uint32_t sum = 0;
+              for (uint8_t o = 0; o < frame.length; o++)
+                sum += frame.get_u8(o) + frame.get_u16(o) + frame.get_u24(o) + frame.get_u32(o);
+              sink = sink + sum;
+            }
+          }));
+
+  uint32_t step = 0;
+  report_("decode poll response", measure_(poll_count, [&]() {
+            const MtFrame *frames = step_frames[step++ % POLL_STEPS];
+            for (uint32_t i = 0; i < poll_count; i++)
+              coordinator_.zb_decode_poll_response(poll_inverters[i], frames[i]);
+          }));
+
+  // the fields alone, the counterpart of the float reference without the power and energy math
+  int64_t values[FIELD_COUNT];
+  report_("decode fields", measure_(poll_count, [&]() {
+            const MtFrame *frames = step_frames[step++ % POLL_STEPS];
+            for (uint32_t i = 0; i < poll_count; i++) {
+              const InverterModel &model = get_inverter_model(poll_inverters[i]->get_type());
+              sink = sink + model.decode(frames[i].slice(AF_INCOMING_MSG_DATA), 0x0F, values);
+            }
+          }));
+
+  static ReferenceData reference[sizeof(GOLDEN_INVERTERS) / sizeof(GoldenInverter)];
+  step = 0;
+  report_("decode float reference", measure_(poll_count, [&]() {
+            const MtFrame *frames = step_frames[step++ % POLL_STEPS];
+            for (uint32_t i = 0; i < poll_count; i++) {
+              size_t n = poll_inverters[i] - inverters;
+              reference_decode(GOLDEN_INVERTERS[n].type, GOLDEN_INVERTERS[n].panels, frames[i], reference[n]);
+            }
+          }));
+
+  report_("decode pair response", measure_(pair_count, [&]() {
+            for (uint32_t i = 0; i < pair_count; i++) {
+              coordinator_.set_rx_buffer(GOLDEN_PAIRS[i].frame, GOLDEN_PAIRS[i].size);
+              coordinator_.decode_pair_responses(&pair_inverters[i]);
+            }
+          }));
+
+  report_("send", measure_(poll_count, [&]() {
+            for (uint32_t i = 0; i < poll_count; i++)
+              coordinator_.zb_send(polls[i]->frame, polls[i]->size, MT_AF_INCOMING_MSG);
+          }));
+}
+
+}  // namespace benchmark
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esphome/core/component.h"
+#include "esphome/components/uart/uart.h"
+#include "esphome/components/apsystems/zigbee_coordinator.h"
+#include "golden_frames.h"
+
+namespace esphome {
+namespace apsystems {
+namespace benchmark {
+
+// Gives the benchmark access to the protocol routines of the coordinator
+class BenchmarkCoordinator : public ZigbeeCoordinator {
+ public:
+  using ZigbeeCoordinator::zb_decode_poll_response;
+  using ZigbeeCoordinator::zb_send;
+  void set_rx_buffer(const uint8_t *data, size_t size);
+  // Decodes the pair answers in the receive buffer like the pairing does, the last answer wins
+  bool decode_pair_responses(Inverter *inverter);
+};
+
+// Discards everything written, never has data to read
+class NullUart : public uart::UARTComponent {
+ public:
+  void write_array(const uint8_t *data, size_t len) override {}
+  bool peek_byte(uint8_t *data) override { return false; }
+  bool read_array(uint8_t *data, size_t len) override { return false; }
+  int available() override { return 0; }
+  void flush() override {}
+
+ protected:
+  void check_logger_conflict() override {}
+};
+
+struct BenchmarkResult {
+  float ns_per_frame;
+  size_t stack;        // bytes used below the caller
+  float allocations;   // heap allocations per frame
+};
+
+// Checks the protocol routines against the golden frame corpus and measures their run time, stack and heap use.
+// Runs once on setup, exits with a failure if a decoded value drifted from the corpus.
+class DecoderBenchmark : public Component {
+ public:
+  void set_iterations(uint32_t iterations) { iterations_ = iterations; }
+  void set_exit_on_completion(bool exit_on_completion) { exit_on_completion_ = exit_on_completion; }
+  void setup() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::LATE; }
+
+ protected:
+  bool check_polls_();
+  bool check_pairs_();
+  bool check_value_(const char *name, const char *field, float value, float expected);
+  void run_benchmarks_();
+  template<typename F> BenchmarkResult measure_(uint32_t frames, F &&run);
+  void report_(const char *routine, const BenchmarkResult &result);
+
+  uint32_t iterations_{10000};
+  bool exit_on_completion_{true};
+  uint32_t drifted_{0};
+  NullUart uart_;
+  uart::UARTDevice device_{&uart_};
+  BenchmarkCoordinator coordinator_;
+  InverterStore store_;
+};
+
+}  // namespace benchmark
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,258 @@
+#pragma once
+
+#include "esphome/components/apsystems/inverter.h"
+
+namespace esphome {
+namespace apsystems {
+namespace benchmark {
+
+// Golden frame corpus of the decoder. The frames are complete MT frames as read from the uart. The expected values
+// are what the hex string decoder the binary codec replaced produced for them, zb_decode_poll_response and
+// zb_check_pair_response of the first release fed with the frames as hex. Any change to the decoder has to
+// reproduce them.
+
+// Decoded inverter data in the units published to the sensors, index 4 of the panel values holds the total
+struct GoldenValues {
+  int poll_timestamp;
+  float ac_frequency;
+  float signal_quality;
+  float temperature;
+  float ac_voltage;
+  float dc_current[4];
+  float dc_voltage[4];
+  float dc_power[5];
+  float ac_power[5];
+  float energy_since_last_reset[5];
+  float energy_today[5];
+};
+
+struct GoldenPoll {
+  const char *name;
+  const uint8_t *frame;
+  uint8_t size;
+  GoldenValues expected;  // inverter data once the frame was decoded, unchanged if the decoder rejected it
+};
+
+// Poll answers of one inverter, decoded in order starting without previous data
+struct GoldenInverter {
+  const char *name;
+  InverterType type;
+  uint8_t panels;
+  const GoldenPoll *polls;
+  uint8_t poll_count;
+};
+
+struct GoldenPair {
+  const char *serial;
+  const uint8_t *frame;
+  uint8_t size;
+  const char *pair_id;  // empty if the answer does not hold a pair id for the serial
+};
+
+// clang-format off
+// YC600: two polls 300 s apart, a restart of the inverter and an answer with an implausible ac voltage
+static const uint8_t YC600_POLL_1[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x96, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x43, 0x0F, 0x40, 0xB0, 0x00, 0x00, 0x04, 0xB0, 0x00, 0x00, 0x00, 0xF8, 0x42, 0x6D, 0xDA, 0x02,
+    0x6C, 0x04, 0xCD, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5F, 0xE6, 0x00, 0x00, 0x00,
+    0x5A, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x68,
+};
+static const uint8_t YC600_POLL_2[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x91, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x48, 0x0F, 0x43, 0xD0, 0x00, 0x00, 0x05, 0xDC, 0x00, 0x00, 0x00, 0x15, 0xA3, 0x6C, 0x07, 0x63,
+    0x6B, 0x04, 0xD5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7A, 0x12, 0x00, 0x00, 0x00,
+    0x73, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x3C,
+};
+static const uint8_t YC600_POLL_RESET[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x90, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x37, 0x0F, 0x42, 0x40, 0x00, 0x00, 0x00, 0x2D, 0x00, 0x00, 0x00, 0xB3, 0x30, 0x69, 0xA4, 0x90,
+    0x68, 0x04, 0xC6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xDC, 0x00, 0x00, 0x00,
+    0x00, 0xC8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x64,
+};
+static const uint8_t YC600_POLL_INVALID[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x90, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x37, 0x0F, 0x42, 0x40, 0x00, 0x00, 0x01, 0x59, 0x00, 0x00, 0x00, 0xB3, 0x30, 0x69, 0xA4, 0x90,
+    0x68, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x4C, 0x00, 0x00, 0x00,
+    0x03, 0xE8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x24,
+};
+// QS1: two polls 300 s apart, 4 panels
+static const uint8_t QS1_POLL_1[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x8F, 0x12, 0x14, 0x14, 0x00, 0xB4, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x57, 0x0F, 0x41, 0x78, 0x00, 0x2D, 0xB0, 0x5D, 0xB9, 0xA3, 0x70, 0x9B, 0x03, 0x70, 0x7E, 0x63,
+    0x6F, 0x04, 0xC4, 0x1C, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0xE8, 0x88, 0x00, 0x00, 0x02,
+    0xCE, 0xC0, 0x00, 0x00, 0x02, 0xF9, 0xB8, 0x00, 0x00, 0x00, 0x08, 0x34, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x8B,
+};
+static const uint8_t QS1_POLL_2[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x8F, 0x12, 0x14, 0x14, 0x00, 0xB2, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x5A, 0x0F, 0x3F, 0xE8, 0x00, 0x2D, 0x60, 0x5D, 0xC8, 0x53, 0x70, 0xAA, 0xB3, 0x6F, 0x8D, 0x13,
+    0x6F, 0x04, 0xC9, 0x1D, 0x4C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x08, 0x90, 0x00, 0x00, 0x02,
+    0xED, 0x9C, 0x00, 0x00, 0x03, 0x1A, 0x88, 0x00, 0x00, 0x00, 0x09, 0x60, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x43,
+};
+// DS3: two polls 300 s apart
+static const uint8_t DS3_POLL_1[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x5D, 0x02, 0x14, 0x14, 0x00, 0x70, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+    0x33, 0x07, 0x20, 0x02, 0x88, 0x02, 0x78, 0x03, 0x76, 0x13, 0x89, 0x0E, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x7F, 0x01, 0x13, 0xB9, 0xF0, 0x01, 0x0B, 0x07, 0x60, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0x62,
+};
+static const uint8_t DS3_POLL_2[] = {
+    0xFE, 0x61, 0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x5D, 0x02, 0x14, 0x14, 0x00, 0x72, 0x00, 0x12,
+    0x34, 0x56, 0x78, 0x00, 0x50, 0xFB, 0xFB, 0x51, 0xB1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+    0x2A, 0x07, 0x1B, 0x02, 0x98, 0x02, 0x80, 0x03, 0x74, 0x13, 0x87, 0x0F, 0x3C, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0xA2, 0x01, 0x2B, 0xFC, 0xE0, 0x01, 0x22, 0x5F, 0xF0, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0xFE, 0xFE, 0xDA,
+};
+// Pairing answers as read from the uart in one go: the SRSP, the AF_DATA_CONFIRM and the answer of the inverter.
+// The fourth answer belongs to another inverter, the last one is cut off behind the pair id.
+static const uint8_t YC600_PAIR[] = {
+    0xFE, 0x01, 0x64, 0x02, 0x00, 0x67, 0xFE, 0x03, 0x44, 0x80, 0x00, 0x14, 0x8C, 0x5F, 0xFE, 0x29,
+    0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x8C, 0x00, 0x12, 0x34, 0x56,
+    0x78, 0x00, 0x18, 0xFB, 0xFB, 0x10, 0x00, 0x40, 0x80, 0x00, 0x01, 0x23, 0x45, 0x3C, 0xA1, 0x80,
+    0x97, 0x1B, 0x01, 0xA3, 0xD8, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0xB7,
+};
+static const uint8_t QS1_PAIR[] = {
+    0xFE, 0x01, 0x64, 0x02, 0x00, 0x67, 0xFE, 0x03, 0x44, 0x80, 0x00, 0x14, 0x8C, 0x5F, 0xFE, 0x29,
+    0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x8F, 0x12, 0x14, 0x14, 0x00, 0x8C, 0x00, 0x12, 0x34, 0x56,
+    0x78, 0x00, 0x18, 0xFB, 0xFB, 0x10, 0x00, 0x80, 0x10, 0x00, 0x05, 0x43, 0x21, 0x8F, 0x12, 0x80,
+    0x97, 0x1B, 0x01, 0xA3, 0xD8, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0xE7,
+};
+static const uint8_t DS3_PAIR[] = {
+    0xFE, 0x01, 0x64, 0x02, 0x00, 0x67, 0xFE, 0x03, 0x44, 0x80, 0x00, 0x14, 0x8C, 0x5F, 0xFE, 0x29,
+    0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x5D, 0x02, 0x14, 0x14, 0x00, 0x8C, 0x00, 0x12, 0x34, 0x56,
+    0x78, 0x00, 0x18, 0xFB, 0xFB, 0x10, 0x00, 0x70, 0x30, 0x00, 0x09, 0x87, 0x65, 0x5D, 0x02, 0x80,
+    0x97, 0x1B, 0x01, 0xA3, 0xD8, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0xBB,
+};
+static const uint8_t OTHER_PAIR[] = {
+    0xFE, 0x01, 0x64, 0x02, 0x00, 0x67, 0xFE, 0x03, 0x44, 0x80, 0x00, 0x14, 0x8C, 0x5F, 0xFE, 0x29,
+    0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x12, 0x34, 0x14, 0x14, 0x00, 0x8C, 0x00, 0x12, 0x34, 0x56,
+    0x78, 0x00, 0x18, 0xFB, 0xFB, 0x10, 0x00, 0x40, 0x80, 0x00, 0x09, 0x99, 0x99, 0x12, 0x34, 0x80,
+    0x97, 0x1B, 0x01, 0xA3, 0xD8, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0xD9,
+};
+static const uint8_t TRUNCATED_PAIR[] = {
+    0xFE, 0x01, 0x64, 0x02, 0x00, 0x67, 0xFE, 0x03, 0x44, 0x80, 0x00, 0x14, 0x8C, 0x5F, 0xFE, 0x1D,
+    0x44, 0x81, 0x00, 0x00, 0x06, 0x00, 0x3C, 0xA1, 0x14, 0x14, 0x00, 0x8C, 0x00, 0x12, 0x34, 0x56,
+    0x78, 0x00, 0x18, 0xFB, 0xFB, 0x10, 0x00, 0x40, 0x80, 0x00, 0x01, 0x23, 0x45, 0x3C, 0xA1, 0xF5,
+};
+
+static const GoldenPoll YC600_POLLS[] = {
+    {"poll 1", YC600_POLL_1, sizeof(YC600_POLL_1),
+     {1200, 50.0200081, 58.8235283, 41.5432129, 231.415222,
+      {5.10253906, 4.90112305, 0, 0},
+      {35.2075195, 34.8046875, 0, 0},
+      {179.647751, 170.582062, 0, 0, 350.229797},
+      {170.029205, 159.98674, 0, 0, 330.01593},
+      {56.676403, 53.3289146, 0, 0, 110.005318},
+      {56.676403, 53.3289146, 0, 0, 110.005318},
+     }},
+    {"poll 2", YC600_POLL_2, sizeof(YC600_POLL_2),
+     {1500, 49.9800072, 56.8627434, 42.9191895, 232.921585,
+      {5.29724121, 5.20324707, 0, 0},
+      {35.0061035, 34.6032715, 0, 0},
+      {185.435776, 180.049377, 0, 0, 365.485168},
+      {185.61232, 177.301346, 0, 0, 362.913666},
+      {72.1440964, 68.1040268, 0, 0, 140.248123},
+      {72.1440964, 68.1040268, 0, 0, 140.248123},
+     }},
+    {"restart", YC600_POLL_RESET, sizeof(YC600_POLL_RESET),
+     {45, 50, 56.4705887, 38.2407837, 230.097153,
+      {1.20178223, 1.10107422, 0, 0},
+      {33.8983154, 33.6968994, 0, 0},
+      {40.7383919, 37.102787, 0, 0, 77.8411789},
+      {40.6315498, 36.9377747, 0, 0, 77.5693207},
+      {0.507894397, 0.461722195, 0, 0, 0.969616592},
+      {72.6519928, 68.5657501, 0, 0, 141.217743},
+     }},
+    {"implausible", YC600_POLL_INVALID, sizeof(YC600_POLL_INVALID),
+     {45, 50, 56.4705887, 38.2407837, 230.097153,
+      {1.20178223, 1.10107422, 0, 0},
+      {33.8983154, 33.6968994, 0, 0},
+      {40.7383919, 37.102787, 0, 0, 77.8411789},
+      {40.6315498, 36.9377747, 0, 0, 77.5693207},
+      {0.507894397, 0.461722195, 0, 0, 0.969616592},
+      {72.6519928, 68.5657501, 0, 0, 141.217743},
+     }},
+};
+
+static const GoldenPoll QS1_POLLS[] = {
+    {"poll 1", QS1_POLL_1, sizeof(QS1_POLL_1),
+     {7200, 50.0100021, 70.5882339, 47.0472107, 229.720566,
+      {6.19689941, 6.00219727, 6.39831543, 0.302124023},
+      {36.09375, 35.892334, 36.295166, 30.1922607},
+      {223.669342, 215.432861, 232.227921, 9.1218071, 680.451965},
+      {220.010635, 212.392227, 225.089584, 2.42404151, 659.916443},
+      {440.021271, 424.784454, 450.179169, 4.84808302, 1319.83289},
+      {440.021271, 424.784454, 450.179169, 4.84808302, 1319.83289},
+     }},
+    {"poll 2", QS1_POLL_2, sizeof(QS1_POLL_2),
+     {7500, 50.0300179, 69.8039246, 47.8728027, 230.662048,
+      {6.29760742, 6.10290527, 6.49902344, 0.302124023},
+      {35.993042, 35.791626, 36.194458, 30.0915527},
+      {226.670044, 218.432907, 235.228638, 9.09138107, 689.422974},
+      {227.167236, 218.856079, 232.708008, 8.31100273, 687.042297},
+      {458.951874, 443.022461, 469.571503, 5.54066658, 1377.08655},
+      {458.951874, 443.022461, 469.571503, 5.54066658, 1377.08655},
+     }},
+};
+
+static const GoldenPoll DS3_POLLS[] = {
+    {"poll 1", DS3_POLL_1, sizeof(DS3_POLL_1),
+     {3600, 50.0099983, 43.9215698, 39.5001984, 233.157898,
+      {8.10000038, 7.9000001, 0, 0},
+      {38.3958321, 38, 0, 0},
+      {311.006256, 300.200012, 0, 0, 611.206299},
+      {299.961975, 290.5, 0, 0, 590.461975},
+      {299.961975, 290.5, 0, 0, 590.461975},
+      {299.961975, 290.5, 0, 0, 590.461975},
+     }},
+    {"poll 2", DS3_POLL_2, sizeof(DS3_POLL_2),
+     {3900, 49.9900017, 44.705883, 40.1931992, 232.631577,
+      {8.30000019, 8, 0, 0},
+      {38.2083321, 37.8958321, 0, 0},
+      {317.12915, 303.166656, 0, 0, 620.295776},
+      {316.728516, 304.776123, 0, 0, 621.504639},
+      {326.356018, 315.89801, 0, 0, 642.254028},
+      {326.356018, 315.89801, 0, 0, 642.254028},
+     }},
+};
+
+static const GoldenInverter GOLDEN_INVERTERS[] = {
+    {"yc600", INVERTER_TYPE_YC600, 2, YC600_POLLS, sizeof(YC600_POLLS) / sizeof(GoldenPoll)},
+    {"qs1", INVERTER_TYPE_QS1, 4, QS1_POLLS, sizeof(QS1_POLLS) / sizeof(GoldenPoll)},
+    {"ds3", INVERTER_TYPE_DS3, 2, DS3_POLLS, sizeof(DS3_POLLS) / sizeof(GoldenPoll)},
+};
+
+static const GoldenPair GOLDEN_PAIRS[] = {
+    {"408000012345", YC600_PAIR, sizeof(YC600_PAIR), "3CA1"},
+    {"801000054321", QS1_PAIR, sizeof(QS1_PAIR), "8F12"},
+    {"703000098765", DS3_PAIR, sizeof(DS3_PAIR), "5D02"},
+    {"408000012345", OTHER_PAIR, sizeof(OTHER_PAIR), ""},
+    {"408000012345", TRUNCATED_PAIR, sizeof(TRUNCATED_PAIR), ""},
+};
+// clang-format on
+
+}  // namespace benchmark
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,97 @@
+from esphome import pins
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import uart
+from esphome.components.apsystems import Apsystems, apsystems_ns, coordinator_id
+from esphome.const import (
+    CONF_ID,
+    CONF_INVERTED,
+    CONF_MODE,
+    CONF_NUMBER,
+    CONF_OUTPUT,
+)
+
+CODEOWNERS = ["@derrohrbach"]
+
+AUTO_LOAD = ["uart"]
+
+CONF_APSYSTEMS_ID = "apsystems_id"
+CONF_APSYSTEMS_EMULATOR = "apsystems_emulator"
+CONF_ECU_ID = "ecu_id"
+CONF_LATENCY_MIN = "latency_min"
+CONF_LATENCY_MAX = "latency_max"
+CONF_LOSS_RATE = "loss_rate"
+CONF_CORRUPTION_RATE = "corruption_rate"
+CONF_SEED = "seed"
+
+emulator_ns = apsystems_ns.namespace("emulator")
+Cc2530Emulator = emulator_ns.class_(
+    "Cc2530Emulator", uart.UARTComponent, cg.Component
+)
+EmulatorResetPin = emulator_ns.class_("EmulatorResetPin", cg.GPIOPin)
+
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(Cc2530Emulator),
+        cv.Required(CONF_APSYSTEMS_ID): cv.use_id(Apsystems),
+        cv.Optional(CONF_ECU_ID, "46AF3B742134"): coordinator_id,
+        cv.Optional(
+            CONF_LATENCY_MIN, "20ms"
+        ): cv.positive_time_period_microseconds,
+        cv.Optional(
+            CONF_LATENCY_MAX, "60ms"
+        ): cv.positive_time_period_microseconds,
+        cv.Optional(CONF_LOSS_RATE, "0%"): cv.percentage,
+        cv.Optional(CONF_CORRUPTION_RATE, "0%"): cv.percentage,
+        cv.Optional(CONF_SEED, 42): cv.uint32_t,
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    parent = await cg.get_variable(config[CONF_APSYSTEMS_ID])
+    cg.add(var.set_apsystems(parent))
+    cg.add(var.set_ecu_id(config[CONF_ECU_ID]))
+    cg.add(
+        var.set_latency(
+            config[CONF_LATENCY_MIN].total_microseconds,
+            config[CONF_LATENCY_MAX].total_microseconds,
+        )
+    )
+    cg.add(var.set_loss_rate(config[CONF_LOSS_RATE]))
+    cg.add(var.set_corruption_rate(config[CONF_CORRUPTION_RATE]))
+    cg.add(var.set_seed(config[CONF_SEED]))
+
+
+def validate_mode(value):
+    if not value[CONF_OUTPUT]:
+        raise cv.Invalid("The emulator reset pin only supports output mode")
+    return value
+
+
+EMULATOR_PIN_SCHEMA = cv.All(
+    {
+        cv.GenerateID(): cv.declare_id(EmulatorResetPin),
+        cv.Required(CONF_APSYSTEMS_EMULATOR): cv.use_id(Cc2530Emulator),
+        cv.Optional(CONF_NUMBER, 0): cv.int_,
+        cv.Optional(CONF_MODE, default={}): cv.All(
+            {
+                cv.Optional(CONF_OUTPUT, default=True): cv.boolean,
+            },
+            validate_mode,
+        ),
+        cv.Optional(CONF_INVERTED, default=False): cv.boolean,
+    }
+)
+
+
+@pins.PIN_SCHEMA_REGISTRY.register(CONF_APSYSTEMS_EMULATOR, EMULATOR_PIN_SCHEMA)
+async def emulator_pin_to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    parent = await cg.get_variable(config[CONF_APSYSTEMS_EMULATOR])
+    cg.add(var.set_parent(parent))
+    cg.add(var.set_inverted(config[CONF_INVERTED]))
+    return var
@@ -0,0 +1,423 @@
+#include "cc2530_emulator.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+namespace emulator {
+
+static const char *const TAG = "apsystems_emulator";
+
+static const uint32_t BYTE_TIME_US = 87;  // 115200 baud 8N1
+static const uint32_t SRSP_DELAY_US = 1000;
+static const uint32_t CONFIRM_DELAY_US = 5000;
+static const uint32_t RESET_DELAY_US = 400000;
+static const uint32_t START_DELAY_US = 200000;
+static const uint16_t ZDO_STATE_CHANGE_IND = 0x45C0;
+static const uint8_t DEVICE_STATE_COORDINATOR = 0x09;
+static const uint8_t AF_STATUS_NO_ROUTE = 0xCD;
+static const uint8_t POLL_ANSWER_SIZE = 80;
+static const uint8_t LQI_ENTRIES_PER_PAGE = 3;  // like Z-Stack, larger tables are paged
+
+Cc2530Emulator::Cc2530Emulator() {
+  this->set_baud_rate(115200);
+  this->set_stop_bits(1);
+  this->set_data_bits(8);
+  this->set_parity(uart::UART_CONFIG_PARITY_NONE);
+  parser_.set_on_frame([this](const MtFrame &frame, const uint8_t *raw, size_t raw_size) {
+    frames_received_++;
+    if (reset_line_ && !hanging_)
+      handle_request_(frame);
+  });
+}
+
+void Cc2530Emulator::setup() {
+  if (apsystems_ == nullptr)
+    return;
+  // emulate the configured inverters, already joined to the network
+  uint16_t next_address = 0x1000;
+  for (auto inv : apsystems_->get_inverters()) {
+    uint16_t address = next_address++;
+    if (inv->is_paired()) {
+      uint8_t id[2];
+      parse_hex(inv->get_id(), id, 2);
+      address = (id[0] << 8) | id[1];
+    }
+    add_inverter(inv->get_serial(), inv->get_type(), address);
+  }
+}
+
+void Cc2530Emulator::dump_config() {
+  ESP_LOGCONFIG(TAG, "APsystems CC2530 emulator:");
+  ESP_LOGCONFIG(TAG, "  Inverters: %u", (unsigned) inverters_.size());
+  ESP_LOGCONFIG(TAG, "  Latency: %u-%u us", latency_min_us_, latency_max_us_);
+  ESP_LOGCONFIG(TAG, "  Loss rate: %.1f%%", loss_rate_ * 100);
+  ESP_LOGCONFIG(TAG, "  Corruption rate: %.1f%%", corruption_rate_ * 100);
+  ESP_LOGCONFIG(TAG, "  Frames received: %u, sent: %u, resets: %u", frames_received_, frames_sent_, resets_);
+}
+
+EmulatedInverter &Cc2530Emulator::add_inverter(const char *serial, InverterType type, uint16_t address, bool joined) {
+  EmulatedInverter inv{};
+  parse_hex(serial, inv.serial, 6);
+  inv.address[0] = address >> 8;
+  inv.address[1] = address & 0xFF;
+  inv.type = type;
+  inv.joined = joined;
+  inv.link_quality = 60 + random_() % 150;
+  inv.dc_voltage = 30.0f + (random_() % 100) / 10.0f;
+  inv.dc_current = 1.0f + (random_() % 60) / 10.0f;
+  inv.timestamp = 1 + random_() % 30000;  // the inverters have been running for a while
+  inverters_.push_back(inv);
+  return inverters_.back();
+}
+
+void Cc2530Emulator::set_ecu_id(const std::string &ecu_id) {
+  uint8_t bytes[6];
+  parse_hex(ecu_id.c_str(), bytes, 6);
+  for (int i = 0; i < 6; i++)
+    ecu_address_[i] = bytes[5 - i];
+}
+
+void Cc2530Emulator::set_latency(uint32_t min_us, uint32_t max_us) {
+  latency_min_us_ = min_us;
+  latency_max_us_ = std::max(min_us, max_us);
+}
+
+void Cc2530Emulator::write_array(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    parser_.feed(data[i]);
+}
+
+int Cc2530Emulator::available() {
+  transmit_();
+  uint64_t now = now_us_();
+  int count = 0;
+  for (auto &b : wire_) {
+    if (b.at > now)
+      break;
+    count++;
+  }
+  return count;
+}
+
+bool Cc2530Emulator::peek_byte(uint8_t *data) {
+  if (available() == 0)
+    return false;
+  *data = wire_.front().value;
+  return true;
+}
+
+bool Cc2530Emulator::read_array(uint8_t *data, size_t len) {
+  if ((size_t) available() < len)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    data[i] = wire_.front().value;
+    wire_.pop_front();
+  }
+  return true;
+}
+
+void Cc2530Emulator::set_reset_line(bool value) {
+  if (reset_line_ && !value) {
+    // held in reset: forget everything in flight
+    pending_.clear();
+    wire_.clear();
+    wire_free_at_ = 0;
+    started_ = false;
+    hanging_ = false;
+    resets_++;
+  } else if (!reset_line_ && value) {
+    static const uint8_t RESET_IND[] = {0x00, 0x02, 0x02, 0x02, 0x07, 0x02};  // reason power up
+    send_(MT_SYS_RESET_IND, RESET_IND, sizeof(RESET_IND), RESET_DELAY_US);
+  }
+  reset_line_ = value;
+}
+
+void Cc2530Emulator::handle_request_(const MtFrame &frame) {
+  static const uint8_t SUCCESS = 0x00;
+  switch (frame.command) {
+    case MT_SYS_PING: {
+      static const uint8_t CAPABILITIES[] = {0x79, 0x07};
+      send_(MT_SYS_PING_SRSP, CAPABILITIES, sizeof(CAPABILITIES), SRSP_DELAY_US);
+      break;
+    }
+    case MT_SYS_RESET_REQ: {
+      static const uint8_t RESET_IND[] = {0x01, 0x02, 0x02, 0x02, 0x07, 0x02};  // reason external
+      started_ = false;
+      send_(MT_SYS_RESET_IND, RESET_IND, sizeof(RESET_IND), RESET_DELAY_US);
+      break;
+    }
+    case MT_ZB_WRITE_CONFIGURATION:
+      send_(MT_ZB_WRITE_CONFIGURATION_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+      break;
+    case MT_AF_REGISTER:
+      send_(MT_AF_REGISTER_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+      break;
+    case MT_ZB_START_REQUEST:
+      send_(MT_ZB_START_REQUEST_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+      send_(ZDO_STATE_CHANGE_IND, &DEVICE_STATE_COORDINATOR, 1, START_DELAY_US);
+      started_ = true;
+      break;
+    case MT_UTIL_GET_DEVICE_INFO: {
+      // status, IEEE address (FFFF + ecu address), short address, device type, device state, no associated devices
+      uint8_t info[14] = {0x00, 0xFF, 0xFF};
+      memcpy(info + 3, ecu_address_, 6);
+      info[11] = 0x07;
+      info[12] = started_ ? DEVICE_STATE_COORDINATOR : 0x00;
+      send_(MT_UTIL_GET_DEVICE_INFO_SRSP, info, sizeof(info), SRSP_DELAY_US);
+      break;
+    }
+    case MT_AF_DATA_REQUEST:
+      handle_data_request_(frame);
+      break;
+    case MT_AF_DATA_REQUEST_EXT:
+      handle_pair_request_(frame);
+      break;
+    case MT_ZDO_MGMT_LQI_REQ:
+      send_(MT_ZDO_MGMT_LQI_REQ_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+      handle_lqi_request_(frame);
+      break;
+    default:
+      ESP_LOGW(TAG, "unhandled command %04X", frame.command);
+      break;
+  }
+}
+
+void Cc2530Emulator::handle_data_request_(const MtFrame &frame) {
+  static const uint8_t SUCCESS = 0x00;
+  send_(MT_AF_DATA_REQUEST_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+
+  // DstAddr(2) DstEndpoint SrcEndpoint ClusterId(2) TransID Options Radius Len Data
+  EmulatedInverter *target = nullptr;
+  for (auto &inv : inverters_) {
+    if (inv.joined && inv.address[0] == frame.get_u8(0) && inv.address[1] == frame.get_u8(1)) {
+      target = &inv;
+      break;
+    }
+  }
+  bool broadcast = frame.get_u8(0) == 0xFF && frame.get_u8(1) == 0xFF;
+  uint8_t confirm[3] = {target != nullptr || broadcast ? SUCCESS : AF_STATUS_NO_ROUTE, 0x14, frame.get_u8(6)};
+  send_(MT_AF_DATA_CONFIRM, confirm, sizeof(confirm), CONFIRM_DELAY_US + random_() % 10000);
+  MtFrame data = frame.slice(10);
+  if (broadcast && data.get_u8(9) == 0xBB) {
+    // every inverter in normal operation answers a broadcast poll
+    for (auto &inv : inverters_) {
+      if (!inv.joined || chance_(loss_rate_))
+        continue;
+      uint8_t answer[POLL_ANSWER_SIZE];
+      uint8_t length;
+      build_poll_answer_(inv, answer, length);
+      send_incoming_(inv, answer, length, radio_delay_());
+    }
+    return;
+  }
+  if (target == nullptr || chance_(loss_rate_))
+    return;
+
+  if (data.get_u8(9) == 0xBB) {  // poll
+    uint8_t answer[POLL_ANSWER_SIZE];
+    uint8_t length;
+    build_poll_answer_(*target, answer, length);
+    send_incoming_(*target, answer, length, radio_delay_());
+  } else if (data.get_u8(9) == 0xC1) {  // reboot
+    target->timestamp = 0;
+    target->polls = 0;
+    for (auto &energy : target->energy)
+      energy = 0;
+  }
+}
+
+// Answers with a page of the neighbor table, which lists the joined inverters
+void Cc2530Emulator::handle_lqi_request_(const MtFrame &frame) {
+  // DstAddr(2) StartIndex
+  uint8_t start = frame.get_u8(2);
+  std::vector<const EmulatedInverter *> joined;
+  for (auto &inv : inverters_) {
+    if (inv.joined)
+      joined.push_back(&inv);
+  }
+  uint8_t total = std::min<size_t>(joined.size(), UINT8_MAX);
+  uint8_t count = start < total ? std::min<uint8_t>(total - start, LQI_ENTRIES_PER_PAGE) : 0;
+  // SrcAddr(2) Status Total StartIndex Count, then the entries
+  uint8_t payload[ZDO_MGMT_LQI_RSP_ENTRIES + LQI_ENTRIES_PER_PAGE * ZDO_NEIGHBOR_SIZE] = {0x00, 0x00, 0x00};
+  payload[ZDO_MGMT_LQI_RSP_TOTAL] = total;
+  payload[ZDO_MGMT_LQI_RSP_START_INDEX] = start;
+  payload[ZDO_MGMT_LQI_RSP_COUNT] = count;
+  for (uint8_t i = 0; i < count; i++) {
+    const EmulatedInverter &inv = *joined[start + i];
+    uint8_t *neighbor = payload + ZDO_MGMT_LQI_RSP_ENTRIES + i * ZDO_NEIGHBOR_SIZE;
+    // the ieee address is FFFF + serial, little endian
+    uint8_t *ieee = neighbor + ZDO_NEIGHBOR_IEEE_ADDR;
+    ieee[0] = 0xFF;
+    ieee[1] = 0xFF;
+    for (uint8_t j = 0; j < 6; j++)
+      ieee[2 + j] = inv.serial[5 - j];
+    memcpy(neighbor + ZDO_NEIGHBOR_SHORT_ADDR, inv.address, 2);
+    neighbor[18] = 0x25;  // router, receiver on when idle, child
+    neighbor[20] = 0x01;  // depth
+    neighbor[ZDO_NEIGHBOR_LQI] = inv.link_quality;
+  }
+  send_(MT_ZDO_MGMT_LQI_RSP, payload, ZDO_MGMT_LQI_RSP_ENTRIES + count * ZDO_NEIGHBOR_SIZE, CONFIRM_DELAY_US);
+}
+
+void Cc2530Emulator::handle_pair_request_(const MtFrame &frame) {
+  static const uint8_t SUCCESS = 0x00;
+  send_(MT_AF_DATA_REQUEST_EXT_SRSP, &SUCCESS, 1, SRSP_DELAY_US);
+  // DstAddrMode DstAddr(8) DstEndpoint DstPanId(2) SrcEndpoint ClusterId(2) TransID Options Radius Len(2) Data
+  uint8_t step = frame.get_u8(15);
+  uint8_t confirm[3] = {SUCCESS, 0x14, step};
+  send_(MT_AF_DATA_CONFIRM, confirm, sizeof(confirm), CONFIRM_DELAY_US);
+
+  // the inverter answers the commands 1 and 2 which carry its serial
+  if (step != 1 && step != 2)
+    return;
+  MtFrame data = frame.slice(20);
+  for (auto &inv : inverters_) {
+    if (data.length < 6 || memcmp(data.payload, inv.serial, 6) != 0)
+      continue;
+    if (chance_(loss_rate_))
+      return;
+    // the answer carries the serial followed by the short address the inverter uses
+    uint8_t answer[20] = {0xFB, 0xFB, 0x10, 0x00};
+    memcpy(answer + 4, inv.serial, 6);
+    memcpy(answer + 10, inv.address, 2);
+    memcpy(answer + 12, ecu_address_, 6);
+    answer[18] = 0xFE;
+    answer[19] = 0xFE;
+    inv.joined = true;
+    send_incoming_(inv, answer, sizeof(answer), radio_delay_());
+    return;
+  }
+}
+
+// Builds a poll answer in the layout of the inverter type, with the energy counters advanced by the time since
+// the last poll
+void Cc2530Emulator::build_poll_answer_(EmulatedInverter &inv, uint8_t *data, uint8_t &length) {
+  length = POLL_ANSWER_SIZE;
+  memset(data, 0, length);
+  uint32_t now = millis();
+  uint16_t elapsed = inv.polls == 0 ? 0 : std::max<uint32_t>(1, (now - inv.last_poll) / 1000);
+  inv.last_poll = now;
+  inv.polls++;
+  inv.timestamp += elapsed;
+
+  auto put16 = [data](uint8_t offset, uint32_t value) {
+    data[offset] = value >> 8;
+    data[offset + 1] = value;
+  };
+  // a bit of noise so consecutive answers differ
+  float jitter = 1.0f + ((int) (random_() % 21) - 10) / 1000.0f;
+  float voltage = inv.dc_voltage * jitter;
+  float current = inv.dc_current * jitter;
+  float wh = voltage * current * 0.95f * elapsed / 3600.0f;
+  int panels = inv.type == INVERTER_TYPE_QS1 ? 4 : 2;
+
+  if (inv.type == INVERTER_TYPE_DS3) {
+    for (int i = 0; i < 2; i++) {
+      put16(26 + 2 * i, voltage * 48.0f);
+      put16(30 + 2 * i, current / 0.0125f);
+    }
+    put16(34, 230.0f * 3.8f);
+    put16(36, 5000);
+    put16(38, inv.timestamp);
+    put16(48, (35.0f + 23.84f) / 0.0198f);
+    for (int i = 0; i < 2; i++) {
+      inv.energy[i] += wh * 100000.0f / 1.66f;
+      put16(50 + 4 * i, inv.energy[i] >> 16);
+      put16(52 + 4 * i, inv.energy[i] & 0xFFFF);
+    }
+    return;
+  }
+
+  put16(10, (35.0f + 258.7f) / 0.2752f);
+  uint32_t period = 50000000 / 50;
+  data[12] = period >> 16;
+  put16(13, period & 0xFFFF);
+  put16(28, 230.0f * 5.3108f);
+  // 12 bit voltage (byte + high nibble of the byte before) and current (low nibble + byte before)
+  static const uint8_t CHANNEL_OFFSETS[] = {22, 25, 19, 16};
+  uint16_t v = voltage * 4096.0f / 82.5f;
+  uint16_t c = current * 4096.0f / 27.5f;
+  for (int i = 0; i < panels; i++) {
+    uint8_t o = CHANNEL_OFFSETS[i];
+    data[o] = c & 0xFF;
+    data[o + 1] = ((v & 0x0F) << 4) | ((c >> 8) & 0x0F);
+    data[o + 2] = v >> 4;
+  }
+  put16(inv.type == INVERTER_TYPE_QS1 ? 30 : 17, inv.timestamp);
+  for (int i = 0; i < panels; i++) {
+    inv.energy[i] += wh * 3600.0f / 8.311f;
+    data[37 + 5 * i] = inv.energy[i] >> 16;
+    put16(38 + 5 * i, inv.energy[i] & 0xFFFF);
+  }
+}
+
+void Cc2530Emulator::send_incoming_(const EmulatedInverter &inv, const uint8_t *data, uint8_t length,
+                                    uint32_t delay_us) {
+  // GroupId(2) ClusterId(2) SrcAddr(2) SrcEndpoint DstEndpoint WasBroadcast LinkQuality SecurityUse Timestamp(4)
+  // TransSeqNumber Len Data
+  uint8_t payload[MT_MAX_PAYLOAD_SIZE] = {0x00, 0x00, 0x06, 0x00};
+  memcpy(payload + AF_INCOMING_MSG_SRC_ADDR, inv.address, 2);
+  payload[6] = 0x14;
+  payload[7] = 0x14;
+  payload[AF_INCOMING_MSG_LINK_QUALITY] = inv.link_quality;
+  payload[AF_INCOMING_MSG_DATA_LENGTH] = length;
+  memcpy(payload + AF_INCOMING_MSG_DATA, data, length);
+  send_(MT_AF_INCOMING_MSG, payload, AF_INCOMING_MSG_DATA + length, delay_us);
+}
+
+void Cc2530Emulator::send_(uint16_t command, const uint8_t *payload, uint8_t length, uint32_t delay_us) {
+  MtFrameBuilder frame(command);
+  frame.add(payload, length);
+  const uint8_t *raw = frame.finish();
+  PendingFrame pending{now_us_() + delay_us, std::vector<uint8_t>(raw, raw + frame.get_size())};
+  if (chance_(corruption_rate_))
+    pending.data[random_() % pending.data.size()] ^= 1 << (random_() % 8);
+  auto it = pending_.end();
+  while (it != pending_.begin() && (it - 1)->ready_at > pending.ready_at)
+    --it;
+  pending_.insert(it, std::move(pending));
+  frames_sent_++;
+}
+
+// Moves the frames whose time has come onto the wire, one after the other at the uart byte rate
+void Cc2530Emulator::transmit_() {
+  uint64_t now = now_us_();
+  while (!pending_.empty() && pending_.front().ready_at <= now) {
+    uint64_t at = std::max(pending_.front().ready_at, wire_free_at_);
+    for (uint8_t value : pending_.front().data) {
+      at += BYTE_TIME_US;
+      wire_.push_back(PendingByte{at, value});
+    }
+    wire_free_at_ = at;
+    pending_.pop_front();
+  }
+}
+
+uint64_t Cc2530Emulator::now_us_() {
+  uint32_t now = micros();
+  if (now < last_micros_)
+    micros_high_ += 1ULL << 32;
+  last_micros_ = now;
+  return micros_high_ | now;
+}
+
+uint32_t Cc2530Emulator::radio_delay_() {
+  if (latency_max_us_ == latency_min_us_)
+    return latency_min_us_;
+  return latency_min_us_ + random_() % (latency_max_us_ - latency_min_us_);
+}
+
+bool Cc2530Emulator::chance_(float rate) { return rate > 0.0f && (random_() % 10000) < rate * 10000.0f; }
+
+void EmulatorResetPin::digital_write(bool value) {
+  value_ = value;
+  parent_->set_reset_line(value != inverted_);
+}
+
+}  // namespace emulator
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+#include "esphome/core/gpio.h"
+#include "esphome/components/uart/uart.h"
+#include "esphome/components/apsystems/apsystems.h"
+#include "esphome/components/apsystems/mt_frame.h"
+
+namespace esphome {
+namespace apsystems {
+namespace emulator {
+
+struct EmulatedInverter {
+  uint8_t serial[6];
+  uint8_t address[2];
+  InverterType type;
+  bool joined;  // answers polls, otherwise only pairing requests
+  uint8_t link_quality;
+  float dc_voltage;
+  float dc_current;
+  uint32_t energy[4];
+  uint16_t timestamp;
+  uint32_t last_poll;
+  uint32_t polls;
+};
+
+// Emulates a cc2530 running the APsystems ZNP firmware plus the inverters on its channel. It takes the place of
+// the uart bus and the coordinator reset pin of the apsystems component, so the component can run on the host
+// platform without hardware. Bytes become readable once their wire time at 115200 baud has passed.
+class Cc2530Emulator : public uart::UARTComponent, public Component {
+ public:
+  Cc2530Emulator();
+  void set_apsystems(Apsystems *apsystems) { apsystems_ = apsystems; }
+  void set_ecu_id(const std::string &ecu_id);
+  // Answer delay of the inverters, uniformly distributed
+  void set_latency(uint32_t min_us, uint32_t max_us);
+  void set_loss_rate(float rate) { loss_rate_ = rate; }
+  void set_corruption_rate(float rate) { corruption_rate_ = rate; }
+  void set_seed(uint32_t seed) { random_.seed(seed); }
+  // A hanging coordinator stops answering until it is reset
+  void set_hanging(bool hanging) { hanging_ = hanging; }
+  EmulatedInverter &add_inverter(const char *serial, InverterType type, uint16_t address, bool joined = true);
+  std::vector<EmulatedInverter> &get_inverters() { return inverters_; }
+  void set_reset_line(bool value);
+
+  void setup() override;
+  void dump_config() override;
+  float get_setup_priority() const override { return setup_priority::BUS; }
+
+  uint32_t get_frames_received() const { return frames_received_; }
+  uint32_t get_frames_sent() const { return frames_sent_; }
+  uint32_t get_resets() const { return resets_; }
+
+  // uart::UARTComponent
+  void write_array(const uint8_t *data, size_t len) override;
+  bool peek_byte(uint8_t *data) override;
+  bool read_array(uint8_t *data, size_t len) override;
+  int available() override;
+  void flush() override {}
+
+ protected:
+  void check_logger_conflict() override {}
+  void handle_request_(const MtFrame &frame);
+  void handle_data_request_(const MtFrame &frame);
+  void handle_pair_request_(const MtFrame &frame);
+  void handle_lqi_request_(const MtFrame &frame);
+  void send_(uint16_t command, const uint8_t *payload, uint8_t length, uint32_t delay_us);
+  void send_incoming_(const EmulatedInverter &inv, const uint8_t *data, uint8_t length, uint32_t delay_us);
+  void build_poll_answer_(EmulatedInverter &inv, uint8_t *data, uint8_t &length);
+  uint32_t radio_delay_();
+  bool chance_(float rate);
+  uint64_t now_us_();
+  void transmit_();
+
+  struct PendingFrame {
+    uint64_t ready_at;
+    std::vector<uint8_t> data;
+  };
+  struct PendingByte {
+    uint64_t at;
+    uint8_t value;
+  };
+  Apsystems *apsystems_{nullptr};
+  std::deque<PendingFrame> pending_;  // answers by the time they are ready
+  std::deque<PendingByte> wire_;      // bytes on the wire by the time they were received
+  uint64_t wire_free_at_{0};
+  uint32_t last_micros_{0};
+  uint64_t micros_high_{0};
+  MtFrameParser parser_;
+  std::vector<EmulatedInverter> inverters_;
+  uint8_t ecu_address_[6]{0};
+  bool reset_line_{true};
+  bool started_{false};
+  bool hanging_{false};
+  uint32_t latency_min_us_{20000};
+  uint32_t latency_max_us_{60000};
+  float loss_rate_{0.0f};
+  float corruption_rate_{0.0f};
+  std::mt19937 random_{42};
+  uint32_t frames_received_{0};
+  uint32_t frames_sent_{0};
+  uint32_t resets_{0};
+};
+
+// The coordinator reset line of the emulator
+class EmulatorResetPin : public GPIOPin {
+ public:
+  void set_parent(Cc2530Emulator *parent) { parent_ = parent; }
+  void set_inverted(bool inverted) { inverted_ = inverted; }
+  void setup() override {}
+  void pin_mode(gpio::Flags flags) override {}
+  bool digital_read() override { return value_; }
+  void digital_write(bool value) override;
+  std::string dump_summary() const override { return "cc2530 emulator reset"; }
+
+ protected:
+  Cc2530Emulator *parent_;
+  bool inverted_{false};
+  bool value_{true};
+};
+
+}  // namespace emulator
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,78 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components.apsystems import Apsystems, apsystems_ns, CONF_SERIAL
+from esphome.const import CONF_ID
+
+CODEOWNERS = ["@derrohrbach"]
+
+DEPENDENCIES = ["apsystems"]
+
+CONF_COORDINATORS = "coordinators"
+CONF_REBALANCE_INTERVAL = "rebalance_interval"
+CONF_MIN_SIGNAL_QUALITY = "min_signal_quality"
+CONF_MIN_SUCCESS_RATE = "min_success_rate"
+CONF_BALANCE_LOAD = "balance_load"
+MAX_COORDINATORS = 4
+
+fleet_ns = apsystems_ns.namespace("fleet")
+FleetManager = fleet_ns.class_("FleetManager", cg.Component)
+FleetPairInverterAction = fleet_ns.class_("FleetPairInverterAction", automation.Action)
+FleetPollInverterAction = fleet_ns.class_("FleetPollInverterAction", automation.Action)
+FleetRebootInverterAction = fleet_ns.class_(
+    "FleetRebootInverterAction", automation.Action
+)
+
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(FleetManager),
+        cv.Required(CONF_COORDINATORS): cv.All(
+            cv.ensure_list(cv.use_id(Apsystems)),
+            cv.Length(min=2, max=MAX_COORDINATORS),
+        ),
+        cv.Optional(
+            CONF_REBALANCE_INTERVAL, "10min"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MIN_SIGNAL_QUALITY, "20%"): cv.percentage,
+        cv.Optional(CONF_MIN_SUCCESS_RATE, "80%"): cv.percentage,
+        cv.Optional(CONF_BALANCE_LOAD, True): cv.boolean,
+    }
+).extend(cv.COMPONENT_SCHEMA)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    for coordinator in config[CONF_COORDINATORS]:
+        parent = await cg.get_variable(coordinator)
+        cg.add(var.add_coordinator(parent))
+    cg.add(var.set_rebalance_interval(config[CONF_REBALANCE_INTERVAL]))
+    cg.add(var.set_min_signal_quality(config[CONF_MIN_SIGNAL_QUALITY]))
+    cg.add(var.set_min_success_rate(config[CONF_MIN_SUCCESS_RATE]))
+    cg.add(var.set_balance_load(config[CONF_BALANCE_LOAD]))
+
+
+FLEET_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_ID): cv.use_id(FleetManager),
+        cv.Required(CONF_SERIAL): cv.templatable(cv.string),
+    }
+)
+
+
+@automation.register_action(
+    "apsystems_fleet.pair_inverter", FleetPairInverterAction, FLEET_ACTION_SCHEMA
+)
+@automation.register_action(
+    "apsystems_fleet.poll_inverter", FleetPollInverterAction, FLEET_ACTION_SCHEMA
+)
+@automation.register_action(
+    "apsystems_fleet.reboot_inverter", FleetRebootInverterAction, FLEET_ACTION_SCHEMA
+)
+async def actions_to_code(config, action_id, template_arg, args):
+    paren = await cg.get_variable(config[CONF_ID])
+    var = cg.new_Pvariable(action_id, template_arg, paren)
+    template_ = await cg.templatable(config[CONF_SERIAL], args, cg.std_string)
+    cg.add(var.set_serial(template_))
+    return var
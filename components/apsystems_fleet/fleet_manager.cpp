@@ -0,0 +1,305 @@
+#include "fleet_manager.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace apsystems {
+namespace fleet {
+
+static const char *const TAG = "apsystems_fleet";
+
+static uint16_t blob_crc(const FleetBlob &blob) {
+  uint16_t crc = crc16(reinterpret_cast<const uint8_t *>(&blob.count), sizeof(blob.count));
+  return crc16(reinterpret_cast<const uint8_t *>(blob.records), blob.count * sizeof(FleetRecord), crc);
+}
+
+void FleetManager::setup() {
+  for (uint8_t c = 0; c < coordinators_.size(); c++) {
+    for (auto inv : coordinators_[c]->get_inverters()) {
+      FleetMember member{inv, c, c, 0, false, {}};
+      memset(member.quality, QUALITY_UNKNOWN, sizeof(member.quality));
+      members_.push_back(member);
+    }
+  }
+  size_t slots = (members_.size() + FLEET_SLOT_RECORDS - 1) / FLEET_SLOT_RECORDS;
+  for (size_t s = 0; s < slots; s++) {
+    prefs_.push_back(global_preferences->make_preference<FleetBlob>(
+        fnv1_hash(str_sprintf("apsystems_fleet_%u", (unsigned) s)), true));
+  }
+  restore_();
+  last_rebalance_ = millis();
+}
+
+void FleetManager::loop() {
+  uint32_t now = millis();
+  if (now - last_rebalance_ < rebalance_interval_)
+    return;
+  last_rebalance_ = now;
+  rebalance_();
+}
+
+void FleetManager::dump_config() {
+  ESP_LOGCONFIG(TAG, "APsystems fleet:");
+  ESP_LOGCONFIG(TAG, "  Rebalance interval: %us", (unsigned) (rebalance_interval_ / 1000));
+  ESP_LOGCONFIG(TAG, "  Minimum signal quality: %u%%, minimum success rate: %u%%", min_signal_quality_,
+                min_success_rate_);
+  ESP_LOGCONFIG(TAG, "  Balance load: %s", YESNO(balance_load_));
+  ESP_LOGCONFIG(TAG, "  Moves: %u", (unsigned) moves_);
+  for (uint8_t c = 0; c < coordinators_.size(); c++)
+    ESP_LOGCONFIG(TAG, "  Coordinator %u: %u inverters", c, get_load_(c));
+  for (auto &member : members_) {
+    if (member.current != member.home)
+      ESP_LOGCONFIG(TAG, "    Inverter %s: coordinator %u (configured at %u)", member.inverter->get_serial(),
+                    member.current, member.home);
+  }
+}
+
+FleetMember *FleetManager::find_member_(const char *serial) {
+  for (auto &member : members_) {
+    if (strcmp(serial, member.inverter->get_serial()) == 0)
+      return &member;
+  }
+  return nullptr;
+}
+
+uint8_t FleetManager::get_load_(uint8_t coordinator) const {
+  uint8_t load = 0;
+  for (auto &member : members_) {
+    if (member.current == coordinator)
+      load++;
+  }
+  return load;
+}
+
+bool FleetManager::is_degraded_(const FleetMember &member, uint16_t polls, uint16_t failed) const {
+  // unpaired inverters aren't polled, only a failed pairing rates their link, once it had its cooldown to settle
+  if (!member.inverter->is_paired())
+    return member.pair_failed && member.cooldown == 0;
+  if (polls < FLEET_MIN_POLLS)
+    return false;
+  return member.quality[member.current] < min_signal_quality_ ||
+         (polls - failed) * 100 < min_success_rate_ * polls;
+}
+
+// Rates the links of the last interval, then moves at most one inverter: the one with the worst degraded link, or
+// for the load balance if no link is degraded.
+void FleetManager::rebalance_() {
+  std::vector<bool> degraded(members_.size(), false);
+  bool any_degraded = false;
+  for (size_t i = 0; i < members_.size(); i++) {
+    FleetMember &member = members_[i];
+    Inverter *inv = member.inverter;
+    uint16_t polls = inv->get_polls();
+    uint16_t failed = inv->get_failed_polls();
+    if (!inv->is_paired()) {
+      member.quality[member.current] = 0;
+    } else if (polls >= FLEET_MIN_POLLS) {
+      int32_t signal = inv->get_store()->signal_quality(inv->get_slot());
+      uint8_t success = (polls - failed) * 100 / polls;
+      // the signal quality of the last answer, 0 if no poll got one
+      member.quality[member.current] = signal == VALUE_UNKNOWN ? 0 : std::min<int32_t>(signal / 1000, success);
+    }
+    degraded[i] = is_degraded_(member, polls, failed);
+    any_degraded |= degraded[i];
+    if (polls >= FLEET_MIN_POLLS)
+      inv->reset_poll_statistics();
+    if (member.cooldown > 0)
+      member.cooldown--;
+  }
+  if (any_degraded && move_degraded_(degraded))
+    return;
+  if (balance_load_)
+    move_for_load_();
+}
+
+bool FleetManager::move_degraded_(const std::vector<bool> &degraded) {
+  FleetMember *worst = nullptr;
+  for (size_t i = 0; i < members_.size(); i++) {
+    FleetMember &member = members_[i];
+    if (!degraded[i] || member.cooldown > 0)
+      continue;
+    if (worst == nullptr || member.quality[member.current] < worst->quality[worst->current])
+      worst = &member;
+  }
+  if (worst == nullptr)
+    return false;
+
+  // a coordinator the inverter had a better link with or wasn't tried with yet, the least loaded one of them
+  uint8_t current_quality = worst->quality[worst->current];
+  int target = -1;
+  for (uint8_t c = 0; c < coordinators_.size(); c++) {
+    if (c == worst->current || !coordinators_[c]->get_coordinator().is_ready())
+      continue;
+    uint8_t quality = worst->quality[c];
+    if (quality != QUALITY_UNKNOWN && quality <= current_quality)
+      continue;
+    if (target < 0 || get_load_(c) < get_load_(target))
+      target = c;
+  }
+  if (target < 0) {
+    ESP_LOGD(TAG, "Inverter %s has a degraded link, no coordinator has a better one", worst->inverter->get_serial());
+    return false;
+  }
+  ESP_LOGI(TAG, "Inverter %s has a degraded link (%u%%), moving it to coordinator %d", worst->inverter->get_serial(),
+           current_quality, target);
+  return move_(*worst, target, true);
+}
+
+bool FleetManager::move_for_load_() {
+  int most = -1;
+  int least = -1;
+  for (uint8_t c = 0; c < coordinators_.size(); c++) {
+    if (!coordinators_[c]->get_coordinator().is_ready())
+      continue;
+    if (most < 0 || get_load_(c) > get_load_(most))
+      most = c;
+    if (least < 0 || get_load_(c) < get_load_(least))
+      least = c;
+  }
+  if (most < 0 || get_load_(most) < get_load_(least) + 2)
+    return false;
+
+  // the inverter with the worst link moves, it has the least to lose
+  FleetMember *candidate = nullptr;
+  for (auto &member : members_) {
+    if (member.current != most || member.cooldown > 0 || member.quality[least] == 0)
+      continue;
+    if (candidate == nullptr || member.quality[most] < candidate->quality[most])
+      candidate = &member;
+  }
+  if (candidate == nullptr)
+    return false;
+  ESP_LOGI(TAG, "Moving inverter %s from coordinator %d to %d to balance the load", candidate->inverter->get_serial(),
+           most, least);
+  return move_(*candidate, least, true);
+}
+
+bool FleetManager::move_(FleetMember &member, uint8_t target, bool pair) {
+  Inverter *inv = member.inverter;
+  if (!coordinators_[member.current]->release_inverter(inv)) {
+    ESP_LOGD(TAG, "Inverter %s is busy, moving it later", inv->get_serial());
+    return false;
+  }
+  inv->reset_poll_statistics();
+  member.current = target;
+  member.cooldown = FLEET_MOVE_COOLDOWN;
+  member.pair_failed = false;
+  moves_++;
+  size_t index = &member - members_.data();
+  coordinators_[target]->adopt_inverter(inv, pair, [this, index, target](bool success) {
+    FleetMember &moved = members_[index];
+    moved.pair_failed = !success;
+    if (!success)
+      ESP_LOGW(TAG, "Pairing inverter %s with coordinator %u failed", moved.inverter->get_serial(), target);
+  });
+  save_();
+  return true;
+}
+
+void FleetManager::save_() {
+  bool saved = true;
+  for (size_t s = 0; s < prefs_.size(); s++) {
+    size_t first = s * FLEET_SLOT_RECORDS;
+    FleetBlob blob{};
+    blob.count = std::min<size_t>(members_.size() - first, FLEET_SLOT_RECORDS);
+    for (uint16_t i = 0; i < blob.count; i++) {
+      blob.records[i].serial_hash = fnv1_hash(members_[first + i].inverter->get_serial());
+      blob.records[i].coordinator = members_[first + i].current;
+    }
+    blob.crc = blob_crc(blob);
+    saved &= prefs_[s].save(&blob);
+  }
+  // moves are rare, they are synced right away so a reboot doesn't have to pair the inverter again
+  if (!saved || !global_preferences->sync())
+    ESP_LOGW(TAG, "Saving the coordinators of the inverters failed");
+}
+
+void FleetManager::restore_() {
+  for (size_t s = 0; s < prefs_.size(); s++) {
+    FleetBlob blob{};
+    if (!prefs_[s].load(&blob))
+      continue;  // no inverter of the slot was moved yet
+    if (blob.count > FLEET_SLOT_RECORDS || blob.crc != blob_crc(blob)) {
+      ESP_LOGW(TAG, "Stored coordinators of slot %u are invalid, their inverters stay at home", (unsigned) s);
+      continue;
+    }
+    // the inverters of a slot change with the config, the records are matched by serial
+    for (uint16_t i = 0; i < blob.count; i++)
+      restore_record_(blob.records[i]);
+  }
+}
+
+void FleetManager::restore_record_(const FleetRecord &record) {
+  for (auto &member : members_) {
+    if (fnv1_hash(member.inverter->get_serial()) != record.serial_hash)
+      continue;
+    if (record.coordinator == member.current)
+      return;
+    if (record.coordinator >= coordinators_.size()) {
+      ESP_LOGW(TAG, "Inverter %s was stored at coordinator %u, which is not configured anymore",
+               member.inverter->get_serial(), record.coordinator);
+      return;
+    }
+    if (!coordinators_[member.current]->release_inverter(member.inverter)) {
+      ESP_LOGW(TAG, "Inverter %s can't be restored at coordinator %u", member.inverter->get_serial(),
+               record.coordinator);
+      return;
+    }
+    // still paired with the coordinator it was moved to
+    member.current = record.coordinator;
+    coordinators_[member.current]->adopt_inverter(member.inverter, false);
+    ESP_LOGD(TAG, "Inverter %s restored at coordinator %u", member.inverter->get_serial(), member.current);
+    return;
+  }
+}
+
+template<typename F> void FleetManager::run_command_(const char *serial, CommandCallback &&callback, F &&start) {
+  if (strcmp(serial, "*") == 0) {
+    // each coordinator works through its own inverters, all of them at once
+    CommandCallback group = make_group_callback(coordinators_.size(), std::move(callback));
+    for (auto coordinator : coordinators_)
+      start(coordinator->get_coordinator(), "*", CommandCallback(group));
+    return;
+  }
+  FleetMember *member = find_member_(serial);
+  if (member == nullptr) {
+    ESP_LOGE(TAG, "Inverter with serial %s is not configured", serial);
+    if (callback)
+      callback(false);
+    return;
+  }
+  start(coordinators_[member->current]->get_coordinator(), serial, std::move(callback));
+}
+
+void FleetManager::pair_inverter(const char *serial, CommandCallback &&callback) {
+  run_command_(serial, std::move(callback), [](ZigbeeCoordinator &c, const char *s, CommandCallback &&cb) {
+    c.start_pair_inverter(s, std::move(cb));
+  });
+}
+
+void FleetManager::poll_inverter(const char *serial, CommandCallback &&callback) {
+  run_command_(serial, std::move(callback), [](ZigbeeCoordinator &c, const char *s, CommandCallback &&cb) {
+    c.start_poll_inverter(s, std::move(cb));
+  });
+}
+
+void FleetManager::reboot_inverter(const char *serial, CommandCallback &&callback) {
+  if (strcmp(serial, "*") == 0 && !members_.empty()) {
+    // the coordinators reboot single inverters only
+    CommandCallback group = make_group_callback(members_.size(), std::move(callback));
+    for (auto &member : members_)
+      coordinators_[member.current]->get_coordinator().start_reboot_inverter(member.inverter->get_serial(),
+                                                                             CommandCallback(group));
+    return;
+  }
+  run_command_(serial, std::move(callback), [](ZigbeeCoordinator &c, const char *s, CommandCallback &&cb) {
+    c.start_reboot_inverter(s, std::move(cb));
+  });
+}
+
+}  // namespace fleet
+}  // namespace apsystems
+}  // namespace esphome
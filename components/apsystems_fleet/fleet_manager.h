@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "esphome/core/automation.h"
+#include "esphome/core/component.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/apsystems/apsystems.h"
+
+namespace esphome {
+namespace apsystems {
+namespace fleet {
+
+static const uint8_t FLEET_MAX_COORDINATORS = 4;
+static const uint8_t QUALITY_UNKNOWN = 0xFF;
+// polls an inverter needs in a rebalance interval before its link is rated
+static const uint16_t FLEET_MIN_POLLS = 3;
+// rebalance intervals a moved inverter stays with its new coordinator at least
+static const uint8_t FLEET_MOVE_COOLDOWN = 6;
+
+struct FleetMember {
+  Inverter *inverter;
+  uint8_t home;     // coordinator the inverter is configured at
+  uint8_t current;  // coordinator the inverter is paired with
+  uint8_t cooldown;
+  bool pair_failed;  // pairing with the current coordinator failed
+  uint8_t quality[FLEET_MAX_COORDINATORS];  // [%] last signal quality seen through each coordinator
+};
+
+// Records of a preference slot, fixed so the stored size doesn't change with the config
+static const uint8_t FLEET_SLOT_RECORDS = 16;
+
+// Coordinator of every inverter, stored so a reboot doesn't have to pair them again
+struct __attribute__((packed)) FleetRecord {
+  uint32_t serial_hash;
+  uint8_t coordinator;
+};
+// A preference slot with the records of up to FLEET_SLOT_RECORDS inverters, the crc covers count and the records
+struct __attribute__((packed)) FleetBlob {
+  uint16_t count;
+  uint16_t crc;
+  FleetRecord records[FLEET_SLOT_RECORDS];
+};
+
+// Spreads the inverters of several apsystems components, each with its own cc2530, over their coordinators.
+// Every rebalance interval it rates the link of each inverter by its poll success rate and signal quality. An
+// inverter with a degraded link is paired again through the coordinator it had the best link with, or one it
+// wasn't tried with yet. If the coordinators carry uneven loads, an inverter moves to the least loaded one. At most
+// one inverter moves per interval, and a moved inverter stays for a few intervals, so links settle before they are
+// rated again. Each coordinator polls its inverters on its own, so sweeps over the fleet run on all of them at once.
+class FleetManager : public Component {
+ public:
+  void add_coordinator(Apsystems *apsystems) { coordinators_.push_back(apsystems); }
+  void set_rebalance_interval(uint32_t rebalance_interval) { rebalance_interval_ = rebalance_interval; }
+  void set_min_signal_quality(float min_signal_quality) { min_signal_quality_ = min_signal_quality * 100; }
+  void set_min_success_rate(float min_success_rate) { min_success_rate_ = min_success_rate * 100; }
+  void set_balance_load(bool balance_load) { balance_load_ = balance_load; }
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  // after the apsystems components, which set up their inverters first
+  float get_setup_priority() const override { return setup_priority::DATA - 1.0f; }
+
+  // Commands routed to the coordinator the inverter is paired with, "*" runs on all coordinators in parallel
+  void pair_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  void poll_inverter(const char *serial, CommandCallback &&callback = nullptr);
+  void reboot_inverter(const char *serial, CommandCallback &&callback = nullptr);
+
+ protected:
+  FleetMember *find_member_(const char *serial);
+  uint8_t get_load_(uint8_t coordinator) const;
+  bool is_degraded_(const FleetMember &member, uint16_t polls, uint16_t failed) const;
+  void rebalance_();
+  bool move_degraded_(const std::vector<bool> &degraded);
+  bool move_for_load_();
+  bool move_(FleetMember &member, uint8_t target, bool pair);
+  void save_();
+  void restore_();
+  void restore_record_(const FleetRecord &record);
+  template<typename F> void run_command_(const char *serial, CommandCallback &&callback, F &&start);
+
+  std::vector<Apsystems *> coordinators_{};
+  std::vector<FleetMember> members_{};
+  std::vector<ESPPreferenceObject> prefs_{};  // one per slot
+  uint32_t rebalance_interval_{600000};
+  uint32_t last_rebalance_{0};
+  uint8_t min_signal_quality_{20};  // [%]
+  uint8_t min_success_rate_{80};    // [%]
+  bool balance_load_{true};
+  uint32_t moves_{0};
+};
+
+template<typename... Ts> class FleetPairInverterAction : public Action<Ts...> {
+ public:
+  FleetPairInverterAction(FleetManager *fleet) : fleet_(fleet) {}
+
+  TEMPLATABLE_VALUE(std::string, serial)
+
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->fleet_->pair_inverter(serial_.value(x...).c_str(), [this, x...](bool) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
+
+ protected:
+  FleetManager *fleet_;
+};
+
+template<typename... Ts> class FleetPollInverterAction : public Action<Ts...> {
+ public:
+  FleetPollInverterAction(FleetManager *fleet) : fleet_(fleet) {}
+
+  TEMPLATABLE_VALUE(std::string, serial)
+
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->fleet_->poll_inverter(serial_.value(x...).c_str(), [this, x...](bool) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
+
+ protected:
+  FleetManager *fleet_;
+};
+
+template<typename... Ts> class FleetRebootInverterAction : public Action<Ts...> {
+ public:
+  FleetRebootInverterAction(FleetManager *fleet) : fleet_(fleet) {}
+
+  TEMPLATABLE_VALUE(std::string, serial)
+
+  // the action completes once the command finished on the coordinator
+  void play_complex(Ts... x) override {
+    this->num_running_++;
+    this->fleet_->reboot_inverter(serial_.value(x...).c_str(), [this, x...](bool) { this->play_next_(x...); });
+  }
+  void play(Ts... x) override { /* ignore - see play_complex */ }
+
+ protected:
+  FleetManager *fleet_;
+};
+
+}  // namespace fleet
+}  // namespace apsystems
+}  // namespace esphome
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Generates an ESPHome host configuration running the apsystems component against the cc2530 emulator.
+
+The configuration polls the whole fleet in a loop and logs the time every sweep took. Build and run it with
+`esphome run fleet.yaml`, the resident memory of the process can be watched with the usual host tools.
+"""
+
+import argparse
+import random
+
+TYPES = ["yc600", "qs1", "ds3"]
+PANELS = {"yc600": 2, "qs1": 4, "ds3": 2}
+
+HEADER = """\
+esphome:
+  name: apsystems-fleet
+
+host:
+
+logger:
+  level: {log_level}
+
+external_components:
+  - source:
+      type: local
+      path: {components}
+
+time:
+  - platform: host
+
+apsystems_emulator:
+  id: emulator
+  apsystems_id: aps1
+  latency_min: {latency_min}
+  latency_max: {latency_max}
+  loss_rate: {loss_rate}%
+  corruption_rate: {corruption_rate}%
+  seed: {seed}
+
+apsystems:
+  id: aps1
+  uart_id: emulator
+  coordinator_reset_pin:
+    apsystems_emulator: emulator
+  auto_pair: {auto_pair}
+  update_interval: {update_interval}
+
+globals:
+  - id: sweep_started
+    type: uint32_t
+
+interval:
+  - interval: {sweep_interval}
+    then:
+      - lambda: id(sweep_started) = millis();
+      - apsystems.poll_inverter:
+          id: aps1
+          serial: "*"
+      - logger.log:
+          format: "sweep of {count} inverters took %u ms"
+          args: ["millis() - id(sweep_started)"]
+          level: INFO
+
+sensor:
+"""
+
+INVERTER = """\
+  - platform: apsystems
+    apsystems_id: aps1
+    serial: "{serial}"
+    type: {type}
+{pair_id}    panels:
+      connected: [{connected}]
+    power:
+      name: "Power {serial}"
+    energy:
+      name: "Energy {serial}"
+"""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("count", type=int, help="number of emulated inverters")
+    parser.add_argument("--components", default="../components")
+    parser.add_argument("--latency-min", default="20ms")
+    parser.add_argument("--latency-max", default="60ms")
+    parser.add_argument("--loss-rate", type=float, default=0)
+    parser.add_argument("--corruption-rate", type=float, default=0)
+    parser.add_argument("--seed", type=int, default=42)
+    parser.add_argument("--unpaired", action="store_true", help="pair the inverters on startup")
+    parser.add_argument("--update-interval", default="5min")
+    parser.add_argument("--sweep-interval", default="30s")
+    parser.add_argument("--log-level", default="INFO")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    out = [
+        HEADER.format(
+            log_level=args.log_level,
+            components=args.components,
+            latency_min=args.latency_min,
+            latency_max=args.latency_max,
+            loss_rate=args.loss_rate,
+            corruption_rate=args.corruption_rate,
+            seed=args.seed,
+            auto_pair="true" if args.unpaired else "false",
+            update_interval=args.update_interval,
+            sweep_interval=args.sweep_interval,
+            count=args.count,
+        )
+    ]
+    for i in range(args.count):
+        inverter_type = rng.choice(TYPES)
+        prefix = {"yc600": "4080", "qs1": "8010", "ds3": "7030"}[inverter_type]
+        pair_id = "" if args.unpaired else f'    pair_id: "{0x1000 + i:04X}"\n'
+        out.append(
+            INVERTER.format(
+                serial=f"{prefix}{i:08d}",
+                type=inverter_type,
+                pair_id=pair_id,
+                connected=", ".join(["true"] * PANELS[inverter_type]),
+            )
+        )
+    print("".join(out), end="")
+
+
+if __name__ == "__main__":
+    main()